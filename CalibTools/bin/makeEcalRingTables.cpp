@@ -0,0 +1,41 @@
+// One-time conversion of Endc_x_y_ring.txt + the calibEB/calibEE trees of CalibMapEtaRing
+// into the binary tables mapped by FillEpsilonPlot (parameter RingTablesBinary).
+//
+// usage: makeEcalRingTables <Endc_x_y_ring.txt> <calibMap.root> <output.bin>
+
+#include <iostream>
+#include <string>
+
+#include "FWCore/Utilities/interface/Exception.h"
+#include "CalibCode/CalibTools/interface/EcalRingTables.h"
+
+int main(int argc, char** argv)
+{
+  if(argc!=4){
+    std::cout << "usage: " << argv[0] << " <Endc_x_y_ring.txt> <calibMap.root> <output.bin>" << std::endl;
+    return 1;
+  }
+
+  EcalRingTables tables;
+  try {
+    tables.buildFromRingFile( argv[1] );
+    tables.buildFromCalibTrees( argv[2] );
+  }
+  catch(cms::Exception& e) {
+    std::cout << e.what() << std::endl;
+    return 2;
+  }
+  if( !tables.writeToFile( argv[3] ) ){
+    std::cout << "[makeEcalRingTables] :: cannot write " << argv[3] << std::endl;
+    return 3;
+  }
+
+  // read it back through the same path the fill jobs use
+  EcalRingTables check;
+  if( !check.loadFromFile( argv[3] ) ){
+    std::cout << "[makeEcalRingTables] :: written file does not load back" << std::endl;
+    return 4;
+  }
+  std::cout << "[makeEcalRingTables] :: wrote " << argv[3] << std::endl;
+  return 0;
+}
@@ -0,0 +1,228 @@
+// Merge of the fit outputs (<NameTag>Barrel_N_calibMap.root, <NameTag>Endcap_N_calibMap.root) into the
+// calibMap.root of the iteration: calibMap_EB/EEm/EEp and the calibEB/calibEE trees, as the PyROOT loop
+// of calibJobHandler.py does. The inputs are read in parallel, the output is written in one pass in the
+// order of the list. Each fit output contributes the regions [init,finit] of its "hint" histogram, or
+// those of its "fitRegions" histogram (balanced fit jobs, non-contiguous regions) when it has one; the
+// merge fails if a region of a fitted subdetector is covered by no output or by more than one.
+//
+// usage: mergeCalibMaps <output.root> <fitOutputs.txt> <nRegionsEB> <nRegionsEE> [nThreads]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TH1F.h"
+#include "TH2F.h"
+
+#include "DataFormats/EcalDetId/interface/EBDetId.h"
+#include "DataFormats/EcalDetId/interface/EEDetId.h"
+
+namespace {
+
+  const int nEBInts = 10;
+  const char* ebInts[nEBInts] = { "rawId", "hashedIndex", "ieta", "iphi", "iSM", "iMod", "iTT", "iTTeta", "iTTphi", "iter" };
+  const int nEEInts = 9;
+  const char* eeInts[nEEInts] = { "ix", "iy", "zside", "sc", "isc", "ic", "iquadrant", "hashedIndex", "iter" };
+  const int nFloats = 15;
+  const char* floats[nFloats] = { "coeff", "Signal", "Backgr", "Chisqu", "Ndof", "fit_mean", "fit_mean_err", "fit_sigma",
+                                  "fit_Snorm", "fit_b0", "fit_b1", "fit_b2", "fit_b3", "fit_Bnorm", "fit_time" };
+
+  /// one crystal of a fit output: tree entry and calibMap bin
+  struct Record {
+    Int_t   ints[nEBInts];
+    Float_t values[nFloats];
+    Int_t   attempt;
+    Int_t   iRegion;
+    float   mapValue;
+    int     binX, binY, zside;
+  };
+
+  struct FitOutput {
+    std::string name;
+    bool ok;
+    bool isEE;
+    int init, finit;
+    std::vector<int> regions;  // sorted, empty: all of [init,finit]
+    std::vector<Record> records;
+    FitOutput() : ok(false), isEE(false), init(0), finit(-1) {}
+    bool fitted(int iR) const
+    {
+      if( iR<init || iR>finit ) return false;
+      return regions.empty() || std::binary_search( regions.begin(), regions.end(), iR );
+    }
+  };
+
+  void readFitOutput(FitOutput& out)
+  {
+    TFile* f = TFile::Open( out.name.c_str() );
+    if( !f || f->IsZombie() ) { delete f; return; }
+    TH1F* hint = (TH1F*) f->Get("hint");
+    if( !hint ) { f->Close(); delete f; return; }
+    out.init  = int( hint->GetBinContent(1) );
+    out.finit = int( hint->GetBinContent(2) );
+    out.isEE  = hint->GetBinContent(3)!=0;
+    if( TH1F* mask = (TH1F*) f->Get("fitRegions") )
+      for(int iR=0; iR<mask->GetNbinsX(); iR++)
+        if( mask->GetBinContent(iR+1)>0 ) out.regions.push_back(iR);
+
+    TTree* tree = (TTree*) f->Get( out.isEE ? "calibEE" : "calibEB" );
+    TH2F* mapEB  = (TH2F*) f->Get("calibMap_EB");
+    TH2F* mapEEm = (TH2F*) f->Get("calibMap_EEm");
+    TH2F* mapEEp = (TH2F*) f->Get("calibMap_EEp");
+    if( !tree || (!out.isEE && !mapEB) || (out.isEE && (!mapEEm || !mapEEp)) ) { f->Close(); delete f; return; }
+
+    Record r = Record();
+    const int nInts = out.isEE ? nEEInts : nEBInts;
+    const char** intNames = out.isEE ? eeInts : ebInts;
+    for(int i=0; i<nInts; i++) tree->SetBranchAddress( intNames[i], (void*) &r.ints[i] );
+    // fit outputs made before fit_time existed: left at 0
+    for(int i=0; i<nFloats; i++) if( tree->GetBranch( floats[i] ) ) tree->SetBranchAddress( floats[i], (void*) &r.values[i] );
+    tree->SetBranchAddress( "fit_attempt", (void*) &r.attempt );
+    tree->SetBranchAddress( "iRegion", (void*) &r.iRegion );
+    const int hashedSlot = out.isEE ? 7 : 1;
+
+    Long64_t nentries = tree->GetEntries();
+    out.records.reserve( out.regions.empty() ? out.finit-out.init+1 : out.regions.size() );
+    for(Long64_t iEntry=0; iEntry<nentries; iEntry++){
+      tree->GetEntry(iEntry);
+      if( !out.fitted(r.iRegion) ) continue;
+      if( !out.isEE ){
+        EBDetId id = EBDetId::unhashIndex( r.ints[hashedSlot] );
+        r.binX = id.ieta()+EBDetId::MAX_IETA+1; r.binY = id.iphi(); r.zside = 0;
+        r.mapValue = mapEB->GetBinContent( r.binX, r.binY );
+      }
+      else {
+        EEDetId id = EEDetId::unhashIndex( r.ints[hashedSlot] );
+        r.binX = id.ix(); r.binY = id.iy(); r.zside = id.zside();
+        r.mapValue = (r.zside<0 ? mapEEm : mapEEp)->GetBinContent( r.binX, r.binY );
+      }
+      out.records.push_back(r);
+    }
+    f->Close();
+    delete f;
+    out.ok = true;
+  }
+
+  /// every region of a subdetector with fit outputs must come from exactly one of them
+  bool checkCoverage(const std::vector<FitOutput>& outputs, bool isEE, int nRegions)
+  {
+    std::vector<int> covered(nRegions, 0);
+    bool any = false;
+    for(size_t i=0; i<outputs.size(); i++){
+      if( outputs[i].isEE!=isEE ) continue;
+      any = true;
+      for(int iR=std::max(0, outputs[i].init); iR<=outputs[i].finit && iR<nRegions; iR++)
+        if( outputs[i].fitted(iR) ) covered[iR]++;
+    }
+    if( !any ) return true;
+    int nMissing = 0, nOverlap = 0;
+    for(int iR=0; iR<nRegions; iR++){
+      if( covered[iR]==0 ) { if( nMissing++<10 ) std::cout << "[mergeCalibMaps] :: " << (isEE ? "EE" : "EB") << " region " << iR << " not covered by any fit output" << std::endl; }
+      if( covered[iR]>1 )  { if( nOverlap++<10 ) std::cout << "[mergeCalibMaps] :: " << (isEE ? "EE" : "EB") << " region " << iR << " covered by " << covered[iR] << " fit outputs" << std::endl; }
+    }
+    if( nMissing || nOverlap )
+      std::cout << "[mergeCalibMaps] :: " << (isEE ? "EE" : "EB") << ": " << nMissing << " regions missing, " << nOverlap << " covered more than once" << std::endl;
+    return nMissing==0 && nOverlap==0;
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  if(argc!=5 && argc!=6){
+    std::cout << "usage: " << argv[0] << " <output.root> <fitOutputs.txt> <nRegionsEB> <nRegionsEE> [nThreads]" << std::endl;
+    return 1;
+  }
+  const int nRegionsEB = atoi(argv[3]);
+  const int nRegionsEE = atoi(argv[4]);
+  unsigned nThreads = argc==6 ? atoi(argv[5]) : 8;
+
+  std::vector<FitOutput> outputs;
+  std::ifstream list(argv[2]);
+  std::string line;
+  while( std::getline(list, line) ){
+    size_t end = line.find_last_not_of(" \t\r\n");
+    if( end==std::string::npos ) continue;
+    outputs.push_back( FitOutput() );
+    outputs.back().name = line.substr(0, end+1);
+  }
+  if( outputs.empty() ){
+    std::cout << "[mergeCalibMaps] :: no fit outputs in " << argv[2] << std::endl;
+    return 2;
+  }
+
+  // each worker opens its own files; nothing ROOT-side is shared between them
+  ROOT::EnableThreadSafety();
+  if( nThreads<1 ) nThreads = 1;
+  if( nThreads>outputs.size() ) nThreads = outputs.size();
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for(unsigned iT=0; iT<nThreads; iT++)
+    workers.push_back( std::thread( [&outputs, &next]() {
+      for(size_t i = next++; i<outputs.size(); i = next++) readFitOutput( outputs[i] );
+    } ) );
+  for(size_t iT=0; iT<workers.size(); iT++) workers[iT].join();
+
+  bool ok = true;
+  for(size_t i=0; i<outputs.size(); i++){
+    if( outputs[i].ok ) continue;
+    std::cout << "[mergeCalibMaps] :: cannot read " << outputs[i].name << std::endl;
+    ok = false;
+  }
+  if( !ok ) return 3;
+  if( !checkCoverage(outputs, false, nRegionsEB) || !checkCoverage(outputs, true, nRegionsEE) ) return 4;
+
+  TFile* f = TFile::Open( argv[1], "RECREATE" );
+  if( !f || f->IsZombie() ){
+    std::cout << "[mergeCalibMaps] :: cannot create " << argv[1] << std::endl;
+    return 5;
+  }
+  TH2F* calibMap_EB  = new TH2F("calibMap_EB", "EB calib coefficients: #eta on x, #phi on y", 171,-85.5,85.5 , 360,0.5,360.5);
+  TH2F* calibMap_EEm = new TH2F("calibMap_EEm", "EE- calib coefficients", 100,0.5,100.5,100,0.5,100.5);
+  TH2F* calibMap_EEp = new TH2F("calibMap_EEp", "EE+ calib coefficients", 100,0.5,100.5,100,0.5,100.5);
+
+  // same branches as the merged trees made by calibJobHandler.py (names with a trailing '_')
+  Record r;
+  TTree* treeEB = new TTree("calibEB", "Tree of EB Inter-calibration constants");
+  TTree* treeEE = new TTree("calibEE", "Tree of EE Inter-calibration constants");
+  for(int isEE=0; isEE<2; isEE++){
+    TTree* tree = isEE ? treeEE : treeEB;
+    const int nInts = isEE ? nEEInts : nEBInts;
+    const char** intNames = isEE ? eeInts : ebInts;
+    for(int i=0; i<nInts; i++) tree->Branch( (std::string(intNames[i])+"_").c_str(), &r.ints[i], (std::string(intNames[i])+"_/I").c_str() );
+    for(int i=0; i<nFloats; i++) tree->Branch( (std::string(floats[i])+"_").c_str(), &r.values[i], (std::string(floats[i])+"_/F").c_str() );
+    tree->Branch( "fit_attempt_", &r.attempt, "fit_attempt_/I" );
+    tree->Branch( "iRegion_", &r.iRegion, "iRegion_/I" );
+  }
+
+  size_t nEB = 0, nEE = 0;
+  for(size_t i=0; i<outputs.size(); i++){
+    const std::vector<Record>& records = outputs[i].records;
+    for(size_t j=0; j<records.size(); j++){
+      r = records[j];
+      if( !outputs[i].isEE ){
+        treeEB->Fill();
+        calibMap_EB->SetBinContent( r.binX, r.binY, r.mapValue );
+        nEB++;
+      }
+      else {
+        treeEE->Fill();
+        (r.zside<0 ? calibMap_EEm : calibMap_EEp)->SetBinContent( r.binX, r.binY, r.mapValue );
+        nEE++;
+      }
+    }
+  }
+  f->Write();
+  f->Close();
+  delete f;
+  std::cout << "[mergeCalibMaps] :: " << outputs.size() << " fit outputs, " << nEB << " EB and " << nEE << " EE crystals merged into " << argv[1] << std::endl;
+  return 0;
+}
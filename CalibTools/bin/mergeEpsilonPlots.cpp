@@ -0,0 +1,265 @@
+// Sum of the FillEpsilonPlot outputs (<NameTag>EcalNtp_N.root, or partial epsilonPlots_N.root) without hadd.
+// All the inputs have the same layout: the same histograms (epsilon_EB_iR_N, epsilon_EE_iR_N in
+// Barrel/Endcap, plus the monitoring ones) with the same binning. The layout is taken from the first
+// input; every input is then read key by key in file order and its bin contents are added as flat arrays
+// into one accumulator per thread, the accumulators are summed in parallel and the result is written once.
+// Inputs with other objects (trees) or a different layout are refused: the caller falls back to hadd.
+//
+// usage: mergeEpsilonPlots <output.root> <inputs.list> [nThreads]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+
+#include "TROOT.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TDirectory.h"
+#include "TH1.h"
+#include "TArrayF.h"
+#include "TArrayD.h"
+
+namespace {
+
+  /// one histogram of the layout; its block in the accumulators is
+  /// [contents][sumw2][stats][entries][sumw2 seen], nCells long for contents and sumw2
+  struct Slot {
+    std::string dir;
+    TH1* h;
+    size_t offset;
+    int nCells;
+  };
+
+  struct Layout {
+    std::vector<Slot> slots;
+    std::map<std::string, int> index;
+    size_t size;
+    Layout() : size(0) {}
+  };
+
+  size_t blockSize(int nCells) { return 2*nCells + TH1::kNstat + 2; }
+
+  std::string keyPath(const std::string& dir, const char* name) { return dir.empty() ? std::string(name) : dir + "/" + name; }
+
+  /// highest cycles of the keys of dir, in the order they are stored in the file
+  std::vector<TKey*> sortedKeys(TDirectory* dir)
+  {
+    std::vector< std::pair<Long64_t, TKey*> > order;
+    TIter next( dir->GetListOfKeys() );
+    while( TKey* key = (TKey*) next() ){
+      TKey* last = dir->GetKey( key->GetName() );
+      if( last && last->GetCycle()!=key->GetCycle() ) continue;
+      order.push_back( std::make_pair(key->GetSeekKey(), key) );
+    }
+    std::sort( order.begin(), order.end() );
+    std::vector<TKey*> keys;
+    for(size_t i=0; i<order.size(); i++) keys.push_back( order[i].second );
+    return keys;
+  }
+
+  bool isDirectory(TKey* key) { return std::string(key->GetClassName()).find("TDirectory")==0; }
+
+  int nCells(TH1* h)
+  {
+    if( h->InheritsFrom("TProfile") ) return -1;
+    if( TArrayF* a = dynamic_cast<TArrayF*>(h) ) return a->GetSize();
+    if( TArrayD* a = dynamic_cast<TArrayD*>(h) ) return a->GetSize();
+    return -1;
+  }
+
+  bool readLayout(TDirectory* dir, const std::string& path, Layout& layout)
+  {
+    std::vector<TKey*> keys = sortedKeys(dir);
+    for(size_t i=0; i<keys.size(); i++){
+      if( isDirectory(keys[i]) ){
+        TDirectory* sub = dir->GetDirectory( keys[i]->GetName() );
+        if( !sub || !readLayout(sub, keyPath(path, keys[i]->GetName()), layout) ) return false;
+        continue;
+      }
+      TH1* h = dynamic_cast<TH1*>( keys[i]->ReadObj() );
+      int n = h ? nCells(h) : -1;
+      if( n<0 ){
+        std::cout << "[mergeEpsilonPlots] :: " << keyPath(path, keys[i]->GetName()) << " (" << keys[i]->GetClassName() << ") cannot be merged as a flat array" << std::endl;
+        return false;
+      }
+      h->SetDirectory(0);
+      Slot s = { path, h, layout.size, n };
+      layout.index[ keyPath(path, h->GetName()) ] = layout.slots.size();
+      layout.slots.push_back(s);
+      layout.size += blockSize(n);
+    }
+    return true;
+  }
+
+  bool accumulate(const Slot& s, TH1* h, double* acc)
+  {
+    TArrayF* af = dynamic_cast<TArrayF*>(h);
+    TArrayD* ad = af ? 0 : dynamic_cast<TArrayD*>(h);
+    const int n = s.nCells;
+    if( nCells(h)!=n ) return false;
+    double* c = acc + s.offset;
+    double* w = c + n;
+    if( af ) { const Float_t* x = af->GetArray(); for(int i=0; i<n; i++) c[i] += x[i]; }
+    else     { const Double_t* x = ad->GetArray(); for(int i=0; i<n; i++) c[i] += x[i]; }
+    if( h->GetSumw2N()==n ) {
+      const Double_t* x = h->GetSumw2()->GetArray();
+      for(int i=0; i<n; i++) w[i] += x[i];
+      c[2*n + TH1::kNstat + 1] = 1.;
+    }
+    // unweighted: the errors squared are the contents
+    else if( af ) { const Float_t* x = af->GetArray(); for(int i=0; i<n; i++) w[i] += x[i]; }
+    else          { const Double_t* x = ad->GetArray(); for(int i=0; i<n; i++) w[i] += x[i]; }
+    double stats[TH1::kNstat];
+    std::fill(stats, stats+TH1::kNstat, 0.);
+    h->GetStats(stats);
+    for(int k=0; k<TH1::kNstat; k++) c[2*n+k] += stats[k];
+    c[2*n + TH1::kNstat] += h->GetEntries();
+    return true;
+  }
+
+  bool addDirectory(TDirectory* dir, const std::string& path, const Layout& layout, double* acc)
+  {
+    std::vector<TKey*> keys = sortedKeys(dir);
+    for(size_t i=0; i<keys.size(); i++){
+      if( isDirectory(keys[i]) ){
+        TDirectory* sub = dir->GetDirectory( keys[i]->GetName() );
+        if( !sub || !addDirectory(sub, keyPath(path, keys[i]->GetName()), layout, acc) ) return false;
+        continue;
+      }
+      std::map<std::string, int>::const_iterator it = layout.index.find( keyPath(path, keys[i]->GetName()) );
+      if( it==layout.index.end() ){
+        std::cout << "[mergeEpsilonPlots] :: " << keyPath(path, keys[i]->GetName()) << " is not in the layout of the first input" << std::endl;
+        return false;
+      }
+      TH1* h = dynamic_cast<TH1*>( keys[i]->ReadObj() );
+      bool ok = h && accumulate(layout.slots[it->second], h, acc);
+      if( !ok ) std::cout << "[mergeEpsilonPlots] :: " << keyPath(path, keys[i]->GetName()) << " has a different binning than in the first input" << std::endl;
+      delete h;
+      if( !ok ) return false;
+    }
+    return true;
+  }
+
+  bool addFile(const std::string& name, const Layout& layout, double* acc)
+  {
+    TFile* f = TFile::Open( name.c_str() );
+    if( !f || f->IsZombie() ){
+      std::cout << "[mergeEpsilonPlots] :: cannot open " << name << std::endl;
+      delete f;
+      return false;
+    }
+    bool ok = addDirectory(f, "", layout, acc);
+    f->Close();
+    delete f;
+    if( !ok ) std::cout << "[mergeEpsilonPlots] :: " << name << " does not match the layout" << std::endl;
+    return ok;
+  }
+
+  void fillHisto(const Slot& s, const double* acc)
+  {
+    const int n = s.nCells;
+    const double* c = acc + s.offset;
+    TH1* h = s.h;
+    if( TArrayF* a = dynamic_cast<TArrayF*>(h) ) { Float_t* x = a->GetArray(); for(int i=0; i<n; i++) x[i] = c[i]; }
+    else { Double_t* x = dynamic_cast<TArrayD*>(h)->GetArray(); for(int i=0; i<n; i++) x[i] = c[i]; }
+    if( c[2*n + TH1::kNstat + 1]>0. ){
+      if( h->GetSumw2N()!=n ) h->Sumw2();
+      Double_t* x = h->GetSumw2()->GetArray();
+      for(int i=0; i<n; i++) x[i] = c[n+i];
+    }
+    else if( h->GetSumw2N()==n ) h->GetSumw2()->Set(0);
+    double stats[TH1::kNstat];
+    std::copy(c+2*n, c+2*n+TH1::kNstat, stats);
+    h->PutStats(stats);
+    h->SetEntries( c[2*n + TH1::kNstat] );
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  if(argc!=3 && argc!=4){
+    std::cout << "usage: " << argv[0] << " <output.root> <inputs.list> [nThreads]" << std::endl;
+    return 1;
+  }
+  unsigned nThreads = argc==4 ? atoi(argv[3]) : 4;
+
+  std::vector<std::string> inputs;
+  std::ifstream list(argv[2]);
+  std::string line;
+  while( std::getline(list, line) ){
+    size_t end = line.find_last_not_of(" \t\r\n");
+    if( end!=std::string::npos ) inputs.push_back( line.substr(0, end+1) );
+  }
+  if( inputs.empty() ){
+    std::cout << "[mergeEpsilonPlots] :: no inputs in " << argv[2] << std::endl;
+    return 2;
+  }
+
+  ROOT::EnableThreadSafety();
+  Layout layout;
+  {
+    TFile* f = TFile::Open( inputs[0].c_str() );
+    bool ok = f && !f->IsZombie() && readLayout(f, "", layout);
+    if( f ) f->Close();
+    delete f;
+    if( !ok ){
+      std::cout << "[mergeEpsilonPlots] :: cannot take the layout from " << inputs[0] << std::endl;
+      return 3;
+    }
+  }
+  std::cout << "[mergeEpsilonPlots] :: " << layout.slots.size() << " histograms, " << inputs.size() << " inputs" << std::endl;
+
+  // one accumulator per thread, each thread adds whole files into its own
+  if( nThreads<1 ) nThreads = 1;
+  if( nThreads>inputs.size() ) nThreads = inputs.size();
+  std::vector< std::vector<double> > partial( nThreads, std::vector<double>(layout.size, 0.) );
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  std::vector<std::thread> workers;
+  for(unsigned iT=0; iT<nThreads; iT++)
+    workers.push_back( std::thread( [&, iT]() {
+      for(size_t i = next++; i<inputs.size() && !failed; i = next++)
+        if( !addFile(inputs[i], layout, &partial[iT][0]) ) failed = true;
+    } ) );
+  for(size_t iT=0; iT<workers.size(); iT++) workers[iT].join();
+  if( failed ) return 4;
+
+  // accumulators summed into the first one, each thread on its own slice
+  workers.clear();
+  for(unsigned iT=0; iT<nThreads; iT++)
+    workers.push_back( std::thread( [&, iT]() {
+      size_t begin = layout.size*iT/nThreads, end = layout.size*(iT+1)/nThreads;
+      double* acc = &partial[0][0];
+      for(unsigned p=1; p<partial.size(); p++){
+        const double* x = &partial[p][0];
+        for(size_t i=begin; i<end; i++) acc[i] += x[i];
+      }
+    } ) );
+  for(size_t iT=0; iT<workers.size(); iT++) workers[iT].join();
+
+  TFile* out = TFile::Open( argv[1], "RECREATE" );
+  if( !out || out->IsZombie() ){
+    std::cout << "[mergeEpsilonPlots] :: cannot create " << argv[1] << std::endl;
+    return 5;
+  }
+  for(size_t i=0; i<layout.slots.size(); i++){
+    const Slot& s = layout.slots[i];
+    if( i==0 || s.dir!=layout.slots[i-1].dir ){
+      if( !s.dir.empty() && !out->GetDirectory(s.dir.c_str()) ) out->mkdir(s.dir.c_str());
+      out->cd( s.dir.empty() ? 0 : s.dir.c_str() );
+    }
+    fillHisto(s, &partial[0][0]);
+    s.h->Write();
+  }
+  out->Close();
+  delete out;
+  std::cout << "[mergeEpsilonPlots] :: " << inputs.size() << " inputs merged into " << argv[1] << std::endl;
+  return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef BinaryFileTools_h
+#define BinaryFileTools_h
+
+#include <cstddef>
+#include <stdint.h>
+
+/// FNV-1a hash used as payload checksum by the CalibTools binary formats
+/// (EcalRingTables, EcalCalibMapBinary). submit/calibJobHandler.py computes the same value.
+inline uint32_t fnv1aChecksum(const void* buf, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(buf);
+    uint32_t h = 2166136261u;
+    for(size_t i=0; i<len; ++i) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+#endif
@@ -12,6 +12,7 @@
 #include "DataFormats/EcalDetId/interface/EBDetId.h"
 #include "DataFormats/EcalDetId/interface/EEDetId.h"
 #include "CalibCode/CalibTools/interface/ECALGeometry.h"
+#include "CalibCode/CalibTools/interface/EcalCalibMapBinary.h"
 // #include "CalibCode/FillEpsilonPlot/interface/EndcapTools.h"
 
 //EcalCalibType :: { Xtal, EtaRing, TrigTower };
@@ -23,6 +24,7 @@ class EcalCalibMapBase {
         virtual float& operator[](const DetId& id) =0;
         virtual const float& operator[](const DetId& id) const =0;
         virtual void loadCalibMapFromFile(const char* cfile) =0;
+        virtual bool loadCalibMapFromBinary(const char* cfile, int expectedIteration=-1) =0;
         virtual int getNRegionsEB() =0;
         virtual int getNRegionsEE() =0;
 };
@@ -67,10 +69,15 @@ class EcalCalibMap : public EcalCalibMapBase {
        return bad_coeff;
     }
 
+    /// non-virtual access for the clustering loops, where the granularity is known at compile time
+    float coeffEB(const EBDetId& id) const { return mapEB[Type::iRegion(id)]; }
+    float coeffEE(const EEDetId& id) const { return mapEE[Type::iRegionEE(id)]; }
+
     int getNRegionsEB() {return nRegionsEB;}
     int getNRegionsEE() {return nRegionsEE;}
 
     void loadCalibMapFromFile(const char* cfile); 
+    bool loadCalibMapFromBinary(const char* cfile, int expectedIteration=-1);
     // void setCaloGeometry(ECALGeometry *geom);
 
   private:
@@ -123,9 +130,10 @@ void EcalCalibMap<Type>::loadCalibMapFromFile(const char* cfile)
 
     std::cout << "loading constants from TH2F::calibMapEE in <" << cfile << "> ..." << std::endl;
 
+    /// per crystal, as in the binary map (whatever the regions of Type)
     for(int jR=0; jR<EEDetId::kSizeForDenseIndexing; jR++)
     {
-      EEDetId eeid( Type::EEDetIdFromRegion(jR));
+      EEDetId eeid( EEDetId::unhashIndex(jR) );
 
       if(eeid.positiveZ())
           this->coeff(eeid) = hmap_EEp->GetBinContent(eeid.ix(), eeid.iy()); 
@@ -137,6 +145,24 @@ void EcalCalibMap<Type>::loadCalibMapFromFile(const char* cfile)
 }
 
 
+/// Fast path: per-crystal map written by the fit merge (see EcalCalibMapBinary).
+/// Returns false without touching the map if the file is missing or invalid, so that
+/// the caller can fall back to loadCalibMapFromFile.
+template<typename Type> 
+bool EcalCalibMap<Type>::loadCalibMapFromBinary(const char* cfile, int expectedIteration) 
+{
+    std::cout << "[EcalCalibMap] :: loadCalibMapFromBinary(" << std::string(cfile) << ") called" << std::endl; 
+    std::vector<float> xtalEB, xtalEE;
+    if( !EcalCalibMapBinary::read(cfile, xtalEB, xtalEE, expectedIteration) ) return false;
+
+    for(int iR=0; iR<EcalCalibMapBinary::nEB; iR++) this->coeff( EBDetId::unhashIndex(iR) ) = xtalEB[iR];
+    for(int jR=0; jR<EcalCalibMapBinary::nEE; jR++) this->coeff( EEDetId::unhashIndex(jR) ) = xtalEE[jR];
+
+    std::cout << "[EcalCalibMap] :: " << std::string(cfile) << " loaded" << std::endl;
+    return true;
+}
+
+
 //  template<typename Type> 
 //  void EcalCalibMap<Type>::setCaloGeometry(ECALGeometry *geom)
 //  {
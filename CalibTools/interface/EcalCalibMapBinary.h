@@ -0,0 +1,38 @@
+#ifndef EcalCalibMapBinary_h
+#define EcalCalibMapBinary_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "DataFormats/EcalDetId/interface/EBDetId.h"
+#include "DataFormats/EcalDetId/interface/EEDetId.h"
+
+/// Compact calibration map: one float per crystal, indexed by EB/EE hashed index.
+/// Written by the fit merge next to calibMap.root and read back by EcalCalibMap::loadCalibMapFromBinary
+/// with a single read() instead of opening the ROOT file and copying the TH2F bin by bin.
+///
+/// Layout: Header, float EB[nEB], float EE[nEE] (little endian)
+class EcalCalibMapBinary
+{
+    public:
+        static const uint32_t MAGIC   = 0x4D435045; // "EPCM"
+        static const uint32_t VERSION = 1;
+        static const int nEB = EBDetId::kSizeForDenseIndexing;
+        static const int nEE = EEDetId::kSizeForDenseIndexing;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            int32_t  iteration;
+            uint32_t nEB;
+            uint32_t nEE;
+            uint32_t checksum; // FNV-1a of the EB and EE arrays
+        };
+
+        /// returns false on any problem (missing file, wrong size, bad checksum, iteration != expectedIteration if >=0)
+        static bool read(const std::string& fileName, std::vector<float>& mapEB, std::vector<float>& mapEE, int expectedIteration=-1);
+        static bool write(const std::string& fileName, const std::vector<float>& mapEB, const std::vector<float>& mapEE, int iteration);
+};
+
+#endif
@@ -9,7 +9,9 @@
 #include "DataFormats/EcalDetId/interface/EBDetId.h"
 #include "DataFormats/EcalDetId/interface/EEDetId.h"
 #include "DataFormats/EcalDetId/interface/EcalTrigTowerDetId.h"
+#include "DataFormats/EcalDetId/interface/EcalScDetId.h"
 #include "CalibCode/CalibTools/interface/EndcapTools.h"
+#include "CalibCode/CalibTools/interface/EcalRegionIndex.h"
 
 //using namespace std;
 
@@ -64,7 +66,12 @@ namespace EcalCalibType {
          return EBDetId( ieta, 1 );
       }
 
-      static EEDetId EEDetIdFromRegion(uint32_t iR){ return 0; } // to be implemented
+      /// first crystal of the ring (EE-: 0->38, EE+: 39->77), null DetId out of range
+      static EEDetId EEDetIdFromRegion(uint32_t iR){
+         if( iR>=nRegionsEE ) return EEDetId();
+         const EcalRegionIndex& index = EcalRegionIndex::EE<EtaRing>();
+         return index.size(iR)>0 ? EEDetId::unhashIndex( *index.begin(iR) ) : EEDetId();
+      }
 
       static std::vector<DetId> allDetIdsInRegion(uint32_t iR) {
          int ieta = int(iR) - EBDetId::kCrystalsInEta;
@@ -79,9 +86,12 @@ namespace EcalCalibType {
       }
 
       static std::vector<DetId> allDetIdsInEERegion(uint32_t iR) { 
-         // std::vector<DetId> ids;
-         // std::cout << "EtaRing::allDetIdsInEERegion()" << std::endl;
-         return EndcapTools::getDetIdsInRing(int(iR));
+         std::vector<DetId> ids;
+         if( iR>=nRegionsEE ) return ids;
+         const EcalRegionIndex& index = EcalRegionIndex::EE<EtaRing>();
+         ids.reserve(index.size(iR));
+         for(const int* h = index.begin(iR); h != index.end(iR); ++h) ids.push_back( EEDetId::unhashIndex(*h) );
+         return ids;
       }
 
       static std::string printType(){ return std::string("etaring"); }
@@ -89,23 +99,34 @@ namespace EcalCalibType {
     private:
   };
 
+  /// trigger tower in EB, 5x5 supercrystal in EE (the EE towers do not follow the crystal grid,
+  /// the supercrystals do and have the same size)
   class TrigTower {
     public:
       typedef EcalTrigTowerDetId ID;
       static const uint32_t nRegions = EcalTrigTowerDetId::kEBTowersPerSM*EBDetId::MAX_SM;
-      static const uint32_t nRegionsEE = 1;
+      static const uint32_t nRegionsEE = EcalScDetId::kSizeForDenseIndexing;
+      static const int kCrystalsInSC = 5; // per side
       static uint32_t iRegion(const DetId& id) { 
         EBDetId ebid(id); 
         //       0 -> 2448-1
         return (ebid.tower().hashedIndex());
       }
-      static uint32_t iRegionEE(const DetId& id) { return 0; } // TO BE IMPLEMENTED!!!
+      //       0 -> 632-1
+      static uint32_t iRegionEE(const DetId& id) { return scFromCrystal( EEDetId(id) ).hashedIndex(); }
       static ID detIdFromRegion(uint32_t iR) {
          return EcalTrigTowerDetId::detIdFromDenseIndex( iR ); // was +1 but it's a mistake! 6/6/10
       }
 
+      static EcalScDetId scFromCrystal(const EEDetId& eeid) {
+         return EcalScDetId( 1+(eeid.ix()-1)/kCrystalsInSC, 1+(eeid.iy()-1)/kCrystalsInSC, eeid.zside() );
+      }
 
-      static EEDetId EEDetIdFromRegion(uint32_t iR){ return 0;  } // to be implemented
+      /// first valid crystal of the supercrystal, null DetId out of range
+      static EEDetId EEDetIdFromRegion(uint32_t iR){
+         std::vector<DetId> ids = allDetIdsInEERegion(iR);
+         return ids.empty() ? EEDetId() : EEDetId(ids.front());
+      }
 
       static std::vector<DetId> allDetIdsInRegion(uint32_t iR) {
          EcalTrigTowerDetId iTT = EcalTrigTowerDetId::detIdFromDenseIndex( iR );
@@ -125,8 +146,14 @@ namespace EcalCalibType {
          return ids;
       }
 
-      static std::vector<DetId> allDetIdsInEERegion(uint32_t iR) { // TO BE IMPLEMENTED!!
+      static std::vector<DetId> allDetIdsInEERegion(uint32_t iR) {
          std::vector<DetId> ids;
+         if( iR>=nRegionsEE ) return ids;
+         EcalScDetId sc = EcalScDetId::unhashIndex( iR );
+         ids.reserve(kCrystalsInSC*kCrystalsInSC);
+         for(int ix=(sc.ix()-1)*kCrystalsInSC+1; ix<=sc.ix()*kCrystalsInSC; ++ix)
+            for(int iy=(sc.iy()-1)*kCrystalsInSC+1; iy<=sc.iy()*kCrystalsInSC; ++iy)
+               if( EEDetId::validDetId(ix, iy, sc.zside()) ) ids.push_back( EEDetId(ix, iy, sc.zside()) );
          return ids;
       }
 
@@ -134,6 +161,45 @@ namespace EcalCalibType {
     private:
   };
 
+  /// supermodule in EB (0->35), quadrant per endcap in EE (EE-: 0->3, EE+: 4->7).
+  /// Same grouping as the SMCalibEB/SMCalibEE options of FillEpsilonPlot.
+  class SM {
+    public:
+      typedef EBDetId ID;
+      static const uint32_t nRegions = EBDetId::MAX_SM;
+      static const uint32_t nRegionsEE = 8;
+      static uint32_t iRegion(const DetId& id)   { return EBDetId(id).ism()-1; }
+      static uint32_t iRegionEE(const DetId& id) {
+        EEDetId eeid(id);
+        return (eeid.zside()<0 ? 0 : 4) + eeid.iquadrant()-1;
+      }
+      static ID detIdFromRegion(uint32_t iR)       { return EBDetId( iR+1, 1, EBDetId::SMCRYSTALMODE ); }
+      static EEDetId EEDetIdFromRegion(uint32_t iR){
+        if( iR>=nRegionsEE ) return EEDetId();
+        const EcalRegionIndex& index = EcalRegionIndex::EE<SM>();
+        return index.size(iR)>0 ? EEDetId::unhashIndex( *index.begin(iR) ) : EEDetId();
+      }
+
+      static std::vector<DetId> allDetIdsInRegion(uint32_t iR) {
+         std::vector<DetId> ids;
+         ids.reserve(EBDetId::kCrystalsPerSM);
+         for(int ic=1; ic<=EBDetId::kCrystalsPerSM; ++ic) ids.push_back( EBDetId( iR+1, ic, EBDetId::SMCRYSTALMODE ) );
+         return ids;
+      }
+
+      static std::vector<DetId> allDetIdsInEERegion(uint32_t iR) {
+         std::vector<DetId> ids;
+         if( iR>=nRegionsEE ) return ids;
+         const EcalRegionIndex& index = EcalRegionIndex::EE<SM>();
+         ids.reserve(index.size(iR));
+         for(const int* h = index.begin(iR); h != index.end(iR); ++h) ids.push_back( EEDetId::unhashIndex(*h) );
+         return ids;
+      }
+
+      static std::string printType(){ return std::string("sm"); }
+    private:
+  };
+
 } // end of namespace
 
 #endif
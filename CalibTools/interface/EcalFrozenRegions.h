@@ -0,0 +1,58 @@
+#ifndef EcalFrozenRegions_h
+#define EcalFrozenRegions_h
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "CalibCode/CalibTools/interface/EcalCalibMapBinary.h"
+#include "CalibCode/CalibTools/interface/EcalRegionIndex.h"
+
+/// Crystals whose constant has converged, as tracked by the daemon (freezeConverged in parameters.py).
+/// The daemon writes, with the EcalCalibMapBinary layout, the number of consecutive iterations each
+/// crystal met the convergence criterion; a crystal is frozen once this reaches freezeAfter.
+/// A region is frozen when all its crystals are: it is not filled, not fitted, and keeps its coefficient.
+class EcalFrozenRegions
+{
+    public:
+        EcalFrozenRegions() : nFrozenEB_(0), nFrozenEE_(0) {}
+
+        /// returns false (and freezes nothing) if the file is missing or invalid
+        bool load(const std::string& fileName, int freezeAfter, int expectedIteration=-1)
+        {
+            std::vector<float> countEB, countEE;
+            frozenEB_.clear(); frozenEE_.clear();
+            nFrozenEB_ = nFrozenEE_ = 0;
+            if( !EcalCalibMapBinary::read(fileName, countEB, countEE, expectedIteration) ) {
+                std::cout << "[EcalFrozenRegions] :: " << fileName << " not usable, no region is frozen" << std::endl;
+                return false;
+            }
+            frozenEB_.resize(countEB.size());
+            frozenEE_.resize(countEE.size());
+            for(std::size_t h=0; h<countEB.size(); ++h) if( (frozenEB_[h] = countEB[h]>=freezeAfter) ) ++nFrozenEB_;
+            for(std::size_t h=0; h<countEE.size(); ++h) if( (frozenEE_[h] = countEE[h]>=freezeAfter) ) ++nFrozenEE_;
+            std::cout << "[EcalFrozenRegions] :: " << nFrozenEB_ << " EB and " << nFrozenEE_ << " EE crystals frozen (" << fileName << ")" << std::endl;
+            return true;
+        }
+
+        bool empty() const { return nFrozenEB_==0 && nFrozenEE_==0; }
+
+        bool xtalFrozenEB(int hashedIndex) const { return !frozenEB_.empty() && frozenEB_[hashedIndex]; }
+        bool xtalFrozenEE(int hashedIndex) const { return !frozenEE_.empty() && frozenEE_[hashedIndex]; }
+
+        bool regionFrozen(const EcalRegionIndex& index, int iR, bool isEE) const
+        {
+            const std::vector<bool>& frozen = isEE ? frozenEE_ : frozenEB_;
+            if( frozen.empty() || index.size(iR)==0 ) return false;
+            for(const int* h = index.begin(iR); h != index.end(iR); ++h) if( !frozen[*h] ) return false;
+            return true;
+        }
+
+    private:
+        std::vector<bool> frozenEB_;
+        std::vector<bool> frozenEE_;
+        int nFrozenEB_;
+        int nFrozenEE_;
+};
+
+#endif
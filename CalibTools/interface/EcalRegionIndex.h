@@ -0,0 +1,80 @@
+#ifndef EcalRegionIndex_h
+#define EcalRegionIndex_h
+
+#include <vector>
+#include <cstddef>
+
+#include "DataFormats/DetId/interface/DetId.h"
+#include "DataFormats/EcalDetId/interface/EBDetId.h"
+#include "DataFormats/EcalDetId/interface/EEDetId.h"
+
+/// Immutable region <-> crystal index in compressed sparse row form:
+/// the crystals (hashed indices) of region iR are xtals_[offsets_[iR] .. offsets_[iR+1]),
+/// and region(h) gives the region of crystal h (-1 if the crystal belongs to none).
+///
+/// One instance per granularity and subdetector is built on first use and shared,
+/// e.g. EcalRegionIndex::EB<EcalCalibType::EtaRing>(). Ad-hoc groupings (such as the
+/// Endc_x_y rings used by FillEpsilonPlot) can be built from any crystal -> region array.
+class EcalRegionIndex
+{
+    public:
+        EcalRegionIndex() {}
+        EcalRegionIndex(const std::vector<int>& regionOfXtal, int nRegions) { build(regionOfXtal, nRegions); }
+
+        void build(const std::vector<int>& regionOfXtal, int nRegions)
+        {
+            regionOfXtal_ = regionOfXtal;
+            offsets_.assign(nRegions+1, 0);
+            for(std::size_t h=0; h<regionOfXtal_.size(); ++h) {
+                int iR = regionOfXtal_[h];
+                if(iR<0 || iR>=nRegions) { regionOfXtal_[h] = -1; continue; }
+                ++offsets_[iR+1];
+            }
+            for(int iR=0; iR<nRegions; ++iR) offsets_[iR+1] += offsets_[iR];
+            xtals_.resize(offsets_[nRegions]);
+            std::vector<int> fill(offsets_.begin(), offsets_.end()-1);
+            for(std::size_t h=0; h<regionOfXtal_.size(); ++h)
+                if(regionOfXtal_[h]>=0) xtals_[ fill[regionOfXtal_[h]]++ ] = h;
+        }
+
+        int nRegions() const { return offsets_.empty() ? 0 : int(offsets_.size())-1; }
+        int nXtals()   const { return regionOfXtal_.size(); }
+
+        int region(int hashedIndex) const { return regionOfXtal_[hashedIndex]; }
+
+        const int* begin(int iR) const { return xtals_.empty() ? 0 : &xtals_[0] + offsets_[iR]; }
+        const int* end(int iR)   const { return xtals_.empty() ? 0 : &xtals_[0] + offsets_[iR+1]; }
+        int size(int iR)         const { return offsets_[iR+1]-offsets_[iR]; }
+
+        /// shared per-granularity instances, built from Type::iRegion / Type::iRegionEE
+        template<class Type> static const EcalRegionIndex& EB()
+        {
+            static const EcalRegionIndex index( regionsEB<Type>(), Type::nRegions );
+            return index;
+        }
+        template<class Type> static const EcalRegionIndex& EE()
+        {
+            static const EcalRegionIndex index( regionsEE<Type>(), Type::nRegionsEE );
+            return index;
+        }
+
+    private:
+        template<class Type> static std::vector<int> regionsEB()
+        {
+            std::vector<int> r(EBDetId::kSizeForDenseIndexing);
+            for(int h=0; h<EBDetId::kSizeForDenseIndexing; ++h) r[h] = Type::iRegion( EBDetId::unhashIndex(h) );
+            return r;
+        }
+        template<class Type> static std::vector<int> regionsEE()
+        {
+            std::vector<int> r(EEDetId::kSizeForDenseIndexing);
+            for(int h=0; h<EEDetId::kSizeForDenseIndexing; ++h) r[h] = Type::iRegionEE( EEDetId::unhashIndex(h) );
+            return r;
+        }
+
+        std::vector<int> offsets_;
+        std::vector<int> xtals_;
+        std::vector<int> regionOfXtal_;
+};
+
+#endif
@@ -12,6 +12,7 @@
 
 #include "CalibCode/CalibTools/interface/EcalCalibTypes.h"
 #include "CalibCode/CalibTools/interface/EcalCalibMap.h"
+#include "CalibCode/CalibTools/interface/EcalRegionIndex.h"
 
 #define PI0MASS 0.1349
 #define ETAMASS 0.5479
@@ -38,6 +39,9 @@ class EcalRegionalCalibrationBase{
         virtual std::string printType() =0;
         virtual std::vector<DetId> allDetIdsInEBRegion(uint32_t iR) =0;
         virtual std::vector<DetId> allDetIdsInEERegion(uint32_t iR) =0;
+        /// shared region <-> crystal index of the granularity, prefer it to allDetIdsIn*Region in loops
+        virtual const EcalRegionIndex& regionIndexEB() const =0;
+        virtual const EcalRegionIndex& regionIndexEE() const =0;
 };
 
 template<class Type> class EcalRegionalCalibration : public EcalRegionalCalibrationBase {
@@ -52,6 +56,7 @@ template<class Type> class EcalRegionalCalibration : public EcalRegionalCalibrat
             EcalCalibMapBase *basePtr = calibMap; 
             return basePtr;
         }
+        EcalCalibMap<Type>* getTypedCalibMap() { return calibMap; }
         std::string printType() { return std::string(Type::printType()); }
 
         //RegionWeightVector getWeightsEE(const reco::CaloCluster* clus) const;
@@ -64,6 +69,9 @@ template<class Type> class EcalRegionalCalibration : public EcalRegionalCalibrat
             return Type::allDetIdsInEERegion(iR);
         }
 
+        const EcalRegionIndex& regionIndexEB() const { return EcalRegionIndex::EB<Type>(); }
+        const EcalRegionIndex& regionIndexEE() const { return EcalRegionIndex::EE<Type>(); }
+
     private:
         EcalCalibMap<Type>*   calibMap;
 
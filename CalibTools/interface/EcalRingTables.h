@@ -0,0 +1,81 @@
+#ifndef EcalRingTables_h
+#define EcalRingTables_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "DataFormats/EcalDetId/interface/EBDetId.h"
+#include "DataFormats/EcalDetId/interface/EEDetId.h"
+
+/// Dense geometry lookup tables used by FillEpsilonPlot (ieta/iphi/iSM per EB hashed index,
+/// ix/iy/zside/quadrant/eta-ring per EE hashed index, and the EE eta-ring of each (ix,iy)).
+/// They can be built from Endc_x_y_ring.txt + the calibEB/calibEE trees, or mapped
+/// directly from a precompiled binary file written by makeEcalRingTables.
+///
+/// Binary layout: Header, then int32 arrays in this order
+///   EB: ieta[nEB] iphi[nEB] iSM[nEB]
+///   EE: ix[nEE] iy[nEE] zside[nEE] iquadrant[nEE] ring[nEE]
+///   ringXY[nXY*nXY]   (indexed as x*nXY+y, same x/y convention as Endc_x_y_ring.txt)
+class EcalRingTables
+{
+    public:
+        static const uint32_t MAGIC   = 0x54525045; // "EPRT"
+        static const uint32_t VERSION = 1;
+        static const int nEB = EBDetId::kSizeForDenseIndexing;
+        static const int nEE = EEDetId::kSizeForDenseIndexing;
+        static const int nXY = 101;
+        static const int kInvalid = -999;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t nEB;
+            uint32_t nEE;
+            uint32_t nXY;
+            uint32_t checksum; // FNV-1a of the payload following the header
+        };
+
+        EcalRingTables();
+        ~EcalRingTables();
+
+        /// map a precompiled binary file. Returns false (and leaves the tables empty) on any failure
+        bool loadFromFile(const std::string& fileName);
+        /// build the tables in memory from the text ring file and the calibEB/calibEE trees
+        void buildFromRingFile(const std::string& endcXYFile);
+        void buildFromCalibTrees(const std::string& calibMapFile);
+        bool writeToFile(const std::string& fileName) const;
+
+        bool isValid() const { return data_ != 0; }
+
+        int ietaEB(int hashedIndex) const { return data_[hashedIndex]; }
+        int iphiEB(int hashedIndex) const { return data_[nEB + hashedIndex]; }
+        int iSMEB(int hashedIndex)  const { return data_[2*nEB + hashedIndex]; }
+
+        int ixEE(int hashedIndex)        const { return data_[3*nEB + hashedIndex]; }
+        int iyEE(int hashedIndex)        const { return data_[3*nEB + nEE + hashedIndex]; }
+        int zsideEE(int hashedIndex)     const { return data_[3*nEB + 2*nEE + hashedIndex]; }
+        int iquadrantEE(int hashedIndex) const { return data_[3*nEB + 3*nEE + hashedIndex]; }
+        int ringEE(int hashedIndex)      const { return data_[3*nEB + 4*nEE + hashedIndex]; }
+
+        /// eta-ring of (x,y) as listed in Endc_x_y_ring.txt, -1 if not present
+        int ring(int x, int y) const {
+            if( x<0 || y<0 || x>=nXY || y>=nXY ) return -1;
+            return data_[3*nEB + 5*nEE + x*nXY + y];
+        }
+
+        static size_t payloadSize() { return sizeof(int32_t)*(3*nEB + 5*nEE + nXY*nXY); }
+
+    private:
+        void allocate();
+        void unmap();
+
+        int32_t* mutableData() { return &buffer_[0]; }
+
+        const int32_t* data_;
+        std::vector<int32_t> buffer_;
+        void*  mapped_;
+        size_t mappedSize_;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "CalibCode/CalibTools/interface/EcalCalibMapBinary.h"
+#include "CalibCode/CalibTools/interface/BinaryFileTools.h"
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+bool EcalCalibMapBinary::read(const std::string& fileName, std::vector<float>& mapEB, std::vector<float>& mapEE, int expectedIteration)
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    const size_t payload  = sizeof(float)*(nEB+nEE);
+    const size_t expected = sizeof(Header) + payload;
+
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd<0) {
+        std::cout << "[EcalCalibMapBinary] :: cannot open " << fileName << std::endl;
+        return false;
+    }
+    struct stat st;
+    if( fstat(fd, &st)!=0 || size_t(st.st_size)!=expected ) {
+        std::cout << "[EcalCalibMapBinary] :: " << fileName << " has an unexpected size" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // whole file in one read
+    std::vector<char> buf(expected);
+    size_t got = 0;
+    while( got<expected ) {
+        ssize_t n = ::read(fd, &buf[got], expected-got);
+        if(n<=0) break;
+        got += n;
+    }
+    close(fd);
+    if( got!=expected ) {
+        std::cout << "[EcalCalibMapBinary] :: short read on " << fileName << std::endl;
+        return false;
+    }
+
+    const Header* h = reinterpret_cast<const Header*>(&buf[0]);
+    const float* data = reinterpret_cast<const float*>(&buf[sizeof(Header)]);
+    if( h->magic!=MAGIC || h->version!=VERSION || int(h->nEB)!=nEB || int(h->nEE)!=nEE ) {
+        std::cout << "[EcalCalibMapBinary] :: " << fileName << " has an incompatible header" << std::endl;
+        return false;
+    }
+    if( h->checksum!=fnv1aChecksum(data, payload) ) {
+        std::cout << "[EcalCalibMapBinary] :: checksum mismatch in " << fileName << std::endl;
+        return false;
+    }
+    if( expectedIteration>=0 && h->iteration!=expectedIteration ) {
+        std::cout << "[EcalCalibMapBinary] :: " << fileName << " is from iteration " << h->iteration << ", expected " << expectedIteration << std::endl;
+        return false;
+    }
+
+    mapEB.assign(data, data+nEB);
+    mapEE.assign(data+nEB, data+nEB+nEE);
+    return true;
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+bool EcalCalibMapBinary::write(const std::string& fileName, const std::vector<float>& mapEB, const std::vector<float>& mapEE, int iteration)
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    if( int(mapEB.size())!=nEB || int(mapEE.size())!=nEE ) return false;
+
+    std::vector<float> data(mapEB);
+    data.insert(data.end(), mapEE.begin(), mapEE.end());
+
+    Header h;
+    h.magic     = MAGIC;
+    h.version   = VERSION;
+    h.iteration = iteration;
+    h.nEB       = nEB;
+    h.nEE       = nEE;
+    h.checksum  = fnv1aChecksum(&data[0], sizeof(float)*data.size());
+
+    std::string tmpName = fileName + ".tmp";
+    FILE* out = fopen(tmpName.c_str(), "wb");
+    if(!out) return false;
+    bool ok = fwrite(&h, sizeof(Header), 1, out)==1 && fwrite(&data[0], sizeof(float), data.size(), out)==data.size();
+    ok = (fclose(out)==0) && ok;
+    if(!ok) { remove(tmpName.c_str()); return false; }
+    return rename(tmpName.c_str(), fileName.c_str())==0;
+}
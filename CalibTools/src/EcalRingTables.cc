@@ -0,0 +1,193 @@
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include "FWCore/Utilities/interface/Exception.h"
+
+#include "CalibCode/CalibTools/interface/EcalRingTables.h"
+#include "CalibCode/CalibTools/interface/BinaryFileTools.h"
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+EcalRingTables::EcalRingTables() : data_(0), mapped_(0), mappedSize_(0)
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+EcalRingTables::~EcalRingTables()
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    unmap();
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+void EcalRingTables::unmap()
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    if(mapped_) munmap(mapped_, mappedSize_);
+    mapped_ = 0;
+    mappedSize_ = 0;
+    data_ = buffer_.empty() ? 0 : &buffer_[0];
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+void EcalRingTables::allocate()
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    // switching to in-memory tables: drop a previous mapping
+    if(mapped_) { munmap(mapped_, mappedSize_); mapped_ = 0; mappedSize_ = 0; }
+    if(buffer_.empty()) {
+        buffer_.assign(payloadSize()/sizeof(int32_t), int32_t(kInvalid));
+        // the (x,y) ring grid uses -1 for "not found", as the old GetRing did
+        std::fill(buffer_.begin() + 3*nEB + 5*nEE, buffer_.end(), -1);
+    }
+    data_ = &buffer_[0];
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+bool EcalRingTables::loadFromFile(const std::string& fileName)
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd<0) {
+        std::cout << "[EcalRingTables] :: cannot open " << fileName << std::endl;
+        return false;
+    }
+    struct stat st;
+    const size_t expected = sizeof(Header) + payloadSize();
+    if( fstat(fd, &st)!=0 || size_t(st.st_size)!=expected ) {
+        std::cout << "[EcalRingTables] :: " << fileName << " has size " << st.st_size << ", expected " << expected << std::endl;
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(0, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr==MAP_FAILED) {
+        std::cout << "[EcalRingTables] :: mmap failed for " << fileName << std::endl;
+        return false;
+    }
+
+    const Header* h = static_cast<const Header*>(addr);
+    const int32_t* payload = reinterpret_cast<const int32_t*>(static_cast<const char*>(addr) + sizeof(Header));
+    if( h->magic!=MAGIC || h->version!=VERSION || int(h->nEB)!=nEB || int(h->nEE)!=nEE || int(h->nXY)!=nXY ) {
+        std::cout << "[EcalRingTables] :: " << fileName << " has an incompatible header" << std::endl;
+        munmap(addr, expected);
+        return false;
+    }
+    if( h->checksum != fnv1aChecksum(payload, payloadSize()) ) {
+        std::cout << "[EcalRingTables] :: checksum mismatch in " << fileName << std::endl;
+        munmap(addr, expected);
+        return false;
+    }
+
+    unmap();
+    buffer_.clear();
+    mapped_ = addr;
+    mappedSize_ = expected;
+    data_ = payload;
+    return true;
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+void EcalRingTables::buildFromRingFile(const std::string& endcXYFile)
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    std::ifstream file(endcXYFile.c_str());
+    if(!file.is_open())
+        throw cms::Exception("EcalRingTables") << "Cannot open " << endcXYFile << "\n";
+
+    allocate();
+    int32_t* ringXY = mutableData() + 3*nEB + 5*nEE;
+    std::string line;
+    while( std::getline(file, line) ) {
+        std::istringstream myLine(line);
+        int x, y, sign, ring;
+        if( !(myLine >> x >> y >> sign >> ring) ) continue;
+        if( x<0 || y<0 || x>=nXY || y>=nXY ) continue;
+        // keep the first occurrence of (x,y), like the linear search it replaces
+        if( ringXY[x*nXY+y]==-1 ) ringXY[x*nXY+y] = ring;
+    }
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+void EcalRingTables::buildFromCalibTrees(const std::string& calibMapFile)
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    TFile* f = TFile::Open( calibMapFile.c_str() );
+    if( !f || f->IsZombie() )
+        throw cms::Exception("EcalRingTables") << "Cannot open " << calibMapFile << "\n";
+    TTree* calibEB = (TTree*) f->Get("calibEB");
+    TTree* calibEE = (TTree*) f->Get("calibEE");
+    if( !calibEB || !calibEE )
+        throw cms::Exception("EcalRingTables") << "calibEB/calibEE trees not found in " << calibMapFile << "\n";
+
+    allocate();
+    int32_t* d = mutableData();
+
+    Int_t hashedIndex_, ieta_, iphi_, iSM_, ix_, iy_, zside_, iquadrant_;
+    calibEB->SetBranchAddress( "hashedIndex_", &hashedIndex_);
+    calibEB->SetBranchAddress( "ieta_", &ieta_);
+    calibEB->SetBranchAddress( "iphi_", &iphi_);
+    calibEB->SetBranchAddress( "iSM_", &iSM_);
+    Long64_t nentries = calibEB->GetEntriesFast();
+    for(Long64_t iEntry=0; iEntry<nentries; iEntry++){
+        calibEB->GetEntry(iEntry);
+        if( hashedIndex_<0 || hashedIndex_>=nEB ) continue;
+        d[hashedIndex_]         = ieta_;
+        d[nEB + hashedIndex_]   = iphi_;
+        d[2*nEB + hashedIndex_] = iSM_;
+    }
+
+    calibEE->SetBranchAddress( "hashedIndex_", &hashedIndex_);
+    calibEE->SetBranchAddress( "ix_", &ix_);
+    calibEE->SetBranchAddress( "iy_", &iy_);
+    calibEE->SetBranchAddress( "zside_", &zside_);
+    calibEE->SetBranchAddress( "iquadrant_", &iquadrant_);
+    nentries = calibEE->GetEntriesFast();
+    for(Long64_t iEntry=0; iEntry<nentries; iEntry++){
+        calibEE->GetEntry(iEntry);
+        if( hashedIndex_<0 || hashedIndex_>=nEE ) continue;
+        int32_t* ee = d + 3*nEB + hashedIndex_;
+        ee[0]     = ix_;
+        ee[nEE]   = iy_;
+        ee[2*nEE] = zside_;
+        ee[3*nEE] = iquadrant_;
+        ee[4*nEE] = ring( ix_, iy_ );
+    }
+    f->Close();
+    delete f;
+}
+
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+bool EcalRingTables::writeToFile(const std::string& fileName) const
+/*+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
+{
+    if(!data_) return false;
+    Header h;
+    h.magic    = MAGIC;
+    h.version  = VERSION;
+    h.nEB      = nEB;
+    h.nEE      = nEE;
+    h.nXY      = nXY;
+    h.checksum = fnv1aChecksum(data_, payloadSize());
+
+    // write to a temporary name and rename, so a reader never maps a half-written file
+    std::string tmpName = fileName + ".tmp";
+    FILE* out = fopen(tmpName.c_str(), "wb");
+    if(!out) return false;
+    bool ok = fwrite(&h, sizeof(Header), 1, out)==1 && fwrite(data_, payloadSize(), 1, out)==1;
+    ok = (fclose(out)==0) && ok;
+    if(!ok) { remove(tmpName.c_str()); return false; }
+    return rename(tmpName.c_str(), fileName.c_str())==0;
+}
@@ -3,6 +3,9 @@
 #include "TH1F.h"
 #include "TLorentzVector.h"
 
+#include <set>
+#include <ctime>
+
 #include "FWCore/Framework/interface/Frameworkfwd.h"
 #include "FWCore/Framework/interface/EDAnalyzer.h"
 
@@ -20,6 +23,9 @@
 #include "CalibCode/CalibTools/interface/EcalEnerCorr.h"
 #include "CalibCode/CalibTools/interface/EcalCalibTypes.h"
 #include "CalibCode/CalibTools/interface/EcalRegionalCalibration.h"
+#include "CalibCode/CalibTools/interface/EcalRingTables.h"
+#include "CalibCode/CalibTools/interface/EcalRegionIndex.h"
+#include "CalibCode/CalibTools/interface/EcalFrozenRegions.h"
 #include "CalibCode/CalibTools/interface/EcalPreshowerHardcodedTopology.h"
 #include "Geometry/EcalAlgo/interface/EcalPreshowerGeometry.h"
 #include "Geometry/CaloGeometry/interface/CaloGeometry.h"
@@ -49,14 +55,6 @@
 enum calibGranularity{ xtal, tt, etaring };
 //enum subdet{ thisIsEE, thisIsEB }; 
 
-struct iXiYtoRing {
-    int iX;
-    int iY;
-    int sign;
-    int Ring;
-    iXiYtoRing() : iX(0), iY(0), sign(0), Ring(-1) { }
-} GiveRing;
-
 using namespace reco;
 
 class FillEpsilonPlot : public edm::EDAnalyzer {
@@ -81,15 +79,22 @@ class FillEpsilonPlot : public edm::EDAnalyzer {
       void fillEBClusters(std::vector< CaloCluster > & ebclusters, const edm::Event& iEvent, const EcalChannelStatus &channelStatus);
       void fillEEClusters(std::vector< CaloCluster > & eseeclusters,std::vector< CaloCluster > & eseeclusters_tot, const edm::Event& iEvent, const EcalChannelStatus &channelStatus);
       void computeEpsilon(std::vector< CaloCluster > & clusters, int subDetId);
+      void precalibrateRecHits(int subDetId);
+      template<class Type> void precalibrateEB(const EcalCalibMap<Type>& calibMap);
+      template<class Type> void precalibrateEE(const EcalCalibMap<Type>& calibMap);
+      void fillRegionGroup(const EcalRegionIndex& index, int iR, TH1F** h, float value, float w);
       bool checkStatusOfEcalRecHit(const EcalChannelStatus &channelStatus,const EcalRecHit &rh);
       bool isInDeadMap( bool isEB, const EcalRecHit &rh );
       float GetDeltaR(float eta1, float eta2, float phi1, float phi2);
       float DeltaPhi(float phi1, float phi2);
       double min( double a, double b);
 
-      TH1F** initializeEpsilonHistograms(const char *name, const char *title, int size );
+      TH1F** initializeEpsilonHistograms(const char *name, const char *title, int size, bool isEE );
       void deleteEpsilonPlot(TH1F **h, int size);
       void writeEpsilonPlot(TH1F **h, const char *folder, int size);
+      void checkpointHistos(std::vector< std::pair<std::string,TH1*> >& histos);
+      void loadCheckpoint();
+      void writeCheckpoint();
       bool getTriggerResult(const edm::Event& iEvent, const edm::EventSetup& iSetup);
       bool getTriggerByName( std::string s );
       bool GetHLTResults(const edm::Event& iEvent, std::string s);
@@ -117,6 +122,9 @@ class FillEpsilonPlot : public edm::EDAnalyzer {
       std::string outfilename_;
       std::string externalGeometry_;
       std::string calibMapPath_; 
+      std::string calibMapBinaryPath_; 
+      std::string frozenRegionsFile_; 
+      int freezeAfter_; 
       std::string jsonFile_; 
       std::string ebContainmentCorrections_;
       std::string MVAEBContainmentCorrections_01_;
@@ -131,6 +139,7 @@ class FillEpsilonPlot : public edm::EDAnalyzer {
       bool        EtaRingCalibEE_;
       bool        SMCalibEE_;
       std::string CalibMapEtaRing_;
+      std::string RingTablesBinary_;
       std::string ebPHIContainmentCorrections_;
       std::string eeContainmentCorrections_;
       std::string Barrel_orEndcap_;
@@ -206,6 +215,8 @@ class FillEpsilonPlot : public edm::EDAnalyzer {
       EcalRegionalCalibration<EcalCalibType::TrigTower> TTCalib;
 
       EcalRegionalCalibrationBase *regionalCalibration_;
+      std::vector<float> ebCalibEnergy_; // rechit energy * IC of the current event, by hashed index
+      std::vector<float> eeCalibEnergy_;
 
       int currentIteration_;
       string outputDir_;
@@ -323,15 +334,18 @@ class FillEpsilonPlot : public edm::EDAnalyzer {
       Float_t Correction1_mva, Correction2_mva, Pt1_mva, Pt2_mva, Mass_mva, MassOr_mva, pi0Eta;
       Int_t   iEta1_mva, iPhi1_mva, iEta2_mva, iPhi2_mva, iSM1_mva, iSM2_mva;
 #endif
-      vector<iXiYtoRing> VectRing;
-      std::map<int,vector<int>> ListEtaFix_xtalEB;
-      std::map<int,vector<int>> ListSMFix_xtalEB;
-      std::map<int,vector<int>> ListEtaFix_xtalEEm;
-      std::map<int,vector<int>> ListEtaFix_xtalEEp;
-      std::map<int,vector<int>> ListQuadFix_xtalEEm;
-      std::map<int,vector<int>> ListQuadFix_xtalEEp;
-      std::map<int,vector<int>> List_IR_EtaPhi;
-      std::map<int,vector<int>> List_IR_XYZ;
+      EcalRingTables ringTables_;
+      EcalRegionIndex etaFixEB_;
+      EcalRegionIndex smFixEB_;
+      EcalRegionIndex etaFixEE_;
+      EcalRegionIndex quadFixEE_;
+      EcalFrozenRegions frozen_;  // converged regions: no epsilon histogram booked
+      std::string checkpointFile_;  // accumulated histograms and their events per lumi, rewritten every checkpointEvery_ s (see writeCheckpoint)
+      int checkpointEvery_;
+      time_t lastCheckpoint_;
+      std::map< std::pair<unsigned,unsigned>, unsigned > checkpointEvents_; // events per lumi already in the loaded checkpoint: skipped
+      std::map< std::pair<unsigned,unsigned>, unsigned > seenEvents_;       // events per lumi in the histograms (loaded or filled)
+      uint32_t calibMapChecksum_;   // FNV-1a of the loaded coefficients: a checkpoint made with other constants is stale
       vector<float> vs4s9EE;
       vector<float> vSeedTime;
       vector<float> vSeedTimeEE;
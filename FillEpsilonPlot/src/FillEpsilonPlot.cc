@@ -23,15 +23,20 @@ Implementation:
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <fstream>
+#include <cstdio>
 
 // user include files
 #include "TFile.h"
+#include "TTree.h"
+#include "TSystem.h"
 #include "TRegexp.h"
 //#include "TStopwatch.h"
 
 #include "FWCore/Framework/interface/Frameworkfwd.h"
 #include "FWCore/Framework/interface/EDAnalyzer.h"
 #include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/LuminosityBlock.h"
 #include "FWCore/Framework/interface/MakerMacros.h"
 
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
@@ -65,6 +70,7 @@ Implementation:
 #include "CalibCode/CalibTools/interface/EcalRecHitCompare.h"
 #include "CalibCode/CalibTools/interface/PreshowerTools.h"
 #include "CalibCode/CalibTools/interface/GeometryService.h"
+#include "CalibCode/CalibTools/interface/BinaryFileTools.h"
 #include "CondFormats/EcalObjects/interface/EcalChannelStatus.h"
 #include "CondFormats/DataRecord/interface/EcalChannelStatusRcd.h"
 //Geom
@@ -106,7 +112,6 @@ using namespace TMVA;
 //Function
 double max_array(double *A, int n);
 double max(double x, double y);
-int GetRing(int x, int y, vector<iXiYtoRing> VectRing, bool debug3);
 
 FillEpsilonPlot::FillEpsilonPlot(const edm::ParameterSet& iConfig)
 {
@@ -143,6 +148,7 @@ FillEpsilonPlot::FillEpsilonPlot(const edm::ParameterSet& iConfig)
     EtaRingCalibEE_                    = iConfig.getUntrackedParameter<bool>("EtaRingCalibEE",false);
     SMCalibEE_                         = iConfig.getUntrackedParameter<bool>("SMCalibEE",false);
     CalibMapEtaRing_                   = iConfig.getUntrackedParameter<std::string>("CalibMapEtaRing","CalibCode/FillEpsilonPlot/data/calibMap.root");
+    RingTablesBinary_                  = iConfig.getUntrackedParameter<std::string>("RingTablesBinary","");
     ebPHIContainmentCorrections_       = iConfig.getUntrackedParameter<std::string>("EBPHIContainmentCorrections");
     eeContainmentCorrections_          = iConfig.getUntrackedParameter<std::string>("EEContainmentCorrections");
     useEBContainmentCorrections_       = iConfig.getUntrackedParameter<bool>("useEBContainmentCorrections");
@@ -152,6 +158,11 @@ FillEpsilonPlot::FillEpsilonPlot(const edm::ParameterSet& iConfig)
     outputDir_                         = iConfig.getUntrackedParameter<std::string>("OutputDir");
     isCRAB_                            = iConfig.getUntrackedParameter<bool>("isCRAB",false);
     calibMapPath_                      = iConfig.getUntrackedParameter<std::string>("calibMapPath");
+    calibMapBinaryPath_                = iConfig.getUntrackedParameter<std::string>("calibMapBinaryPath","");
+    frozenRegionsFile_                 = iConfig.getUntrackedParameter<std::string>("FrozenRegionsFile","");
+    freezeAfter_                       = iConfig.getUntrackedParameter<int>("FreezeAfter",3);
+    checkpointFile_                    = iConfig.getUntrackedParameter<std::string>("CheckpointFile","");
+    checkpointEvery_                   = iConfig.getUntrackedParameter<int>("CheckpointEvery",300);
     Barrel_orEndcap_                   = iConfig.getUntrackedParameter<std::string>("Barrel_orEndcap");
     EB_Seed_E_                         = iConfig.getUntrackedParameter<double>("EB_Seed_E",0.2);
     useEE_EtSeed_                      = iConfig.getUntrackedParameter<bool>("useEE_EtSeed",true);
@@ -223,6 +234,10 @@ FillEpsilonPlot::FillEpsilonPlot(const edm::ParameterSet& iConfig)
     else if(calibTypeString_.compare("etaring") == 0 ) { calibTypeNumber_ = etaring; regionalCalibration_ = &etaCalib;  }
     else throw cms::Exception("CalibType") << "Calib type not recognized\n";
     cout << "crosscheck: selected type: " << regionalCalibration_->printType() << endl;
+    if( calibTypeNumber_!=xtal && (EtaRingCalibEB_ || SMCalibEB_ || EtaRingCalibEE_ || SMCalibEE_) )
+	throw cms::Exception("CalibType") << "EtaRingCalib/SMCalib fold crystal histograms and need CalibType 'xtal'\n";
+    ebCalibEnergy_.resize( EBDetId::kSizeForDenseIndexing, 0. );
+    eeCalibEnergy_.resize( EEDetId::kSizeForDenseIndexing, 0. );
 
     /// external hardcoded geometry
 
@@ -254,21 +269,36 @@ FillEpsilonPlot::FillEpsilonPlot(const edm::ParameterSet& iConfig)
     else if(currentIteration_ > 0)
     {
 	  char fileName[200];
-	  cout << "FillEpsilonPlot:: loading calibraion map at " << calibMapPath_ << endl;
-	  if( isCRAB_ ) sprintf(fileName,"%s",  edm::FileInPath( calibMapPath_.c_str() ).fullPath().c_str() );
-	  else          sprintf(fileName,"%s", calibMapPath_.c_str());
-	  regionalCalibration_->getCalibMap()->loadCalibMapFromFile(fileName);
+	  bool binaryLoaded = false;
+	  if( calibMapBinaryPath_!="" ){
+	    cout << "FillEpsilonPlot:: loading binary calibraion map at " << calibMapBinaryPath_ << endl;
+	    binaryLoaded = regionalCalibration_->getCalibMap()->loadCalibMapFromBinary( calibMapBinaryPath_.c_str(), currentIteration_-1 );
+	    if( !binaryLoaded ) cout << "FillEpsilonPlot:: binary calibraion map not usable, falling back to " << calibMapPath_ << endl;
+	  }
+	  if( !binaryLoaded ){
+	    cout << "FillEpsilonPlot:: loading calibraion map at " << calibMapPath_ << endl;
+	    if( isCRAB_ ) sprintf(fileName,"%s",  edm::FileInPath( calibMapPath_.c_str() ).fullPath().c_str() );
+	    else          sprintf(fileName,"%s", calibMapPath_.c_str());
+	    regionalCalibration_->getCalibMap()->loadCalibMapFromFile(fileName);
+	  }
+	  if( frozenRegionsFile_!="" ) frozen_.load( frozenRegionsFile_, freezeAfter_, currentIteration_-1 );
     }
+    /// identifies the constants in the checkpoints, whatever file they were loaded from
+    std::vector<float> coeffs;
+    coeffs.reserve( EBDetId::kSizeForDenseIndexing + EEDetId::kSizeForDenseIndexing );
+    for(int i=0; i<EBDetId::kSizeForDenseIndexing; i++) coeffs.push_back( regionalCalibration_->getCalibMap()->coeff( EBDetId::detIdFromDenseIndex(i) ) );
+    for(int i=0; i<EEDetId::kSizeForDenseIndexing; i++) coeffs.push_back( regionalCalibration_->getCalibMap()->coeff( EEDetId::detIdFromDenseIndex(i) ) );
+    calibMapChecksum_ = fnv1aChecksum( &coeffs[0], sizeof(float)*coeffs.size() );
 
     /// epsilon histograms
     if(!MakeNtuple4optimization_){
       if(useMassInsteadOfEpsilon_ ){
-	  if( (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EB_h = initializeEpsilonHistograms("epsilon_EB_iR_","#pi^{0} Mass distribution EB - iR ", regionalCalibration_->getCalibMap()->getNRegionsEB() );
-	  if( (Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EE_h = initializeEpsilonHistograms("epsilon_EE_iR_","#pi^{0} Mass distribution EE - iR ", regionalCalibration_->getCalibMap()->getNRegionsEE() );
+	  if( (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EB_h = initializeEpsilonHistograms("epsilon_EB_iR_","#pi^{0} Mass distribution EB - iR ", regionalCalibration_->getCalibMap()->getNRegionsEB(), false );
+	  if( (Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EE_h = initializeEpsilonHistograms("epsilon_EE_iR_","#pi^{0} Mass distribution EE - iR ", regionalCalibration_->getCalibMap()->getNRegionsEE(), true );
 	}
       else{
-	  if( (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EB_h = initializeEpsilonHistograms("epsilon_EB_iR_","Epsilon distribution EB - iR ", regionalCalibration_->getCalibMap()->getNRegionsEB() );
-	  if( (Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EE_h = initializeEpsilonHistograms("epsilon_EE_iR_","Epsilon distribution EE - iR ", regionalCalibration_->getCalibMap()->getNRegionsEE() );
+	  if( (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EB_h = initializeEpsilonHistograms("epsilon_EB_iR_","Epsilon distribution EB - iR ", regionalCalibration_->getCalibMap()->getNRegionsEB(), false );
+	  if( (Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) )  epsilon_EE_h = initializeEpsilonHistograms("epsilon_EE_iR_","Epsilon distribution EE - iR ", regionalCalibration_->getCalibMap()->getNRegionsEE(), true );
 	}
     }
 
@@ -390,6 +420,13 @@ FillEpsilonPlot::FillEpsilonPlot(const edm::ParameterSet& iConfig)
     forest_EE_pi01 = (GBRForest *)EEweight_file_pi01->Get("Correction");
     forest_EE_pi02 = (GBRForest *)EEweight_file_pi02->Get("Correction");
 #endif
+
+    // only histograms are checkpointed: no checkpoint when a tree is filled
+    lastCheckpoint_ = time(0);
+#if defined(SELECTION_TREE) || defined(MVA_REGRESSIO_Tree) || defined(MVA_REGRESSIO_EE)
+    checkpointFile_ = "";
+#endif
+    if( MakeNtuple4optimization_ ) checkpointFile_ = "";
 }
 
 FillEpsilonPlot::~FillEpsilonPlot()
@@ -460,6 +497,15 @@ FillEpsilonPlot::~FillEpsilonPlot()
 FillEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 {
   //cout<<"Event: "<<iEvent.id().event()<<" Run "<<iEvent.id().run()<<" LS "<<iEvent.id().luminosityBlock()<<endl;
+  // checkpoint: the histograms hold the events counted in seenEvents_; the first events of a lumi already
+  // in the checkpoint of a previous attempt are skipped
+  if( checkpointFile_!="" ){
+    if( time(0)-lastCheckpoint_ >= checkpointEvery_ ) writeCheckpoint();
+    std::pair<unsigned,unsigned> id( iEvent.id().run(), iEvent.id().luminosityBlock() );
+    unsigned seen = ++seenEvents_[id];
+    std::map< std::pair<unsigned,unsigned>, unsigned >::const_iterator done = checkpointEvents_.find(id);
+    if( done!=checkpointEvents_.end() && seen<=done->second ) return;
+  }
   //JSON
   EventFlow_EB->Fill(0.); EventFlow_EE->Fill(0.);
   if ( JSONfile_!="" && !myjson->isGoodLS(iEvent.id().run(),iEvent.id().luminosityBlock()) ) return;
@@ -565,11 +611,54 @@ FillEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup
 }
 
 
+/*===============================================================*/
+template<class Type>
+void FillEpsilonPlot::precalibrateEB(const EcalCalibMap<Type>& calibMap)
+  /*===============================================================*/
+{
+  for(EBRecHitCollection::const_iterator itb= ebHandle->begin(); itb != ebHandle->end(); ++itb){
+    EBDetId id(itb->id());
+    ebCalibEnergy_[id.hashedIndex()] = itb->energy() * calibMap.coeffEB(id);
+  }
+}
+
+/*===============================================================*/
+template<class Type>
+void FillEpsilonPlot::precalibrateEE(const EcalCalibMap<Type>& calibMap)
+  /*===============================================================*/
+{
+  for(EERecHitCollection::const_iterator ite= eeHandle->begin(); ite != eeHandle->end(); ++ite){
+    EEDetId id(ite->id());
+    eeCalibEnergy_[id.hashedIndex()] = ite->energy() * calibMap.coeffEE(id);
+  }
+}
+
+/*===============================================================*/
+void FillEpsilonPlot::precalibrateRecHits(int subDetId)
+  /*===============================================================*/
+{
+  // Multiply every rechit by its IC once per event. The clustering reads ebCalibEnergy_/eeCalibEnergy_
+  // only for hits of the current event, so the arrays need no reset.
+  // The granularity is dispatched here once, not per crystal through EcalCalibMapBase.
+  if(subDetId==EcalBarrel){
+    if(      calibTypeNumber_==xtal    ) precalibrateEB( *xtalCalib.getTypedCalibMap() );
+    else if( calibTypeNumber_==tt      ) precalibrateEB( *TTCalib.getTypedCalibMap() );
+    else                                 precalibrateEB( *etaCalib.getTypedCalibMap() );
+  }
+  else{
+    if(      calibTypeNumber_==xtal    ) precalibrateEE( *xtalCalib.getTypedCalibMap() );
+    else if( calibTypeNumber_==tt      ) precalibrateEE( *TTCalib.getTypedCalibMap() );
+    else                                 precalibrateEE( *etaCalib.getTypedCalibMap() );
+  }
+}
+
 /*===============================================================*/
 void FillEpsilonPlot::fillEBClusters(std::vector< CaloCluster > & ebclusters, const edm::Event& iEvent, const EcalChannelStatus &channelStatus)
   /*===============================================================*/
 {
 
+  precalibrateRecHits(EcalBarrel);
+
   std::vector<EcalRecHit> ebseeds;
 
   typedef std::set<EBDetId> XtalInUse;
@@ -691,7 +780,7 @@ void FillEpsilonPlot::fillEBClusters(std::vector< CaloCluster > & ebclusters, co
 	convxtalid(iphi,ieta);
 
 	// use calibration coeff for energy and position
-	float en = RecHitsInWindow[j]->energy() * regionalCalibration_->getCalibMap()->coeff(RecHitsInWindow[j]->id());
+	float en = ebCalibEnergy_[det.hashedIndex()];
 	int dx = diff_neta_s(seed_ieta,ieta);
 	int dy = diff_nphi_s(seed_iphi,iphi);
 #ifdef MVA_REGRESSIO
@@ -806,6 +895,8 @@ void FillEpsilonPlot::fillEEClusters(std::vector< CaloCluster > & eseeclusters,
 
   PreshowerTools esClusteringAlgo(geometry, estopology_, esHandle);
 
+  precalibrateRecHits(EcalEndcap);
+
   std::vector<EcalRecHit> eeseeds;
 
   vector <double> eeclusterS4S9; eeclusterS4S9.clear();
@@ -941,7 +1032,7 @@ void FillEpsilonPlot::fillEEClusters(std::vector< CaloCluster > & eseeclusters,
 	int iy = det.iy();
 
 	// use calibration coeff for energy and position
-	float en = RecHitsInWindow[j]->energy() * regionalCalibration_->getCalibMap()->coeff(RecHitsInWindow[j]->id());
+	float en = eeCalibEnergy_[det.hashedIndex()];
 	int dx = seed_ix-ix;
 	int dy = seed_iy-iy;
 #ifdef MVA_REGRESSIO_EE
@@ -1123,7 +1214,8 @@ void FillEpsilonPlot::fillEEClusters(std::vector< CaloCluster > & eseeclusters,
 }
 
 
-TH1F** FillEpsilonPlot::initializeEpsilonHistograms(const char *name, const char *title, int size )
+/// frozen regions (see EcalFrozenRegions) get no histogram: their slot is null and they are not filled nor written
+TH1F** FillEpsilonPlot::initializeEpsilonHistograms(const char *name, const char *title, int size, bool isEE )
 {
   TH1F **h = new TH1F*[size];
   char name_c[100];
@@ -1131,8 +1223,10 @@ TH1F** FillEpsilonPlot::initializeEpsilonHistograms(const char *name, const char
 
   cout << "FillEpsilonPlot::initializeEpsilonHistograms::useMassInsteadOfEpsilon_ = " << useMassInsteadOfEpsilon_ << endl;
 
+  const EcalRegionIndex& index = isEE ? regionalCalibration_->regionIndexEE() : regionalCalibration_->regionIndexEB();
   for(int jR=0; jR<size; jR++)
   {
+    if( frozen_.regionFrozen(index, jR, isEE) ) { h[jR] = 0; continue; }
     sprintf(name_c, "%s%d", name, jR);
     sprintf(title_c, "%s%d", title, jR);
 
@@ -1165,10 +1259,141 @@ void  FillEpsilonPlot::writeEpsilonPlot(TH1F **h, const char *folder, int size)
   outfile_->mkdir(folder);
   outfile_->cd(folder);
   for(int jR=0; jR<size; jR++)
-    h[jR]->Write();
+    if(h[jR]) h[jR]->Write();
 }
 
 
+/// histograms accumulated over the events, with their folder in the output file
+void FillEpsilonPlot::checkpointHistos(std::vector< std::pair<std::string,TH1*> >& histos)
+{
+  TH1* top[] = { EventFlow_EB, EventFlow_EE, allEpsilon_EB, allEpsilon_EBnw, allEpsilon_EE, allEpsilon_EEnw, entries_EEp, entries_EEm, entries_EB,
+                 Occupancy_EEp, Occupancy_EEm, Occupancy_EB, pi0MassVsIetaEB, pi0MassVsETEB, triggerComposition };
+  for(size_t i=0; i<sizeof(top)/sizeof(top[0]); i++) histos.push_back( std::make_pair(std::string(""), top[i]) );
+  if( Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" )
+    for(int iR=0; iR<regionalCalibration_->getCalibMap()->getNRegionsEB(); iR++)
+      if( epsilon_EB_h[iR] ) histos.push_back( std::make_pair(std::string("Barrel"), (TH1*) epsilon_EB_h[iR]) );
+  if( Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" )
+    for(int iR=0; iR<regionalCalibration_->getCalibMap()->getNRegionsEE(); iR++)
+      if( epsilon_EE_h[iR] ) histos.push_back( std::make_pair(std::string("Endcap"), (TH1*) epsilon_EE_h[iR]) );
+}
+
+
+/// a previous attempt of this job left a checkpoint: its histograms are added to the empty ones and, in
+/// each lumi, as many events as it holds are skipped by analyze (same files, same order: the same events).
+/// A checkpoint that cannot be read, is incomplete, or is of another iteration or other constants is
+/// removed and the job starts from scratch
+void FillEpsilonPlot::loadCheckpoint()
+{
+  if( checkpointFile_=="" || gSystem->AccessPathName( checkpointFile_.c_str() ) ) return;
+  TDirectory* previous = gDirectory;
+  TFile* f = TFile::Open( checkpointFile_.c_str() );
+  std::string stale = "";
+  TTree* stamp = ( f && !f->IsZombie() ) ? (TTree*) f->Get("stamp") : 0;
+  TTree* lumis = ( f && !f->IsZombie() ) ? (TTree*) f->Get("lumis") : 0;
+  Int_t iteration = -1;
+  UInt_t checksum = 0;
+  if( stamp && stamp->GetEntries()==1 ){
+    stamp->SetBranchAddress("iteration", &iteration);
+    stamp->SetBranchAddress("checksum", &checksum);
+    stamp->GetEntry(0);
+  }
+  std::vector< std::pair<std::string,TH1*> > histos;
+  std::vector<TH1*> saved;
+  checkpointHistos(histos);
+  if( !stamp || !lumis ) stale = "unreadable";
+  else if( iteration!=currentIteration_ || checksum!=calibMapChecksum_ ) stale = "of another iteration or other constants";
+  for(size_t i=0; i<histos.size() && stale==""; i++){
+    std::string path = histos[i].first.empty() ? histos[i].second->GetName() : histos[i].first + "/" + histos[i].second->GetName();
+    saved.push_back( (TH1*) f->Get( path.c_str() ) );
+    if( !saved.back() ) stale = "without " + path;
+  }
+  if( stale!="" ){
+    cout << "[FillEpsilonPlot] :: checkpoint " << checkpointFile_ << " " << stale << " (iteration " << iteration << ", constants " << checksum
+         << " for " << currentIteration_ << ", " << calibMapChecksum_ << "): removed, starting from scratch" << endl;
+    if( f ){ f->Close(); delete f; }
+    previous->cd();
+    std::remove( checkpointFile_.c_str() );
+    return;
+  }
+  for(size_t i=0; i<histos.size(); i++) histos[i].second->Add( saved[i] );
+  UInt_t run, lumi, events;
+  lumis->SetBranchAddress("run", &run);
+  lumis->SetBranchAddress("lumi", &lumi);
+  lumis->SetBranchAddress("events", &events);
+  unsigned nEvents = 0;
+  for(Long64_t i=0; i<lumis->GetEntries(); i++){
+    lumis->GetEntry(i);
+    checkpointEvents_[ std::make_pair(run, lumi) ] = events;
+    nEvents += events;
+  }
+  f->Close();
+  delete f;
+  previous->cd();
+  cout << "[FillEpsilonPlot] :: resumed from " << checkpointFile_ << ": " << nEvents << " events in " << checkpointEvents_.size() << " lumis already done" << endl;
+}
+
+
+/// histograms and the number of events of each lumi they contain, written to a temporary file renamed over
+/// the checkpoint (a job killed while writing leaves the previous checkpoint). Called between two events,
+/// so a lumi still going on (or continued in a later input file) is saved with the events seen so far
+void FillEpsilonPlot::writeCheckpoint()
+{
+  TDirectory* previous = gDirectory;
+  std::string tmp = checkpointFile_ + ".tmp";
+  TFile* f = new TFile( tmp.c_str(), "RECREATE" );
+  if( f->IsZombie() ){
+    cout << "[FillEpsilonPlot] :: cannot write the checkpoint " << tmp << endl;
+    delete f;
+    previous->cd();
+    return;
+  }
+  std::vector< std::pair<std::string,TH1*> > histos;
+  checkpointHistos(histos);
+  for(size_t i=0; i<histos.size(); i++){
+    if( i==0 || histos[i].first!=histos[i-1].first ){
+      if( histos[i].first.empty() ) f->cd();
+      else { f->mkdir( histos[i].first.c_str() ); f->cd( histos[i].first.c_str() ); }
+    }
+    histos[i].second->Write();
+  }
+  f->cd();
+  Int_t iteration = currentIteration_;
+  UInt_t checksum = calibMapChecksum_;
+  TTree* stamp = new TTree("stamp", "iteration and constants of the checkpoint");
+  stamp->Branch("iteration", &iteration, "iteration/I");
+  stamp->Branch("checksum", &checksum, "checksum/i");
+  stamp->Fill();
+  stamp->Write();
+  UInt_t run, lumi, events;
+  TTree* lumis = new TTree("lumis", "events per lumi section in the checkpoint");
+  lumis->Branch("run", &run, "run/i");
+  lumis->Branch("lumi", &lumi, "lumi/i");
+  lumis->Branch("events", &events, "events/i");
+  for(std::map< std::pair<unsigned,unsigned>, unsigned >::const_iterator it=seenEvents_.begin(); it!=seenEvents_.end(); ++it){
+    run = it->first.first; lumi = it->first.second; events = it->second;
+    lumis->Fill();
+  }
+  lumis->Write();
+  f->Close();
+  delete f;
+  previous->cd();
+  if( std::rename( tmp.c_str(), checkpointFile_.c_str() )!=0 ){
+    cout << "[FillEpsilonPlot] :: cannot move " << tmp << " to " << checkpointFile_ << endl;
+    return;
+  }
+  lastCheckpoint_ = time(0);
+  cout << "[FillEpsilonPlot] :: checkpoint with " << seenEvents_.size() << " lumis written to " << checkpointFile_ << endl;
+}
+
+
+/// fill the epsilon histograms of all the crystals grouped with iR (same eta-ring, SM, ...)
+void FillEpsilonPlot::fillRegionGroup(const EcalRegionIndex& index, int iR, TH1F** h, float value, float w)
+{
+  int group = index.region(iR);
+  if( group<0 ) return;
+  for(const int* jR = index.begin(group); jR != index.end(group); ++jR) if(h[*jR]) h[*jR]->Fill( value, w );
+}
+
 
 void FillEpsilonPlot::computeEpsilon(std::vector< CaloCluster > & clusters, int subDetId ) 
 {
@@ -1326,7 +1551,7 @@ void FillEpsilonPlot::computeEpsilon(std::vector< CaloCluster > & clusters, int
 	    iY1=id_2.iy(); iY2 = id_1.iy();
 	    ind1=j; ind2=i;
 	  }
-	  int EtaRing_1=GetRing( iX1, iY1, VectRing, false), EtaRing_2=GetRing( iX2, iY2, VectRing, false);
+	  int EtaRing_1=ringTables_.ring( iX1, iY1 ), EtaRing_2=ringTables_.ring( iX2, iY2 );
 	  float value_pi01[10];
 	  value_pi01[0] = ( (G_Sort_1+G_Sort_2).E()/cosh((G_Sort_1+G_Sort_2).Eta()) );
 	  value_pi01[1] = ( G_Sort_1.E()/((G_Sort_1+G_Sort_2).E()/cosh((G_Sort_1+G_Sort_2).Eta())) );
@@ -1563,116 +1788,32 @@ void FillEpsilonPlot::computeEpsilon(std::vector< CaloCluster > & clusters, int
 	  for(RegionWeightVector::const_iterator it = w1.begin(); it != w1.end(); ++it) {
 	    const uint32_t& iR = (*it).iRegion;
 	    const float& w = (*it).value;
+	    const float value = useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k;
 
 	    if(subDetId==EcalBarrel){
 		if( pi0P4.mass()>((Are_pi0_)?0.03:0.35) && pi0P4.mass()<((Are_pi0_)?0.23:0.7) ){
-		  if( !EtaRingCalibEB_ && !SMCalibEB_ ) epsilon_EB_h[iR]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w );
+		  if( !EtaRingCalibEB_ && !SMCalibEB_ && epsilon_EB_h[iR] ) epsilon_EB_h[iR]->Fill( value, w );
 		  allEpsilon_EB->Fill( pi0P4.mass(), w );
-		  std::vector<DetId> mioId(regionalCalibration_->allDetIdsInEERegion(iR));
-		  //allDetIdsInEERegion is not reliable for EB and probably wrong. Getting iEta and iPhi elsewhere
-		  std::map<int,vector<int>>::iterator it; 
-		  int iEta = List_IR_EtaPhi.find(iR)->second[0]; int iPhi = List_IR_EtaPhi.find(iR)->second[1]; int iSM = List_IR_EtaPhi.find(iR)->second[2];
-		  entries_EB->Fill( iEta, iPhi, w );
-		  //If Low Statistic fill all the Eta Ring
-		  if( EtaRingCalibEB_ ){
-		    for(auto const &iterator : ListEtaFix_xtalEB){
-			if( iterator.first == iEta ){ 
-			  for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EB_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-			}
-		    }
-		  }
-		  if( SMCalibEB_ ){
-		    for(auto const &iterator : ListSMFix_xtalEB){
-			if( iterator.first == iSM ){ 
-			  for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EB_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-			}
-		    }
-		  }
-		  //		  for(unsigned int i=0; i<mioId.size(); ++i){//Actually size is 1 for this loop, it is just to access the recHit
-		  //
-		  //		    EBDetId tmp_id(mioId.at(i));
-		  //		    entries_EB->Fill( tmp_id.ieta(), tmp_id.iphi(), w );
-		  //cout<<"His iEta and iPhi is : "<<tmp_id.ieta()<<" "<<tmp_id.iphi()<<" iR "<<iR<<" "<<mioId.at(i).rawId()<<endl;
-		  //		    //If Low Statistic fill all the Eta Ring
-		  //		    if( EtaRingCalib_ ){
-		  //		      for(auto const &iterator : ListEtaFix_xtalEB){
-		  //			  if( iterator.first == tmp_id.ieta() ){ 
-		  //			    for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EB_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-		  //			  }
-		  //			}
-		  //		    }
-		  //		  }
+		  //iR is a region of the calibration granularity: fill the occupancy of all its crystals
+		  const EcalRegionIndex& regionIndex = regionalCalibration_->regionIndexEB();
+		  for(const int* h = regionIndex.begin(iR); h != regionIndex.end(iR); ++h) entries_EB->Fill( ringTables_.ietaEB(*h), ringTables_.iphiEB(*h), w );
+		  //If Low Statistic fill all the Eta Ring (or SM)
+		  if( EtaRingCalibEB_ ) fillRegionGroup( etaFixEB_, iR, epsilon_EB_h, value, w );
+		  if( SMCalibEB_ )      fillRegionGroup( smFixEB_,  iR, epsilon_EB_h, value, w );
 		}
 	    }
 	    else {
 		if( pi0P4.mass()>((Are_pi0_)?0.03:0.35) && pi0P4.mass()<((Are_pi0_)?0.28:0.75) ){
-		  if( !EtaRingCalibEE_ && !SMCalibEE_ ) epsilon_EE_h[iR]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w );
+		  if( !EtaRingCalibEE_ && !SMCalibEE_ && epsilon_EE_h[iR] ) epsilon_EE_h[iR]->Fill( value, w );
 		  allEpsilon_EE->Fill( pi0P4.mass(), w );
-		  std::vector<DetId> mioId(regionalCalibration_->allDetIdsInEERegion(iR));
-		  //allDetIdsInEERegion is not reliable for EE. Getting ix and iy elsewhere
-		  std::map<int,vector<int>>::iterator it; 
-		  int iX = List_IR_XYZ.find(iR)->second[0]; int iY = List_IR_XYZ.find(iR)->second[1]; int iZ = List_IR_XYZ.find(iR)->second[2]; int Quad = List_IR_XYZ.find(iR)->second[3];
-		  if( iZ==-1 ){
-		    entries_EEm->Fill( iX, iY, w );
-		    //If Low Statistic fill all the Eta Ring
-		    if( EtaRingCalibEE_ ){
-			for(auto const &iterator : ListEtaFix_xtalEEm){
-			  if( iterator.first == GetRing( iX, iY, VectRing,false) ){ 
-			    for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EE_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-			  }
-			}
-		    }
-		    if( SMCalibEE_ ){
-			for(auto const &iterator : ListQuadFix_xtalEEm){
-			  if( iterator.first == Quad ){ 
-			    for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EE_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-			  }
-			}
-		    }
-		  }
-		  else{
-		    entries_EEp->Fill( iX, iY, w );
-		    //If Low Statistic fill all the Eta Ring
-		    if( EtaRingCalibEE_ ){
-			for(auto const &iterator : ListEtaFix_xtalEEp){
-			  if( iterator.first == GetRing( iX, iY, VectRing,false) ){
-			    for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EE_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-			  }
-			}
-		    }
-		    if( SMCalibEE_ ){
-			for(auto const &iterator : ListQuadFix_xtalEEp){
-			  if( iterator.first == Quad ){ 
-			    for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EE_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-			  }
-			}
-		    }
+		  const EcalRegionIndex& regionIndex = regionalCalibration_->regionIndexEE();
+		  for(const int* h = regionIndex.begin(iR); h != regionIndex.end(iR); ++h){
+		    if( ringTables_.zsideEE(*h)==-1 ) entries_EEm->Fill( ringTables_.ixEE(*h), ringTables_.iyEE(*h), w );
+		    else                              entries_EEp->Fill( ringTables_.ixEE(*h), ringTables_.iyEE(*h), w );
 		  }
-		  //		  for(unsigned int i=0; i<mioId.size(); ++i){//Actually size is 1 for this loop, it is just to access the recHit
-		  //		    EEDetId tmp_id(mioId.at(i));
-		  //		    if( tmp_id.zside()==-1 ){
-		  //			entries_EEm->Fill( tmp_id.ix(), tmp_id.iy(), w );
-		  //			//If Low Statistic fill all the Eta Ring
-		  //			if( EtaRingCalib_ ){
-		  //			  for(auto const &iterator : ListEtaFix_xtalEEm){
-		  //			    if( iterator.first == GetRing( tmp_id.ix(),tmp_id.iy(),VectRing,false) ){ 
-		  //				for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EE_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-		  //			    }
-		  //			  }
-		  //			}
-		  //		    }
-		  //		    else{
-		  //			entries_EEp->Fill( tmp_id.ix(), tmp_id.iy(), w );
-		  //			//If Low Statistic fill all the Eta Ring
-		  //			if( EtaRingCalib_ ){
-		  //			  for(auto const &iterator : ListEtaFix_xtalEEp){
-		  //			    if( iterator.first == GetRing( tmp_id.ix(),tmp_id.iy(),VectRing,false) ){ 
-		  //				for(unsigned int iRtmp=0; iRtmp<iterator.second.size(); iRtmp++){ epsilon_EE_h[ iterator.second[iRtmp] ]->Fill( useMassInsteadOfEpsilon_? pi0P4.mass() : eps_k, w ); }
-		  //			    }
-		  //			  }
-		  //			}
-		  //		    }
-		  //		  }
+		  //If Low Statistic fill all the Eta Ring (or quadrant)
+		  if( EtaRingCalibEE_ ) fillRegionGroup( etaFixEE_,  iR, epsilon_EE_h, value, w );
+		  if( SMCalibEE_ )      fillRegionGroup( quadFixEE_, iR, epsilon_EE_h, value, w );
 		}
 	    }
 	  }  
@@ -1702,6 +1843,7 @@ FillEpsilonPlot::beginJob()
 #ifdef DEBUG
   cout << "[DEBUG] beginJob" << endl;
 #endif
+  loadCheckpoint();
   /// testing the EE eta ring
   TH2F eep("eep","EE+",102,0.5,101.5,102,-0.5,101.5);
   TH2F eem("eem","EE-",102,0.5,101.5,102,-0.5,101.5);
@@ -1725,82 +1867,46 @@ FillEpsilonPlot::beginJob()
   eep.Write();
   eem.Write();
 
-  ifstream file;
-  file.open( edm::FileInPath ( Endc_x_y_.c_str() ).fullPath().c_str(), ifstream::in);
-  VectRing.clear();
-  while ( !file.eof() ) {
-    string Line;
-    getline( file, Line);
-    string value;
-    std::stringstream MyLine(Line);
-
-    char * cstr, *p;
-    cstr = new char [Line.size()+1];
-    strcpy (cstr, Line.c_str());
-    p=strtok (cstr," ");
-    int i(0);
-    while (p!=NULL){
-	if(i==0)  GiveRing.iX = atoi(p);
-	if(i==1)  GiveRing.iY = atoi(p);
-	if(i==2)  GiveRing.sign = atoi(p);
-	if(i==3){
-	  GiveRing.Ring = atoi(p);
-	  VectRing.push_back(GiveRing);
-	}
-	p=strtok(NULL," ");
-	i++;
-    }
-    delete[] cstr;
+  //Dense iR -> (ieta,iphi,iSM) / (ix,iy,zside,quadrant,ring) tables: mapped from the precompiled
+  //binary if given (see CalibTools/bin/makeEcalRingTables), otherwise built from Endc_x_y and CalibMapEtaRing
+  bool tablesLoaded = false;
+  if( RingTablesBinary_!="" ){
+    std::string binPath = RingTablesBinary_[0]=='/' ? RingTablesBinary_ : edm::FileInPath( RingTablesBinary_.c_str() ).fullPath();
+    tablesLoaded = ringTables_.loadFromFile( binPath );
+    if( !tablesLoaded ) cout<<"WARNING: cannot use "<<RingTablesBinary_<<", parsing "<<Endc_x_y_<<" and "<<CalibMapEtaRing_<<endl;
+  }
+  if( !tablesLoaded ){
+    ringTables_.buildFromRingFile( edm::FileInPath( Endc_x_y_.c_str() ).fullPath() );
+    ringTables_.buildFromCalibTrees( edm::FileInPath( CalibMapEtaRing_.c_str() ).fullPath() );
   }
   //Initialize Map iR vs Eta
   if( (SMCalibEB_ && EtaRingCalibEB_) || (SMCalibEE_ && EtaRingCalibEE_) ) cout<<"WARNING: Intercalibrating with EtaRing and SM!!!"<<endl; 
-  std::vector<int> InitV; InitV.clear();
-  for(Long64_t i=-85; i<86; i++) ListEtaFix_xtalEB[i]   = InitV;
-  for(Long64_t i=0; i<37; i++)   ListSMFix_xtalEB[i]    = InitV;
-  for(Long64_t i=0; i<40; i++)   ListEtaFix_xtalEEm[i]  = InitV;
-  for(Long64_t i=0; i<40; i++)   ListEtaFix_xtalEEp[i]  = InitV;
-  for(Long64_t i=0; i<10; i++)   ListQuadFix_xtalEEm[i] = InitV;
-  for(Long64_t i=0; i<10; i++)   ListQuadFix_xtalEEp[i] = InitV;
-  //Open File where to take iR vs Eta
-  TFile *CalibMapEtaRingF = TFile::Open( edm::FileInPath( CalibMapEtaRing_.c_str() ).fullPath().c_str() );
-  TTree *calibMap_EB      = (TTree*) CalibMapEtaRingF->Get("calibEB");
-  TTree *calibMap_EE      = (TTree*) CalibMapEtaRingF->Get("calibEE");
-  Int_t hashedIndexEB_, hashedIndexEE_, ieta_, iphi_, iSM_, ix_, iy_, zside_, iquadrant_;
-  calibMap_EB->SetBranchAddress( "hashedIndex_", &hashedIndexEB_);
-  calibMap_EB->SetBranchAddress( "ieta_", &ieta_);
-  calibMap_EB->SetBranchAddress( "iphi_", &iphi_);
-  calibMap_EB->SetBranchAddress( "iSM_", &iSM_);
-  calibMap_EE->SetBranchAddress( "hashedIndex_", &hashedIndexEE_);
-  calibMap_EE->SetBranchAddress( "ix_", &ix_);
-  calibMap_EE->SetBranchAddress( "iy_", &iy_);
-  calibMap_EE->SetBranchAddress( "zside_", &zside_);
-  calibMap_EE->SetBranchAddress( "iquadrant_", &iquadrant_);
-  //Loop to Fill the map in EB
-  Long64_t nentries = calibMap_EB->GetEntriesFast();
-  for(Long64_t iEntry=0; iEntry<nentries; iEntry++){
-    calibMap_EB->GetEntry(iEntry);
-    ListEtaFix_xtalEB[ieta_].push_back( hashedIndexEB_ );
-    ListSMFix_xtalEB[iSM_].push_back( hashedIndexEB_ );
-    std::vector<int> EtaPhi; EtaPhi.clear(); EtaPhi.push_back( ieta_ ); EtaPhi.push_back( iphi_ ); EtaPhi.push_back( iSM_ );
-    List_IR_EtaPhi[hashedIndexEB_] = EtaPhi;
+  //Region -> crystals indexes (CSR) used to replicate a candidate over its eta-ring / SM / quadrant.
+  //Groups follow the calibEB/calibEE trees: EB eta-ring ieta+85, EB SM iSM; EE regions are
+  //offset by side (EE- first), the eta-ring slot 0 collects the crystals without a ring (-1)
+  std::vector<int> etaEB(EcalRingTables::nEB,-1), smEB(EcalRingTables::nEB,-1);
+  for(int iR=0; iR<EcalRingTables::nEB; iR++){
+    if( ringTables_.ietaEB(iR)==EcalRingTables::kInvalid ) continue;
+    etaEB[iR] = ringTables_.ietaEB(iR)+85;
+    smEB[iR]  = ringTables_.iSMEB(iR);
   }
-  //Loop to Fill the map in EE
-  nentries = calibMap_EE->GetEntriesFast();
-  for(Long64_t iEntry=0; iEntry<nentries; iEntry++){
-    calibMap_EE->GetEntry(iEntry);
-    if(zside_<0.) ListEtaFix_xtalEEm[ GetRing( ix_,iy_, VectRing, false) ].push_back( hashedIndexEE_ );
-    if(zside_>0.) ListEtaFix_xtalEEp[ GetRing( ix_,iy_, VectRing, false) ].push_back( hashedIndexEE_ );
-    if(zside_<0.) ListQuadFix_xtalEEm[ iquadrant_ ].push_back( hashedIndexEE_ );
-    if(zside_>0.) ListQuadFix_xtalEEp[ iquadrant_ ].push_back( hashedIndexEE_ );
-    std::vector<int> iXYZ; iXYZ.clear(); iXYZ.push_back( ix_ ); iXYZ.push_back( iy_ ); iXYZ.push_back( zside_ ); iXYZ.push_back( iquadrant_ );
-    List_IR_XYZ[hashedIndexEE_] = iXYZ;
+  etaFixEB_.build( etaEB, 171 );
+  smFixEB_.build( smEB, 37 );
+  std::vector<int> etaEE(EcalRingTables::nEE,-1), quadEE(EcalRingTables::nEE,-1);
+  for(int iR=0; iR<EcalRingTables::nEE; iR++){
+    int zside = ringTables_.zsideEE(iR);
+    if( zside==EcalRingTables::kInvalid ) continue;
+    etaEE[iR]  = (zside>0 ? 41 : 0) + ringTables_.ringEE(iR)+1;
+    quadEE[iR] = (zside>0 ? 10 : 0) + ringTables_.iquadrantEE(iR);
   }
+  etaFixEE_.build( etaEE, 82 );
+  quadFixEE_.build( quadEE, 20 );
   //  //###########
   //  fstream  file_Ix;
   //  file_Ix.open( "/afs/cern.ch/work/l/lpernie/ECALpro/gitHubCalib/CMSSW_5_3_6/src/CalibCode/submit/common/ix_iy_iz_EtaRing_Eta.txt", ios::out);
   //  for(int x=0; x<100;x++){
   //    for(int y=0; y<100;y++){
-  //	int ring = GetRing( x, y, VectRing, false);
+  //	int ring = ringTables_.ring( x, y );
   //	if(ring!=-1){
   //	  EEDetId EE_id(x, y, 1, 0);
   //	  file_Ix << x << " "<< y << " " << ring << " " <<endl;
@@ -2102,6 +2208,8 @@ FillEpsilonPlot::beginLuminosityBlock(edm::LuminosityBlock const&, edm::EventSet
   void 
 FillEpsilonPlot::endLuminosityBlock(edm::LuminosityBlock const&, edm::EventSetup const&)
 {
+  // checkpoints also go between events (analyze) for the lumis longer than checkpointEvery_
+  if( checkpointFile_!="" && time(0)-lastCheckpoint_ >= checkpointEvery_ ) writeCheckpoint();
 }
 
 // ------------ method fills 'descriptions' with the allowed parameters for the module  ------------
@@ -2130,18 +2238,5 @@ double max (double x, double y){
   else      return y;
 }
 
-int GetRing(int x, int y, vector<iXiYtoRing> VectRing, bool debug3){
-  int index(0);
-  bool found = false;
-  if(debug3) cout<<"--> Looking for "<<x<<" "<<y<<endl;
-  for( size_t i=0; i<VectRing.size(); i++){
-    if(  VectRing[i].iX != x || VectRing[i].iY != y ){index++;    if(debug3){cout<<"Is not "<<VectRing[i].iX<<" and "<<VectRing[i].iY<<" index is: "<<index<<endl;}}
-    if(  VectRing[i].iX == x && VectRing[i].iY == y ){found=true; if(debug3){cout<<"FOUND! "<<VectRing[i].iX<<" "<<VectRing[i].iY<<endl;}                   break;}
-  }
-  if(found){ if(debug3){cout<<"Returning: "<<VectRing[index].iX<<" "<<VectRing[index].iY<<" "<<VectRing[index].Ring<<endl;} return VectRing[index].Ring;}
-  else{      if(debug3){cout<<"NOT found: "<<x<<" "<<y<<endl;}             return -1;}
-}
-
-
 //define this as a plug-in
 DEFINE_FWK_MODULE(FillEpsilonPlot);
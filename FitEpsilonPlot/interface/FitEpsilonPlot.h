@@ -2,6 +2,7 @@
 
 #include "RooRealVar.h"
 #include "RooFitResult.h"
+#include "RooAbsPdf.h"
 
 #include "FWCore/Framework/interface/Frameworkfwd.h"
 #include "FWCore/Framework/interface/EDAnalyzer.h"
@@ -11,6 +12,8 @@
 
 #include "CalibCode/CalibTools/interface/EcalRegionalCalibration.h"
 #include "CalibCode/CalibTools/interface/EcalCalibTypes.h"
+#include "CalibCode/CalibTools/interface/GeometryService.h"
+#include "CalibCode/CalibTools/interface/EcalFrozenRegions.h"
 
 
 enum calibGranularity{ xtal, tt, etaring };
@@ -28,6 +31,18 @@ struct Pi0FitResult {
    float probchi2;
 };
 
+/// fit of a region in the previous iteration, used as starting point (WarmStartFits)
+/// and as reference of the fast peak estimate (FastPeakEstimate)
+struct FitSeed {
+   float mean;
+   float sigma;
+   float b0, b1, b2, b3;
+   float chi2;
+   float Snorm, Bnorm;  // signal and background pdf fractions within +-3 sigma
+   int attempt;  // retry ladder step that gave the stored fit, -1 = no seed
+   FitSeed() : mean(0.), sigma(0.), b0(0.), b1(0.), b2(0.), b3(0.), chi2(0.), Snorm(0.), Bnorm(0.), attempt(-1) {}
+};
+
 class FitEpsilonPlot : public edm::EDAnalyzer {
    public:
       enum FitMode{ Eta=0, Pt, GausPol3, GausEndpoint, Pi0EB, Pi0EE, EtaEB };
@@ -48,11 +63,20 @@ class FitEpsilonPlot : public edm::EDAnalyzer {
       virtual void endLuminosityBlock(edm::LuminosityBlock const&, edm::EventSetup const&);
 
       void loadEpsilonPlot(char *filename);
+      void loadEpsilonSums(const std::vector<std::string>& fileNames);
+      void loadEpsilonRange(const char* dirName, const char* prefix, TH1F** h, const std::vector<int>& regions, bool isEE);
       void saveCoefficients();
       void IterativeFit(TH1F* h, TF1 & ffit); 
       void deleteEpsilonPlot(TH1F **h, int size);
 
-      Pi0FitResult FitMassPeakRooFit(TH1F* h,double xlo, double xhi, uint32_t HistoIndex, int ngaus=1, FitMode mode=Pi0EB, int niter=0, bool isNot_2010_=true);
+      Pi0FitResult FitMassPeakRooFit(TH1F* h,double xlo, double xhi, uint32_t HistoIndex, int ngaus=1, FitMode mode=Pi0EB, int niter=0, bool isNot_2010_=true, bool retry=true);
+      Pi0FitResult FitMassPeakConcurrent(TH1F* h,double xlo, double xhi, uint32_t HistoIndex, int ngaus=1, FitMode mode=Pi0EB, bool isNot_2010_=true);
+      double binnedChi2(RooAbsPdf& model, RooRealVar& x, TH1F* h, double nExpected);
+      bool FastPeakEstimate(TH1F* h, double xlo, double xhi, uint32_t HistoIndex, FitMode mode, float& mean);
+      bool loadFitSeeds(const char* fileName, int nTrials);
+      const FitSeed* previousFit(uint32_t HistoIndex, FitMode mode) const;
+      const FitSeed* fitSeed(uint32_t HistoIndex, FitMode mode) const;
+      int firstAttempt(uint32_t HistoIndex, FitMode mode) const;
 
       // ----------member data ---------------------------
 
@@ -67,15 +91,25 @@ class FitEpsilonPlot : public edm::EDAnalyzer {
       std::string outfilename_;
       std::string calibTypeString_;
       std::string epsilonPlotFileName_;
+      std::vector<std::string> epsilonPlotFileNames_;  // fused merge and fit: summed here instead of epsilonPlotFileName_
       std::string calibMapPath_; 
+      std::string calibMapBinaryPath_; 
+      std::string fitSeedsPath_;  // local copy of the fit trees of the previous iteration
+      std::string externalGeometry_; 
+      std::string frozenRegionsFile_; 
       std::string Barrel_orEndcap_; 
 
       std::string EEoEB_; 
       bool isNot_2010_; 
       bool Are_pi0_; 
       bool StoreForTest_; 
+      bool headlessFits_; 
+      int storeFitEvery_; 
+      int freezeAfter_; 
       int inRangeFit_; 
       int finRangeFit_; 
+      std::vector<int> fitRegions_;  // regions fitted by this job, sorted
+      bool explicitRegions_;         // fitRegions_ from FitRegions instead of [NInFit,NFinFit]
 
       calibGranularity calibTypeNumber_;
 
@@ -83,10 +117,24 @@ class FitEpsilonPlot : public edm::EDAnalyzer {
       TH1F **epsilon_EE_h;  // epsilon distribution in EE
 
       TFile *inputEpsilonFile_;
+      TFile *externalGeometryFile_;
       TFile *outfile_;
       TFile *outfileTEST_;
 
       bool useMassInsteadOfEpsilon_;
+      bool warmStartFits_;
+      bool concurrentFitVariants_;
+      bool inVariantChild_;          // forked variant fit: no output, result goes through the pipe
+      const FitSeed* variantSeed_;   // starting point of the refit of the chosen variant
+      bool fastPeakEstimate_;
+      double fastPeakMinSignal_;
+      double fastPeakMaxPull_;
+      double fastPeakMaxSigmaShift_;
+      int fastPeakValidateEvery_;
+      int nFastPeaks_;
+      std::vector<FitSeed> EBseeds_;  // by region
+      std::vector<FitSeed> EEseeds_;
+      EcalFrozenRegions frozen_;  // converged regions: not fitted, coefficient carried forward
 
       std::map<int,float> EBmap_Signal;//#
       std::map<int,float> EBmap_Backgr;
@@ -101,6 +149,8 @@ class FitEpsilonPlot : public edm::EDAnalyzer {
       std::map<int,float> EBmap_b2;
       std::map<int,float> EBmap_b3;
       std::map<int,float> EBmap_Bnorm;
+      std::map<int,int>   EBmap_attempt;
+      std::map<int,float> EBmap_time;
 
       std::map<int,float> EEmap_Signal;
       std::map<int,float> EEmap_Backgr;
@@ -115,6 +165,8 @@ class FitEpsilonPlot : public edm::EDAnalyzer {
       std::map<int,float> EEmap_b2;
       std::map<int,float> EEmap_b3;
       std::map<int,float> EEmap_Bnorm;
+      std::map<int,int>   EEmap_attempt;
+      std::map<int,float> EEmap_time;
 
 
 
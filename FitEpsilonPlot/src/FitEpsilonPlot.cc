@@ -21,6 +21,12 @@ Implementation:
 #include <memory>
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "TF1.h"
 #include "TH1F.h"
@@ -29,6 +35,9 @@ Implementation:
 #include "TTree.h"
 #include "TLatex.h"
 #include "TMath.h"
+#include "TKey.h"
+#include "TDirectory.h"
+#include "TStopwatch.h"
 
 // user include files
 #include "FWCore/Framework/interface/Frameworkfwd.h"
@@ -37,6 +46,7 @@ Implementation:
 #include "FWCore/Framework/interface/MakerMacros.h"
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
 #include "FWCore/Utilities/interface/Exception.h"
+#include "FWCore/ParameterSet/interface/FileInPath.h"
 
 #include "DataFormats/EcalDetId/interface/EBDetId.h"
 #include "DataFormats/EcalDetId/interface/EEDetId.h"
@@ -52,7 +62,7 @@ Implementation:
 #include "RooPlot.h"
 #include "RooFitResult.h"
 #include "RooNLLVar.h"
-#include "RooChi2Var.h"
+#include "RooHistError.h"
 #include "RooMinuit.h"
 
 #include "CalibCode/FitEpsilonPlot/interface/FitEpsilonPlot.h"
@@ -72,15 +82,33 @@ FitEpsilonPlot::FitEpsilonPlot(const edm::ParameterSet& iConfig)
     //now do what ever initialization is needed
     currentIteration_ =  iConfig.getUntrackedParameter<int>("CurrentIteration");
     epsilonPlotFileName_ = iConfig.getUntrackedParameter<std::string>("EpsilonPlotFileName");
+    epsilonPlotFileNames_ = iConfig.getUntrackedParameter<std::vector<std::string> >("EpsilonPlotFileNames",std::vector<std::string>());
     outputDir_ = iConfig.getUntrackedParameter<std::string>("OutputDir");
     outfilename_          = iConfig.getUntrackedParameter<std::string>("OutputFile");
     calibMapPath_ = iConfig.getUntrackedParameter<std::string>("calibMapPath");
+    calibMapBinaryPath_ = iConfig.getUntrackedParameter<std::string>("calibMapBinaryPath","");
+    fitSeedsPath_ = iConfig.getUntrackedParameter<std::string>("FitSeedsPath","");
+    warmStartFits_ = iConfig.getUntrackedParameter<bool>("WarmStartFits",false);
+    concurrentFitVariants_ = iConfig.getUntrackedParameter<bool>("ConcurrentFitVariants",false);
+    inVariantChild_ = false;
+    variantSeed_ = 0;
+    fastPeakEstimate_ = iConfig.getUntrackedParameter<bool>("FastPeakEstimate",false);
+    fastPeakMinSignal_ = iConfig.getUntrackedParameter<double>("FastPeakMinSignal",2000.);
+    fastPeakMaxPull_ = iConfig.getUntrackedParameter<double>("FastPeakMaxPull",1.);
+    fastPeakMaxSigmaShift_ = iConfig.getUntrackedParameter<double>("FastPeakMaxSigmaShift",0.2);
+    fastPeakValidateEvery_ = iConfig.getUntrackedParameter<int>("FastPeakValidateEvery",0);
+    nFastPeaks_ = 0;
     inRangeFit_ = iConfig.getUntrackedParameter<int>("NInFit");
     finRangeFit_ = iConfig.getUntrackedParameter<int>("NFinFit");    
+    fitRegions_ = iConfig.getUntrackedParameter<std::vector<int> >("FitRegions",std::vector<int>());
     EEoEB_ = iConfig.getUntrackedParameter<std::string>("EEorEB");
     isNot_2010_ = iConfig.getUntrackedParameter<bool>("isNot_2010");
     Are_pi0_ = iConfig.getUntrackedParameter<bool>("Are_pi0");
     StoreForTest_ = iConfig.getUntrackedParameter<bool>("StoreForTest","false");
+    headlessFits_ = iConfig.getUntrackedParameter<bool>("HeadlessFits",false);
+    storeFitEvery_ = iConfig.getUntrackedParameter<int>("StoreFitEvery",0);
+    frozenRegionsFile_ = iConfig.getUntrackedParameter<std::string>("FrozenRegionsFile","");
+    freezeAfter_ = iConfig.getUntrackedParameter<int>("FreezeAfter",3);
     Barrel_orEndcap_ = iConfig.getUntrackedParameter<std::string>("Barrel_orEndcap");
 
     /// setting calibration type
@@ -91,14 +119,53 @@ FitEpsilonPlot::FitEpsilonPlot(const edm::ParameterSet& iConfig)
     else throw cms::Exception("CalibType") << "Calib type not recognized\n";
     cout << "FIT_EPSILON: crosscheck: selected type: " << regionalCalibration_->printType() << endl;
 
+    /// the eta-rings are computed from the geometry (EndcapTools), as in FillEpsilonPlot: every etaring job needs it
+    externalGeometry_ = iConfig.getUntrackedParameter<std::string>("ExternalGeometry","");
+    externalGeometryFile_ = 0;
+    if( externalGeometry_!="" ){
+	  externalGeometryFile_ = TFile::Open( edm::FileInPath( externalGeometry_.c_str() ).fullPath().c_str() );
+	  if(!externalGeometryFile_) throw cms::Exception("ExtGeom") << "External Geometry file (" << externalGeometry_ << ") not found\n";
+	  GeometryService::setGeometryName(externalGeometry_);
+	  GeometryService::setGeometryPtr( ECALGeometry::getGeometry(externalGeometryFile_) );
+    }
+    else if( calibTypeNumber_==etaring )
+	  throw cms::Exception("ExtGeom") << "CalibType etaring needs ExternalGeometry\n";
+
+    /// regions of this job: the FitRegions list of a balanced fit job (any regions, not contiguous),
+    /// or the range [NInFit,NFinFit]. With a list, the hint range is the one spanned by the list
+    int nRegions = EEoEB_=="Barrel" ? regionalCalibration_->getCalibMap()->getNRegionsEB() : regionalCalibration_->getCalibMap()->getNRegionsEE();
+    explicitRegions_ = !fitRegions_.empty();
+    if( explicitRegions_ ){
+	  std::sort( fitRegions_.begin(), fitRegions_.end() );
+	  fitRegions_.erase( std::unique( fitRegions_.begin(), fitRegions_.end() ), fitRegions_.end() );
+	  if( fitRegions_.front()<0 || fitRegions_.back()>=nRegions )
+		throw cms::Exception("FitRegions") << "FitRegions out of the " << nRegions << " " << EEoEB_ << " regions\n";
+	  inRangeFit_ = fitRegions_.front();
+	  finRangeFit_ = fitRegions_.back();
+	  cout << "FIT_EPSILON: fitting " << fitRegions_.size() << " " << EEoEB_ << " regions of the FitRegions list" << endl;
+    }
+    else
+	  for(int iR=std::max(0, inRangeFit_); iR<=finRangeFit_ && iR<nRegions; iR++) fitRegions_.push_back(iR);
+
     /// retrieving calibration coefficients of the previous iteration
     char fileName[200];
     if(currentIteration_ < 0) throw cms::Exception("IterationNumber") << "Invalid negative iteration number\n";
     else if(currentIteration_ > 0)
     {
 	  //sprintf(fileName,"%s/iter_%d/calibMap.root", outputDir_.c_str(), currentIteration_-1);
-	  sprintf(fileName,"%s", calibMapPath_.c_str());
-	  regionalCalibration_->getCalibMap()->loadCalibMapFromFile(fileName);
+	  bool binaryLoaded = false;
+	  if( calibMapBinaryPath_!="" ){
+	    binaryLoaded = regionalCalibration_->getCalibMap()->loadCalibMapFromBinary( calibMapBinaryPath_.c_str(), currentIteration_-1 );
+	    if( !binaryLoaded ) cout << "FIT_EPSILON: binary calibMap not usable, falling back to " << calibMapPath_ << endl;
+	  }
+	  if( !binaryLoaded ){
+	    sprintf(fileName,"%s", calibMapPath_.c_str());
+	    regionalCalibration_->getCalibMap()->loadCalibMapFromFile(fileName);
+	  }
+	  /// the local copy of the fit trees written with the binary map, else calibMap.root
+	  if( (warmStartFits_ || fastPeakEstimate_) && !( fitSeedsPath_!="" && loadFitSeeds( fitSeedsPath_.c_str(), 1 ) ) )
+		loadFitSeeds( calibMapPath_.c_str(), 10 );
+	  if( frozenRegionsFile_!="" ) frozen_.load( frozenRegionsFile_, freezeAfter_, currentIteration_-1 );
     }
 
     // load epsilon from current iter
@@ -106,9 +173,15 @@ FitEpsilonPlot::FitEpsilonPlot(const edm::ParameterSet& iConfig)
     epsilon_EE_h = new TH1F*[regionalCalibration_->getCalibMap()->getNRegionsEE()];
     //sprintf(fileName,"%s/iter_%d/EcalNtp.root", outputDir_.c_str(), currentIteration_);
     //sprintf(fileName,"%s/iter_%d/%s", outputDir_.c_str(), currentIteration_, epsilonPlotFileName_.c_str());
-    sprintf(fileName,"%s", epsilonPlotFileName_.c_str());
-    cout << "FIT_EPSILON: FitEpsilonPlot:: loading epsilon plots from file: " << epsilonPlotFileName_ << endl;
-    loadEpsilonPlot(fileName);
+    if( !epsilonPlotFileNames_.empty() ){
+	  cout << "FIT_EPSILON: FitEpsilonPlot:: summing epsilon plots of " << epsilonPlotFileNames_.size() << " files" << endl;
+	  loadEpsilonSums(epsilonPlotFileNames_);
+    }
+    else{
+	  sprintf(fileName,"%s", epsilonPlotFileName_.c_str());
+	  cout << "FIT_EPSILON: FitEpsilonPlot:: loading epsilon plots from file: " << epsilonPlotFileName_ << endl;
+	  loadEpsilonPlot(fileName);
+    }
 
 
 }
@@ -119,8 +192,9 @@ FitEpsilonPlot::~FitEpsilonPlot()
     delete epsilon_EB_h;
     delete epsilon_EE_h;
 
-    if(inputEpsilonFile_->IsOpen())
+    if(inputEpsilonFile_ && inputEpsilonFile_->IsOpen())
 	  inputEpsilonFile_->Close();
+    if(externalGeometryFile_) externalGeometryFile_->Close();
 }
 
 
@@ -131,34 +205,97 @@ FitEpsilonPlot::~FitEpsilonPlot()
 
 void FitEpsilonPlot::loadEpsilonPlot(char *filename)
 {
-    char line[100];
-
     inputEpsilonFile_ = TFile::Open(filename);
     if(!inputEpsilonFile_) 
 	  throw cms::Exception("loadEpsilonPlot") << "Cannot open file " << string(filename) << "\n"; 
     if( EEoEB_ == "Barrel" && (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" ) ){
-	  for(int iR=inRangeFit_; iR <= finRangeFit_ && iR < regionalCalibration_->getCalibMap()->getNRegionsEB(); iR++)
-	  {
-		sprintf(line,"Barrel/epsilon_EB_iR_%d",iR);
-		epsilon_EB_h[iR] = (TH1F*)inputEpsilonFile_->Get(line);
-
-		if(!epsilon_EB_h[iR])
-		    throw cms::Exception("loadEpsilonPlot") << "Cannot load histogram " << string(line) << "\n";
-		else if(!(iR%1000))
-		    cout << "FIT_EPSILON: Epsilon distribution for EB region " << iR << " loaded" << endl;
-	  }
+	  loadEpsilonRange( "Barrel", "epsilon_EB_iR_", epsilon_EB_h, fitRegions_, false );
     }
     else if( EEoEB_ == "Endcap" && (Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) ){
-	  for(int jR=inRangeFit_; jR <= finRangeFit_ && jR<EEDetId::kSizeForDenseIndexing; jR++)
-	  {
-		sprintf(line,"Endcap/epsilon_EE_iR_%d",jR);
-		epsilon_EE_h[jR] = (TH1F*)inputEpsilonFile_->Get(line);
-		if(!epsilon_EE_h[jR])
-		    throw cms::Exception("loadEpsilonPlot") << "Cannot load histogram " << string(line) << "\n";
-		else if(!(jR%1000))
-		    cout << "FIT_EPSILON: Epsilon distribution for EE region " << jR << " loaded" << endl;
+	  loadEpsilonRange( "Endcap", "epsilon_EE_iR_", epsilon_EE_h, fitRegions_, true );
+    }
+}
+
+/// fused merge and fit (EpsilonPlotFileNames): the distributions of the regions of this job summed over
+/// the partial sums (hadd outputs), one file open at a time, instead of read from the merged file
+void FitEpsilonPlot::loadEpsilonSums(const std::vector<std::string>& fileNames)
+{
+    bool isEE = ( EEoEB_ == "Endcap" );
+    bool wanted = isEE ? ( Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) : ( EEoEB_ == "Barrel" && (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE") );
+    inputEpsilonFile_ = 0;
+    if( !wanted ) return;
+    TH1F** sum = isEE ? epsilon_EE_h : epsilon_EB_h;
+    TH1F** part = new TH1F*[ isEE ? regionalCalibration_->getCalibMap()->getNRegionsEE() : regionalCalibration_->getCalibMap()->getNRegionsEB() ];
+    for(size_t k=0; k<fitRegions_.size(); k++) sum[fitRegions_[k]] = 0;
+
+    for(size_t iF=0; iF<fileNames.size(); iF++){
+	  inputEpsilonFile_ = TFile::Open(fileNames[iF].c_str());
+	  if(!inputEpsilonFile_ || inputEpsilonFile_->IsZombie())
+		throw cms::Exception("loadEpsilonPlot") << "Cannot open file " << fileNames[iF] << "\n";
+	  loadEpsilonRange( isEE ? "Endcap" : "Barrel", isEE ? "epsilon_EE_iR_" : "epsilon_EB_iR_", part, fitRegions_, isEE );
+	  for(size_t k=0; k<fitRegions_.size(); k++){
+		int iR = fitRegions_[k];
+		if(!part[iR]) continue;
+		if(!sum[iR]){
+		    part[iR]->SetDirectory(0);
+		    sum[iR] = part[iR];
+		}
+		else{
+		    sum[iR]->Add(part[iR]);
+		    delete part[iR];
+		}
 	  }
+	  inputEpsilonFile_->Close();
+	  delete inputEpsilonFile_;
     }
+    inputEpsilonFile_ = 0;
+    delete [] part;
+}
+
+/// reads <dirName>/<prefix>N for the N of regions (sorted) with one pass over the directory's key list,
+/// instead of one name lookup per histogram, and the keys in the order they are stored in the file.
+/// Frozen regions may be missing (FillEpsilonPlot does not book them): their histogram is left null
+void FitEpsilonPlot::loadEpsilonRange(const char* dirName, const char* prefix, TH1F** h, const std::vector<int>& regions, bool isEE)
+{
+    if(regions.empty()) return;
+    int first = regions.front(), last = regions.back();
+    TDirectory* dir = inputEpsilonFile_->GetDirectory(dirName);
+    if(!dir) throw cms::Exception("loadEpsilonPlot") << "Cannot find directory " << dirName << "\n";
+
+    std::vector<TKey*> keys(last-first+1, (TKey*)0);
+    std::vector<bool> wanted(last-first+1, false);
+    for(size_t k=0; k<regions.size(); k++) wanted[regions[k]-first] = true;
+    size_t prefixLength = strlen(prefix);
+    TIter next( dir->GetListOfKeys() );
+    while( TKey* key = (TKey*)next() ){
+	  const char* name = key->GetName();
+	  if( strncmp(name, prefix, prefixLength)!=0 ) continue;
+	  char* endPtr;
+	  long iR = strtol(name+prefixLength, &endPtr, 10);
+	  if( *endPtr!='\0' || iR<first || iR>last || !wanted[iR-first] ) continue;
+	  // several cycles of the same name: keep the highest one, as TDirectory::Get does
+	  TKey*& slot = keys[iR-first];
+	  if( !slot || key->GetCycle()>slot->GetCycle() ) slot = key;
+    }
+
+    std::vector< std::pair<Long64_t,int> > order;
+    order.reserve(regions.size());
+    const EcalRegionIndex& index = isEE ? regionalCalibration_->regionIndexEE() : regionalCalibration_->regionIndexEB();
+    for(size_t k=0; k<regions.size(); k++){
+	  size_t i = regions[k]-first;
+	  h[first+i] = 0;
+	  if(!keys[i] && frozen_.regionFrozen(index, first+i, isEE)) continue;
+	  if(!keys[i]) throw cms::Exception("loadEpsilonPlot") << "Cannot load histogram " << dirName << "/" << prefix << first+i << "\n";
+	  order.push_back( std::make_pair( keys[i]->GetSeekKey(), int(i) ) );
+    }
+    std::sort( order.begin(), order.end() );
+
+    for(size_t k=0; k<order.size(); k++){
+	  int i = order[k].second;
+	  h[first+i] = dynamic_cast<TH1F*>( keys[i]->ReadObj() );
+	  if(!h[first+i]) throw cms::Exception("loadEpsilonPlot") << "Cannot load histogram " << dirName << "/" << keys[i]->GetName() << "\n";
+    }
+    cout << "FIT_EPSILON: " << order.size() << " epsilon distributions loaded from " << dirName << " (" << regions.size() << " regions in " << prefix << first << " - " << last << ")" << endl;
 }
 
 
@@ -202,16 +339,23 @@ void FitEpsilonPlot::saveCoefficients()
     if( EEoEB_ == "Barrel" ) hint->SetBinContent(3,0);
     else                     hint->SetBinContent(3,1);
     hint->Write();
+    /// balanced fit jobs: the regions of the job inside the hint range, for the merge
+    if( explicitRegions_ ){
+	  int nRegions = EEoEB_=="Barrel" ? regionalCalibration_->getCalibMap()->getNRegionsEB() : regionalCalibration_->getCalibMap()->getNRegionsEE();
+	  TH1F* hregions = new TH1F("fitRegions","Regions fitted by this job (1)",nRegions,-0.5,nRegions-0.5);
+	  for(size_t k=0; k<fitRegions_.size(); k++) hregions->SetBinContent(fitRegions_[k]+1,1);
+	  hregions->Write();
+    }
 
     /// filling Barrel Map
     for(int j=0; j<regionalCalibration_->getCalibMap()->getNRegionsEB(); ++j)  
     {
-	  std::vector<DetId> ids = regionalCalibration_->allDetIdsInEBRegion(j);
-	  for(std::vector<DetId>::const_iterator iid = ids.begin(); iid != ids.end(); ++iid) {
-		EBDetId ebid(*iid);
+	  const EcalRegionIndex& index = regionalCalibration_->regionIndexEB();
+	  for(const int* h = index.begin(j); h != index.end(j); ++h) {
+		EBDetId ebid = EBDetId::unhashIndex(*h);
 		int ix = ebid.ieta()+EBDetId::MAX_IETA+1;
 
-		float coeffValue = regionalCalibration_->getCalibMap()->coeff(*iid) > 0. ? regionalCalibration_->getCalibMap()->coeff(*iid) : 1.;
+		float coeffValue = regionalCalibration_->getCalibMap()->coeff(ebid) > 0. ? regionalCalibration_->getCalibMap()->coeff(ebid) : 1.;
 		hmap_EB->SetBinContent( ix, ebid.iphi(), coeffValue );
 	  } // loop over DetId in regions
     }
@@ -221,11 +365,11 @@ void FitEpsilonPlot::saveCoefficients()
 
     for(int jR=0; jR < regionalCalibration_->getCalibMap()->getNRegionsEE(); jR++)
     {
-	  std::vector<DetId> ids =  regionalCalibration_->allDetIdsInEERegion(jR);
-	  for(std::vector<DetId>::const_iterator iid = ids.begin(); iid != ids.end(); ++iid) 
+	  const EcalRegionIndex& index = regionalCalibration_->regionIndexEE();
+	  for(const int* h = index.begin(jR); h != index.end(jR); ++h) 
 	  { 
-		EEDetId eeid(*iid);
-		float coeffValue =  regionalCalibration_->getCalibMap()->coeff(*iid) > 0. ?  regionalCalibration_->getCalibMap()->coeff(*iid) : 1.;
+		EEDetId eeid = EEDetId::unhashIndex(*h);
+		float coeffValue =  regionalCalibration_->getCalibMap()->coeff(eeid) > 0. ?  regionalCalibration_->getCalibMap()->coeff(eeid) : 1.;
 
 		if(eeid.positiveZ())
 		    hmap_EEp->Fill(eeid.ix(), eeid.iy(), coeffValue); 
@@ -254,6 +398,8 @@ void FitEpsilonPlot::saveCoefficients()
     int        iTTeta;
     int        iTTphi;
     int        iter = currentIteration_;
+    int        iRegion;   // region of the calibration granularity (== hashedIndex for xtal)
+    int        fit_attempt;
     float      regCoeff;
     float      Signal;//#
     float      Backgr; 
@@ -268,6 +414,7 @@ void FitEpsilonPlot::saveCoefficients()
     float      fit_b2;    
     float      fit_b3;    
     float      fit_Bnorm; 
+    float      fit_time;  // seconds spent on the region (fits and retries), cost of the region in the next iteration
     /// endcap variables
     int ix;
     int iy;
@@ -292,6 +439,7 @@ void FitEpsilonPlot::saveCoefficients()
     treeEB->Branch("iTTeta",&iTTeta,"iTTeta/I");
     treeEB->Branch("iTTphi",&iTTphi,"iTTphi/I");
     treeEB->Branch("iter",&iter,"iter/I");
+    treeEB->Branch("iRegion",&iRegion,"iRegion/I");
     treeEB->Branch("coeff",&regCoeff,"coeff/F");
     treeEB->Branch("Signal",&Signal,"Signal/F");//#
     treeEB->Branch("Backgr",&Backgr,"Backgr/F");
@@ -306,6 +454,8 @@ void FitEpsilonPlot::saveCoefficients()
     treeEB->Branch("fit_b2",&fit_b2,"fit_b2/F");
     treeEB->Branch("fit_b3",&fit_b3,"fit_b3/F");
     treeEB->Branch("fit_Bnorm",&fit_Bnorm,"fit_Bnorm/F");
+    treeEB->Branch("fit_attempt",&fit_attempt,"fit_attempt/I");
+    treeEB->Branch("fit_time",&fit_time,"fit_time/F");
 
     /// endcap
     treeEE->Branch("ix",&ix,"ix/I");
@@ -317,6 +467,7 @@ void FitEpsilonPlot::saveCoefficients()
     treeEE->Branch("iquadrant",&iquadrant,"iquadrant/I");
     treeEE->Branch("hashedIndex",&hashedIndex,"hashedIndex/I");
     treeEE->Branch("iter",&iter,"iter/I");
+    treeEE->Branch("iRegion",&iRegion,"iRegion/I");
     treeEE->Branch("coeff",&regCoeff,"coeff/F");
     treeEE->Branch("Signal",&Signal,"Signal/F");//#
     treeEE->Branch("Backgr",&Backgr,"Backgr/F");
@@ -331,13 +482,16 @@ void FitEpsilonPlot::saveCoefficients()
     treeEE->Branch("fit_b2",&fit_b2,"fit_b2/F");
     treeEE->Branch("fit_b3",&fit_b3,"fit_b3/F");
     treeEE->Branch("fit_Bnorm",&fit_Bnorm,"fit_Bnorm/F");
+    treeEE->Branch("fit_attempt",&fit_attempt,"fit_attempt/I");
+    treeEE->Branch("fit_time",&fit_time,"fit_time/F");
 
 
     for(int iR=0; iR < regionalCalibration_->getCalibMap()->getNRegionsEB(); ++iR)  {
-	  std::vector<DetId> ids = regionalCalibration_->allDetIdsInEBRegion(iR);
-	  for(std::vector<DetId>::const_iterator iid = ids.begin(); iid != ids.end(); ++iid) {
-		EBDetId ebid(*iid);
+	  const EcalRegionIndex& index = regionalCalibration_->regionIndexEB();
+	  for(const int* h = index.begin(iR); h != index.end(iR); ++h) {
+		EBDetId ebid = EBDetId::unhashIndex(*h);
 		hashedIndex = ebid.hashedIndex();
+		iRegion = iR;
 		ieta = ebid.ieta();
 		iphi = ebid.iphi();
 		iSM = ebid.ism();
@@ -345,21 +499,23 @@ void FitEpsilonPlot::saveCoefficients()
 		iTT  = ebid.tower().hashedIndex();
 		iTTeta = ebid.tower_ieta();
 		iTTphi = ebid.tower_iphi();
-		Signal = EBmap_Signal[ebid.hashedIndex()];//#
-		Backgr = EBmap_Backgr[ebid.hashedIndex()];
-		Chisqu = EBmap_Chisqu[ebid.hashedIndex()];
-		Ndof = EBmap_ndof[ebid.hashedIndex()];
-		fit_mean     = EBmap_mean[ebid.hashedIndex()];
-		fit_mean_err = EBmap_mean_err[ebid.hashedIndex()];
-		fit_sigma  = EBmap_sigma[ebid.hashedIndex()];
-		fit_Snorm  = EBmap_Snorm[ebid.hashedIndex()];
-		fit_b0     = EBmap_b0[ebid.hashedIndex()];
-		fit_b1     = EBmap_b1[ebid.hashedIndex()];
-		fit_b2     = EBmap_b2[ebid.hashedIndex()];
-		fit_b3     = EBmap_b3[ebid.hashedIndex()];
-		fit_Bnorm  = EBmap_Bnorm[ebid.hashedIndex()];
-
-		regCoeff = regionalCalibration_->getCalibMap()->coeff(*iid);
+		Signal = EBmap_Signal[iR];//#
+		Backgr = EBmap_Backgr[iR];
+		Chisqu = EBmap_Chisqu[iR];
+		Ndof = EBmap_ndof[iR];
+		fit_mean     = EBmap_mean[iR];
+		fit_mean_err = EBmap_mean_err[iR];
+		fit_sigma  = EBmap_sigma[iR];
+		fit_Snorm  = EBmap_Snorm[iR];
+		fit_b0     = EBmap_b0[iR];
+		fit_b1     = EBmap_b1[iR];
+		fit_b2     = EBmap_b2[iR];
+		fit_b3     = EBmap_b3[iR];
+		fit_Bnorm  = EBmap_Bnorm[iR];
+		fit_attempt = EBmap_attempt[iR];
+		fit_time = EBmap_time[iR];
+
+		regCoeff = regionalCalibration_->getCalibMap()->coeff(ebid);
 
 		treeEB->Fill();
 	  } // loop over DetId in regions
@@ -367,10 +523,10 @@ void FitEpsilonPlot::saveCoefficients()
 
     for(int jR=0; jR < regionalCalibration_->getCalibMap()->getNRegionsEE() ; jR++)
     {
-	  std::vector<DetId> ids = regionalCalibration_->allDetIdsInEERegion(jR);
-	  for(std::vector<DetId>::const_iterator iid = ids.begin(); iid != ids.end(); ++iid) 
+	  const EcalRegionIndex& index = regionalCalibration_->regionIndexEE();
+	  for(const int* h = index.begin(jR); h != index.end(jR); ++h) 
 	  { 
-		EEDetId eeid(*iid);
+		EEDetId eeid = EEDetId::unhashIndex(*h);
 		ix = eeid.ix();
 		iy = eeid.iy();
 		zside = eeid.zside();
@@ -379,20 +535,23 @@ void FitEpsilonPlot::saveCoefficients()
 		ic = eeid.ic();
 		iquadrant = eeid.iquadrant();
 		hashedIndex = eeid.hashedIndex();
-		regCoeff = regionalCalibration_->getCalibMap()->coeff(*iid);
-		Signal = EEmap_Signal[eeid.hashedIndex()];//#
-		Backgr = EEmap_Backgr[eeid.hashedIndex()];
-		Chisqu = EEmap_Chisqu[eeid.hashedIndex()];            
-		Ndof = EEmap_ndof[eeid.hashedIndex()];            
-		fit_mean     = EEmap_mean[eeid.hashedIndex()];
-		fit_mean_err = EEmap_mean_err[eeid.hashedIndex()];
-		fit_sigma  = EEmap_sigma[eeid.hashedIndex()];
-		fit_Snorm  = EEmap_Snorm[eeid.hashedIndex()];
-		fit_b0     = EEmap_b0[eeid.hashedIndex()];
-		fit_b1     = EEmap_b1[eeid.hashedIndex()];
-		fit_b2     = EEmap_b2[eeid.hashedIndex()];
-		fit_b3     = EEmap_b3[eeid.hashedIndex()];
-		fit_Bnorm  = EEmap_Bnorm[eeid.hashedIndex()];
+		iRegion = jR;
+		regCoeff = regionalCalibration_->getCalibMap()->coeff(eeid);
+		Signal = EEmap_Signal[jR];//#
+		Backgr = EEmap_Backgr[jR];
+		Chisqu = EEmap_Chisqu[jR];            
+		Ndof = EEmap_ndof[jR];            
+		fit_mean     = EEmap_mean[jR];
+		fit_mean_err = EEmap_mean_err[jR];
+		fit_sigma  = EEmap_sigma[jR];
+		fit_Snorm  = EEmap_Snorm[jR];
+		fit_b0     = EEmap_b0[jR];
+		fit_b1     = EEmap_b1[jR];
+		fit_b2     = EEmap_b2[jR];
+		fit_b3     = EEmap_b3[jR];
+		fit_Bnorm  = EEmap_Bnorm[jR];
+		fit_attempt = EEmap_attempt[jR];
+		fit_time = EEmap_time[jR];
 
 		treeEE->Fill();
 	  }
@@ -422,11 +581,17 @@ FitEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 
     /// compute average weight, eps, and update calib constant
     if( (EEoEB_ == "Barrel") && (Barrel_orEndcap_=="ONLY_BARREL" || Barrel_orEndcap_=="ALL_PLEASE" ) ){
-	  for(uint32_t j= (uint32_t)inRangeFit_; j <= (uint32_t)finRangeFit_ && j < (uint32_t)regionalCalibration_->getCalibMap()->getNRegionsEB(); ++j)  
+	  for(size_t k=0; k<fitRegions_.size(); k++)
 	  {
+		uint32_t j = fitRegions_[k];
+		TStopwatch fitTimer;
 		cout<<"FIT_EPSILON: Fitting EB Cristal--> "<<j<<endl;
 
 		if(!(j%1000)) cout << "FIT_EPSILON: fitting EB region " << j << endl;
+		if( frozen_.regionFrozen(regionalCalibration_->regionIndexEB(), j, false) ){
+		    cout << "FIT_EPSILON: EB region " << j << " frozen, coefficient kept" << endl;
+		    continue;
+		}
 
 		float mean = 0.;
 		if(!useMassInsteadOfEpsilon_ && epsilon_EB_h[j]->Integral(epsilon_EB_h[j]->GetNbinsX()*(1./6.),epsilon_EB_h[j]->GetNbinsX()*0.5) > 20) 
@@ -473,9 +638,19 @@ FitEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 		    int iMin = epsilon_EB_h[j]->GetXaxis()->FindBin(Are_pi0_? 0.08:0.4 ); 
 		    int iMax = epsilon_EB_h[j]->GetXaxis()->FindBin(Are_pi0_? 0.18:0.65 );
 		    double integral = epsilon_EB_h[j]->Integral(iMin, iMax);  
-		    if(integral>60.)
+		    float fastMean = 0.;
+		    if(integral>60. && fastPeakEstimate_ && FastPeakEstimate( epsilon_EB_h[j], Are_pi0_? 0.08:0.4, Are_pi0_? 0.21:0.65, j, Pi0EB, fastMean ))
 		    {
-			  Pi0FitResult fitres = FitMassPeakRooFit( epsilon_EB_h[j], Are_pi0_? 0.08:0.4, Are_pi0_? 0.21:0.65, j, 1, Pi0EB, 0, isNot_2010_); //0.05-0.3
+			  // same acceptance as the fit below, chi2 of the estimate's model
+			  float r2 = fastMean/(Are_pi0_? PI0MASS:ETAMASS);
+			  if( EBmap_Chisqu[j] < 5 && fabs(fastMean-0.15)>0.0000001) mean = 0.5 * ( r2*r2 - 1. );
+			  else                                                      mean = 0.;
+		    }
+		    else if(integral>60.)
+		    {
+			  Pi0FitResult fitres = concurrentFitVariants_ ?
+				FitMassPeakConcurrent( epsilon_EB_h[j], Are_pi0_? 0.08:0.4, Are_pi0_? 0.21:0.65, j, 1, Pi0EB, isNot_2010_) :
+				FitMassPeakRooFit( epsilon_EB_h[j], Are_pi0_? 0.08:0.4, Are_pi0_? 0.21:0.65, j, 1, Pi0EB, firstAttempt(j,Pi0EB), isNot_2010_); //0.05-0.3
 			  RooRealVar* mean_fitresult = (RooRealVar*)(((fitres.res)->floatParsFinal()).find("mean"));
 			  mean = mean_fitresult->getVal();
 			  float r2 = mean/(Are_pi0_? PI0MASS:ETAMASS);
@@ -491,21 +666,28 @@ FitEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 		}
 
 
-		std::vector<DetId> ids = regionalCalibration_->allDetIdsInEBRegion(j);
-		for(std::vector<DetId>::const_iterator iid = ids.begin(); iid != ids.end(); ++iid) 
-		{
-		    regionalCalibration_->getCalibMap()->coeff(*iid) *= (mean==0.) ? 1. : 1./(1.+mean);
-		} // loop over DetId in regions
+		EBmap_time[j] = fitTimer.RealTime();
+
+		// the map holds one coefficient per region: update it through its first crystal only
+		const EcalRegionIndex& index = regionalCalibration_->regionIndexEB();
+		if( index.size(j)>0 )
+		    regionalCalibration_->getCalibMap()->coeff( EBDetId::unhashIndex(*index.begin(j)) ) *= (mean==0.) ? 1. : 1./(1.+mean);
 	  } // loop over regions
     }// if you have to fit barrel
 
     /// loop over EE crystals
     if( (EEoEB_ == "Endcap") && (Barrel_orEndcap_=="ONLY_ENDCAP" || Barrel_orEndcap_=="ALL_PLEASE" ) ){
-	  for(int jR = inRangeFit_; jR <=finRangeFit_ && jR < regionalCalibration_->getCalibMap()->getNRegionsEE(); jR++)
+	  for(size_t k=0; k<fitRegions_.size(); k++)
 	  {
+		int jR = fitRegions_[k];
+		TStopwatch fitTimer;
 		cout << "FIT_EPSILON: Fitting EE Cristal--> " << jR << endl;
 		if(!(jR%1000))
 		    cout << "FIT_EPSILON: fitting EE region " << jR << endl;
+		if( frozen_.regionFrozen(regionalCalibration_->regionIndexEE(), jR, true) ){
+		    cout << "FIT_EPSILON: EE region " << jR << " frozen, coefficient kept" << endl;
+		    continue;
+		}
 
 		float mean = 0.;
 		if(!useMassInsteadOfEpsilon_ && epsilon_EE_h[jR]->Integral(epsilon_EE_h[jR]->GetNbinsX()*(1./6.),epsilon_EE_h[jR]->GetNbinsX()*0.5) > 20) 
@@ -549,9 +731,16 @@ FitEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 		    int iMax = epsilon_EE_h[jR]->GetXaxis()->FindBin(Are_pi0_? 0.18:0.65 );
 		    double integral = epsilon_EE_h[jR]->Integral(iMin, iMax);  
 
-		    if(integral>70.)
+		    float fastMean = 0.;
+		    if(integral>70. && fastPeakEstimate_ && FastPeakEstimate( epsilon_EE_h[jR], Are_pi0_? 0.08:0.4, Are_pi0_? 0.25:0.65, jR, Pi0EE, fastMean ))
 		    {
-			  Pi0FitResult fitres = FitMassPeakRooFit( epsilon_EE_h[jR], Are_pi0_? 0.08:0.4, Are_pi0_? 0.25:0.65, jR, 1, Pi0EE, 0, isNot_2010_);//0.05-0.3
+			  float r2 = fastMean/(Are_pi0_? PI0MASS:ETAMASS);
+			  if( EEmap_Chisqu[jR] < 5 && fabs(fastMean-0.16)>0.0000001 ) mean = 0.5 * ( r2*r2 - 1. );
+			  else                                                        mean = 0.;
+		    }
+		    else if(integral>70.)
+		    {
+			  Pi0FitResult fitres = FitMassPeakRooFit( epsilon_EE_h[jR], Are_pi0_? 0.08:0.4, Are_pi0_? 0.25:0.65, jR, 1, Pi0EE, firstAttempt(jR,Pi0EE), isNot_2010_);//0.05-0.3
 			  RooRealVar* mean_fitresult = (RooRealVar*)(((fitres.res)->floatParsFinal()).find("mean"));
 			  mean = mean_fitresult->getVal();
 			  float r2 = mean/(Are_pi0_? PI0MASS:ETAMASS);
@@ -567,11 +756,11 @@ FitEpsilonPlot::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 		    }
 		}
 
-		std::vector<DetId> ids = regionalCalibration_->allDetIdsInEERegion(jR);
-		for(std::vector<DetId>::const_iterator iid = ids.begin(); iid != ids.end(); ++iid) 
-		{
-		    regionalCalibration_->getCalibMap()->coeff(*iid) *= (mean==0.) ? 1. : 1./(1.+mean);
-		}
+		EEmap_time[jR] = fitTimer.RealTime();
+
+		const EcalRegionIndex& index = regionalCalibration_->regionIndexEE();
+		if( index.size(jR)>0 )
+		    regionalCalibration_->getCalibMap()->coeff( EEDetId::unhashIndex(*index.begin(jR)) ) *= (mean==0.) ? 1. : 1./(1.+mean);
 	  }//for EE
     }// if you have to fit Endcap
 
@@ -616,7 +805,7 @@ FitEpsilonPlot::IterativeFit(TH1F* h, TF1 & ffit)
 
 
 //-----------------------------------------------------------------------------------
-Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,  uint32_t HistoIndex, int ngaus, FitMode mode, int niter, bool isNot_2010_) 
+Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,  uint32_t HistoIndex, int ngaus, FitMode mode, int niter, bool isNot_2010_, bool retry) 
 {
     //-----------------------------------------------------------------------------------
 
@@ -694,6 +883,14 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
 	  cbpars.add( cb5 );
     }
 
+    /// warm start: previous iteration's fit of this region, kept inside the ranges of this attempt
+    const FitSeed* seed = variantSeed_ ? variantSeed_ : fitSeed(HistoIndex, mode);
+    if(seed){
+	  RooRealVar* seeded[6] = { &mean, &sigma, &cb0, &cb1, &cb2, &cb3 };
+	  float values[6] = { seed->mean, seed->sigma, seed->b0, seed->b1, seed->b2, seed->b3 };
+	  for(int i=0; i<6; i++) seeded[i]->setVal( std::max( seeded[i]->getMin(), std::min( seeded[i]->getMax(), double(values[i]) ) ) );
+    }
+
     RooChebychev bkg("bkg","bkg model", x, cbpars );
 
     //RooPolynomial bkg("bkg","background model",x,RooArgList(p0,p1,p2,p3,p4,p5,p6) );
@@ -720,7 +917,6 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
     //m.hesse();
     RooFitResult* res = m.save() ;
 
-    RooChi2Var chi2("chi2","chi2 var",*model,dh, true);
     int ndof = h->GetNbinsX() - res->floatParsFinal().getSize();
 
     // compute S/B
@@ -733,6 +929,8 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
 
     float normSig = integralSig->getVal();
     float normBkg = integralBkg->getVal();
+    delete integralSig;
+    delete integralBkg;
 
     Pi0FitResult pi0res; // this is the output value of this method
     pi0res.res = res;
@@ -748,20 +946,30 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
 		pow(pi0res.Berr/pi0res.B,2) ) ;
     pi0res.dof = ndof;
 
-    RooPlot*  xframe = x.frame(h->GetNbinsX());
-    xframe->SetTitle(h->GetTitle());
-    dh.plotOn(xframe);
-    model->plotOn(xframe,Components(bkg),LineStyle(kDashed), LineColor(kRed));
-    model->plotOn(xframe);
-
-    xframe->Draw();
-    pi0res.probchi2 = TMath::Prob(xframe->chiSquare(), ndof);
-    pi0res.chi2 = xframe->chiSquare();
+    /// headless: chi2 from the model bin expectations, the frame is only made for the stored fits
+    /// (every StoreFitEvery-th region and the failing ones)
+    bool storeFit = StoreForTest_ && !inVariantChild_ && ( niter==firstAttempt(HistoIndex, mode) || !retry );
+    if(headlessFits_){
+	  pi0res.chi2 = binnedChi2( *model, x, h, Nsig.getVal()+Nbkg.getVal() );
+	  storeFit = storeFit && ( (storeFitEvery_>0 && HistoIndex%storeFitEvery_==0) || pi0res.chi2>5 );
+    }
+    RooPlot*  xframe = 0;
+    if(!headlessFits_ || storeFit){
+	  xframe = x.frame(h->GetNbinsX());
+	  xframe->SetTitle(h->GetTitle());
+	  dh.plotOn(xframe);
+	  model->plotOn(xframe,Components(bkg),LineStyle(kDashed), LineColor(kRed));
+	  model->plotOn(xframe);
+
+	  xframe->Draw();
+	  if(!headlessFits_) pi0res.chi2 = xframe->chiSquare();
+    }
+    pi0res.probchi2 = TMath::Prob(pi0res.chi2, ndof);
     cout << "FIT_EPSILON: Nsig: " << Nsig.getVal() 
 	  << " nsig 3sig: " << normSig*Nsig.getVal()
 	  << " nbkg 3sig: " << normBkg*Nbkg.getVal()
 	  << " S/B: " << pi0res.SoB << " +/- " << pi0res.SoBerr
-	  << " chi2: " << xframe->chiSquare()
+	  << " chi2: " << pi0res.chi2
 	  << " DOF: " << pi0res.dof
 	  << " prob(chi2): " << pi0res.probchi2
 					<< endl;
@@ -769,7 +977,7 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
     if(mode==Pi0EB){
 	  EBmap_Signal[HistoIndex]=pi0res.S;
 	  EBmap_Backgr[HistoIndex]=pi0res.B;
-	  EBmap_Chisqu[HistoIndex]=xframe->chiSquare();
+	  EBmap_Chisqu[HistoIndex]=pi0res.chi2;
 	  EBmap_ndof[HistoIndex]=ndof;
 	  EBmap_mean[HistoIndex]=mean.getVal();
 	  EBmap_mean_err[HistoIndex]=mean.getError();
@@ -780,11 +988,12 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
 	  EBmap_b2[HistoIndex]=cb2.getVal();
 	  EBmap_b3[HistoIndex]=cb3.getVal();
 	  EBmap_Bnorm[HistoIndex]=normBkg;
+	  EBmap_attempt[HistoIndex]=niter;
     }
     if(mode==Pi0EE){
 	  EEmap_Signal[HistoIndex]=pi0res.S;
 	  EEmap_Backgr[HistoIndex]=pi0res.B;
-	  EEmap_Chisqu[HistoIndex]=xframe->chiSquare();
+	  EEmap_Chisqu[HistoIndex]=pi0res.chi2;
 	  EEmap_ndof[HistoIndex]=ndof;
 	  EEmap_mean[HistoIndex]=mean.getVal();
 	  EEmap_mean_err[HistoIndex]=mean.getError();
@@ -795,43 +1004,46 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
 	  EEmap_b2[HistoIndex]=cb2.getVal();
 	  EEmap_b3[HistoIndex]=cb3.getVal();
 	  EEmap_Bnorm[HistoIndex]=normBkg;
+	  EEmap_attempt[HistoIndex]=niter;
     }
 
-    TLatex lat;
-    char line[300];
-    lat.SetNDC();
-    lat.SetTextSize(0.040);
-    lat.SetTextColor(1);
+    if(xframe){
+	  TLatex lat;
+	  char line[300];
+	  lat.SetNDC();
+	  lat.SetTextSize(0.040);
+	  lat.SetTextColor(1);
 
-    float xmin(0.55), yhi(0.80), ypass(0.05);
-    if(mode==EtaEB) yhi=0.30;
-    sprintf(line,"Yield: %.0f #pm %.0f", Nsig.getVal(), Nsig.getError() );
-    lat.DrawLatex(xmin,yhi, line);
+	  float xmin(0.55), yhi(0.80), ypass(0.05);
+	  if(mode==EtaEB) yhi=0.30;
+	  sprintf(line,"Yield: %.0f #pm %.0f", Nsig.getVal(), Nsig.getError() );
+	  lat.DrawLatex(xmin,yhi, line);
 
-    sprintf(line,"m_{#gamma#gamma}: %.2f #pm %.2f", mean.getVal()*1000., mean.getError()*1000. );
-    lat.DrawLatex(xmin,yhi-ypass, line);
+	  sprintf(line,"m_{#gamma#gamma}: %.2f #pm %.2f", mean.getVal()*1000., mean.getError()*1000. );
+	  lat.DrawLatex(xmin,yhi-ypass, line);
 
-    sprintf(line,"#sigma: %.2f #pm %.2f (%.2f%s)", sigma.getVal()*1000., sigma.getError()*1000., sigma.getVal()*100./mean.getVal(), "%" );
-    lat.DrawLatex(xmin,yhi-2.*ypass, line);
+	  sprintf(line,"#sigma: %.2f #pm %.2f (%.2f%s)", sigma.getVal()*1000., sigma.getError()*1000., sigma.getVal()*100./mean.getVal(), "%" );
+	  lat.DrawLatex(xmin,yhi-2.*ypass, line);
 
-    //sprintf(line,"S/B(3#sigma): %.2f #pm %.2f", pi0res.SoB, pi0res.SoBerr );
-    sprintf(line,"S/B(3#sigma): %.2f", pi0res.SoB );
-    lat.DrawLatex(xmin,yhi-3.*ypass, line);
+	  //sprintf(line,"S/B(3#sigma): %.2f #pm %.2f", pi0res.SoB, pi0res.SoBerr );
+	  sprintf(line,"S/B(3#sigma): %.2f", pi0res.SoB );
+	  lat.DrawLatex(xmin,yhi-3.*ypass, line);
 
-    sprintf(line,"#Chi^2: %.2f", xframe->chiSquare()/pi0res.dof );
-    lat.DrawLatex(xmin,yhi-4.*ypass, line);
+	  sprintf(line,"#Chi^2: %.2f", pi0res.chi2/pi0res.dof );
+	  lat.DrawLatex(xmin,yhi-4.*ypass, line);
 
-    sprintf(line,"Attempt: %d", niter );
-    lat.DrawLatex(xmin,yhi-5.*ypass, line);
+	  sprintf(line,"Attempt: %d", niter );
+	  lat.DrawLatex(xmin,yhi-5.*ypass, line);
+    }
 
     Pi0FitResult fitres = pi0res;
     //if(mode==Pi0EB && ( xframe->chiSquare()/pi0res.dof>0.35 || pi0res.SoB<0.6 || fabs(mean.getVal()-(Are_pi0_? 0.150:0.62))<0.0000001 ) ){
-    if(mode==Pi0EB && ( xframe->chiSquare()>5 || fabs(mean.getVal()-(Are_pi0_? 0.150:0.62))<0.0000001 ) ){
+    if(retry && mode==Pi0EB && ( pi0res.chi2>5 || fabs(mean.getVal()-(Are_pi0_? 0.150:0.62))<0.0000001 ) ){
 	  if(niter==0) fitres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, 1, isNot_2010_);
 	  if(niter==1) fitres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, 2, isNot_2010_);
 	  if(niter==2) fitres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, 3, isNot_2010_);
     }
-    if(StoreForTest_ && niter==0){
+    if(storeFit){
 	  std::stringstream ind;
 	  ind << (int) HistoIndex;
 	  TString nameHistofit = "Fit_n_" + ind.str();
@@ -843,6 +1055,334 @@ Pi0FitResult FitEpsilonPlot::FitMassPeakRooFit(TH1F* h, double xlo, double xhi,
     return fitres;
 }
 
+/// ConcurrentFitVariants: the first attempt of the EB retry ladder is fitted here, as the sequential
+/// ladder would; only if it fails the ladder's criterion are the remaining background-order variants
+/// fitted at the same time, one forked process each (RooFit/Minuit keep global state, so threads are not
+/// an option). The lowest attempt that passes is chosen and refitted here starting from the child's
+/// parameters to fill the maps and the RooFitResult. A refit that does not pass, or moves the mean by
+/// more than the child's error, is replaced by the plain fit of that attempt.
+Pi0FitResult FitEpsilonPlot::FitMassPeakConcurrent(TH1F* h, double xlo, double xhi, uint32_t HistoIndex, int ngaus, FitMode mode, bool isNot_2010_)
+{
+    struct VariantResult { int ok; float chi2, mean, meanErr, sigma, b0, b1, b2, b3; };
+    const int lastAttempt = 3;
+    const float failedMean = Are_pi0_? 0.150:0.62;
+    int first = firstAttempt(HistoIndex, mode);
+    if(mode!=Pi0EB || first>=lastAttempt) return FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, first, isNot_2010_);
+
+    Pi0FitResult firstres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, first, isNot_2010_, false);
+    RooRealVar* firstMean = (RooRealVar*)firstres.res->floatParsFinal().find("mean");
+    if( firstres.chi2<=5 && firstMean && fabs(firstMean->getVal()-failedMean)>=0.0000001 ) return firstres;
+
+    int nVariants = lastAttempt - first;
+    std::vector<pid_t> pids(nVariants, -1);
+    std::vector<int> fds(nVariants, -1);
+    std::vector<VariantResult> results(nVariants);
+    bool forked = true;
+    cout.flush();
+    for(int i=0; i<nVariants && forked; i++){
+	  int fd[2];
+	  if( pipe(fd)!=0 ){ forked = false; break; }
+	  pid_t pid = fork();
+	  if(pid<0){ close(fd[0]); close(fd[1]); forked = false; break; }
+	  if(pid==0){
+		close(fd[0]);
+		inVariantChild_ = true;
+		VariantResult r = { 0, 0., 0., 0., 0., 0., 0., 0., 0. };
+		Pi0FitResult fr = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, first+1+i, isNot_2010_, false);
+		const RooArgList& pars = fr.res->floatParsFinal();
+		RooRealVar* v;
+		r.ok = 1;
+		r.chi2 = fr.chi2;
+		if( (v=(RooRealVar*)pars.find("mean")) ){ r.mean = v->getVal(); r.meanErr = v->getError(); }
+		r.sigma = (v=(RooRealVar*)pars.find("sigma")) ? v->getVal() : 0.;
+		r.b0    = (v=(RooRealVar*)pars.find("cb0"))   ? v->getVal() : 0.;
+		r.b1    = (v=(RooRealVar*)pars.find("cb1"))   ? v->getVal() : 0.;
+		r.b2    = (v=(RooRealVar*)pars.find("cb2"))   ? v->getVal() : 0.;
+		r.b3    = (v=(RooRealVar*)pars.find("cb3"))   ? v->getVal() : 0.;
+		cout.flush();
+		ssize_t written = write(fd[1], &r, sizeof(r));
+		close(fd[1]);
+		_exit( written==ssize_t(sizeof(r)) ? 0 : 1 );
+	  }
+	  close(fd[1]);
+	  pids[i] = pid;
+	  fds[i] = fd[0];
+    }
+    for(int i=0; i<nVariants; i++){
+	  results[i].ok = 0;
+	  if(fds[i]>=0){
+		if( read(fds[i], &results[i], sizeof(VariantResult))!=ssize_t(sizeof(VariantResult)) ) results[i].ok = 0;
+		close(fds[i]);
+	  }
+	  if(pids[i]>0) waitpid(pids[i], 0, 0);
+    }
+    if(!forked){
+	  cout << "FIT_EPSILON: ConcurrentFitVariants: fork failed, fitting region " << HistoIndex << " sequentially" << endl;
+	  return FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, first+1, isNot_2010_);
+    }
+
+    int chosen = nVariants-1;
+    for(int i=0; i<nVariants; i++){
+	  if( results[i].ok && results[i].chi2<=5 && fabs(results[i].mean-failedMean)>=0.0000001 ){ chosen = i; break; }
+    }
+    int attempt = first+1+chosen;
+    cout << "FIT_EPSILON: ConcurrentFitVariants: region " << HistoIndex << " uses attempt " << attempt << endl;
+    if( !results[chosen].ok ) return FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, attempt, isNot_2010_, false);
+
+    FitSeed seed;
+    seed.mean = results[chosen].mean;  seed.sigma = results[chosen].sigma;
+    seed.b0 = results[chosen].b0;  seed.b1 = results[chosen].b1;
+    seed.b2 = results[chosen].b2;  seed.b3 = results[chosen].b3;
+    seed.attempt = attempt;
+    variantSeed_ = &seed;
+    Pi0FitResult fitres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, attempt, isNot_2010_, false);
+    variantSeed_ = 0;
+
+    /// the refit must reproduce the child's verdict and mean
+    RooRealVar* refitMean = (RooRealVar*)fitres.res->floatParsFinal().find("mean");
+    bool childPassed = results[chosen].chi2<=5 && fabs(results[chosen].mean-failedMean)>=0.0000001;
+    bool refitPassed = fitres.chi2<=5 && refitMean && fabs(refitMean->getVal()-failedMean)>=0.0000001;
+    bool sameMean = refitMean && fabs(refitMean->getVal()-results[chosen].mean) <= std::max(results[chosen].meanErr, 0.0001f);
+    if( refitPassed!=childPassed || !sameMean ){
+	  cout << "FIT_EPSILON: ConcurrentFitVariants: refit of region " << HistoIndex << " does not reproduce attempt " << attempt
+	       << " (chi2 " << fitres.chi2 << " vs " << results[chosen].chi2 << "), fitting it again unseeded" << endl;
+	  fitres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, ngaus, mode, attempt, isNot_2010_, false);
+    }
+    return fitres;
+}
+
+/// FastPeakEstimate: peak position from sideband-subtracted, iteratively truncated moments, started
+/// from the previous iteration's fit of the region. It is used instead of the full fit only when the
+/// region has at least FastPeakMinSignal signal entries, the estimate agrees with the previous mean
+/// within FastPeakMaxPull statistical errors, the width within FastPeakMaxSigmaShift (relative) and
+/// the Gaussian + sideband line it assumes describes the peak (chi2 < 5, as the fit).
+/// The truncated mean is unbiased for that shape only: a tail or a curved background shifts it
+/// w.r.t. the fit, by less than FastPeakMaxPull errors in the accepted regions since the previous
+/// mean is a fit. FastPeakValidateEvery = N fits every N-th accepted region as well and logs the
+/// difference ("FastPeakEstimate validation"), the estimate is kept.
+/// The background shape and normalisations of the previous fit are carried over to the output maps.
+bool FitEpsilonPlot::FastPeakEstimate(TH1F* h, double xlo, double xhi, uint32_t HistoIndex, FitMode mode, float& mean)
+{
+    const FitSeed* prev = previousFit(HistoIndex, mode);
+    if(!prev) return false;
+    const double kTrunc = 2.;          // truncation at +-2 sigma
+    const double kRmsTrunc = 0.8796;   // rms/sigma of a Gaussian truncated at +-2 sigma
+
+    // linear background from the sidebands at 3.5-6 sigma of the previous peak
+    double mu = prev->mean, s = prev->sigma;
+    double sbLo[2] = { std::max(xlo, mu-6.*s), mu+3.5*s };
+    double sbHi[2] = { mu-3.5*s, std::min(xhi, mu+6.*s) };
+    double sbX[2], sbY[2];
+    for(int iSb=0; iSb<2; iSb++){
+	  int b1 = h->GetXaxis()->FindBin(sbLo[iSb]), b2 = h->GetXaxis()->FindBin(sbHi[iSb]);
+	  if( sbHi[iSb]<=sbLo[iSb] || b2<b1 ) return false;
+	  double sum = 0., sumX = 0.;
+	  for(int iBin=b1; iBin<=b2; iBin++){ sum += h->GetBinContent(iBin); sumX += h->GetBinCenter(iBin); }
+	  sbY[iSb] = sum/(b2-b1+1);
+	  sbX[iSb] = sumX/(b2-b1+1);
+    }
+    double slope = (sbY[1]-sbY[0])/(sbX[1]-sbX[0]);
+
+    double sumW = 0., err = 0.;
+    bool converged = false;
+    for(int iter=0; iter<20 && !converged; iter++){
+	  int b1 = h->GetXaxis()->FindBin(std::max(xlo, mu-kTrunc*s)), b2 = h->GetXaxis()->FindBin(std::min(xhi, mu+kTrunc*s));
+	  double sumWX = 0., sumWX2 = 0.;
+	  sumW = 0.;
+	  for(int iBin=b1; iBin<=b2; iBin++){
+		double x = h->GetBinCenter(iBin);
+		double b = sbY[0] + slope*(x-sbX[0]);
+		double w = h->GetBinContent(iBin) - b;
+		sumW += w; sumWX += w*x; sumWX2 += w*x*x;
+	  }
+	  if( sumW<=0. ) return false;
+	  double newMu = sumWX/sumW;
+	  double var = sumWX2/sumW - newMu*newMu;
+	  if( var<=0. ) return false;
+	  double newS = sqrt(var)/kRmsTrunc;
+	  converged = fabs(newMu-mu) < 1.e-3*s;
+	  mu = newMu; s = newS;
+    }
+    if(!converged) return false;
+
+    // statistical error of the mean: Poisson errors of the subtracted bin contents
+    int b1 = h->GetXaxis()->FindBin(std::max(xlo, mu-kTrunc*s)), b2 = h->GetXaxis()->FindBin(std::min(xhi, mu+kTrunc*s));
+    for(int iBin=b1; iBin<=b2; iBin++){
+	  double dx = h->GetBinCenter(iBin)-mu;
+	  err += h->GetBinContent(iBin)*dx*dx;
+    }
+    err = sqrt(err)/sumW;
+
+    // chi2/nbin of the Gaussian over the sideband line between the outer sideband edges, Poisson
+    // errors and empty bins skipped as binnedChi2; 5 parameters (mean, sigma, yield, line)
+    const double kFrac2 = 0.9545, kFrac3 = 0.9973;  // Gaussian fractions within +-2 and +-3 sigma
+    double nSig = sumW/kFrac2, chi2 = 0., bkg3 = 0.;
+    int nBin = 0;
+    int c1 = h->GetXaxis()->FindBin(std::max(xlo, mu-6.*s)), c2 = h->GetXaxis()->FindBin(std::min(xhi, mu+6.*s));
+    for(int iBin=c1; iBin<=c2; iBin++){
+	  double x = h->GetBinCenter(iBin), y = h->GetBinContent(iBin);
+	  double b = sbY[0] + slope*(x-sbX[0]);
+	  if( fabs(x-mu)<3.*s ) bkg3 += b;
+	  if( y==0 ) continue;
+	  double f = b + nSig*h->GetBinWidth(iBin)*TMath::Gaus(x, mu, s, true);
+	  chi2 += (y-f)*(y-f)/y;
+	  nBin++;
+    }
+    chi2 = nBin>0 ? chi2/nBin : 999.;
+
+    bool accepted = sumW>=fastPeakMinSignal_
+	  && fabs(mu-prev->mean) < fastPeakMaxPull_*err
+	  && fabs(s/prev->sigma-1.) < fastPeakMaxSigmaShift_
+	  && chi2 < 5.;
+    cout << "FIT_EPSILON: FastPeakEstimate: region " << HistoIndex << (mode==Pi0EE ? " EE" : " EB")
+	  << " mean: " << mu << " +/- " << err << " (previous " << prev->mean << ")"
+	  << " sigma: " << s << " (previous " << prev->sigma << ")"
+	  << " signal: " << sumW << " chi2: " << chi2 << (accepted ? " -> no fit" : " -> full fit") << endl;
+    if(!accepted) return false;
+
+    if( fastPeakValidateEvery_>0 && (nFastPeaks_++)%fastPeakValidateEvery_==0 ){
+	  Pi0FitResult fitres = FitMassPeakRooFit( h, xlo, xhi, HistoIndex, 1, mode, firstAttempt(HistoIndex,mode), isNot_2010_);
+	  RooRealVar* fitMean = (RooRealVar*)fitres.res->floatParsFinal().find("mean");
+	  if(fitMean) cout << "FIT_EPSILON: FastPeakEstimate validation: region " << HistoIndex << (mode==Pi0EE ? " EE" : " EB")
+		<< " fast - fit: " << mu-fitMean->getVal() << " (" << (mu-fitMean->getVal())/err << " stat. errors)"
+		<< " fit chi2: " << fitres.chi2 << endl;
+    }
+
+    std::map<int,float>* maps[12];
+    if(mode==Pi0EB){
+	  std::map<int,float>* m[12] = { &EBmap_Signal, &EBmap_Backgr, &EBmap_Chisqu, &EBmap_ndof, &EBmap_mean, &EBmap_mean_err, &EBmap_sigma, &EBmap_b0, &EBmap_b1, &EBmap_b2, &EBmap_b3, &EBmap_Snorm };
+	  std::copy(m, m+12, maps);
+	  EBmap_Bnorm[HistoIndex] = prev->Bnorm;
+	  EBmap_attempt[HistoIndex] = prev->attempt;
+    }
+    else{
+	  std::map<int,float>* m[12] = { &EEmap_Signal, &EEmap_Backgr, &EEmap_Chisqu, &EEmap_ndof, &EEmap_mean, &EEmap_mean_err, &EEmap_sigma, &EEmap_b0, &EEmap_b1, &EEmap_b2, &EEmap_b3, &EEmap_Snorm };
+	  std::copy(m, m+12, maps);
+	  EEmap_Bnorm[HistoIndex] = prev->Bnorm;
+	  EEmap_attempt[HistoIndex] = prev->attempt;
+    }
+    // signal and background within +-3 sigma, as FitMassPeakRooFit
+    float values[12] = { float(nSig*kFrac3), float(bkg3), float(chi2), float(std::max(nBin-5, 0)), float(mu), float(err), float(s), prev->b0, prev->b1, prev->b2, prev->b3, prev->Snorm };
+    for(int i=0; i<12; i++) (*maps[i])[HistoIndex] = values[i];
+
+    mean = mu;
+    return true;
+}
+
+/// chi2/nbin of the fitted model against h over the fit range, as RooPlot::chiSquare() computes it
+/// (Poisson errors, empty bins skipped) but from the model bin expectations, without building the frame
+double FitEpsilonPlot::binnedChi2(RooAbsPdf& model, RooRealVar& x, TH1F* h, double nExpected)
+{
+    RooArgSet normSet(x);
+    double xSave = x.getVal();
+    double chisq = 0.;
+    int nbin = 0;
+    for(int iBin=1; iBin<=h->GetNbinsX(); iBin++){
+	  double center = h->GetBinCenter(iBin);
+	  if( center<x.getMin() || center>x.getMax() ) continue;
+	  double y = h->GetBinContent(iBin);
+	  if( y==0 ) continue;
+	  double lo = h->GetBinLowEdge(iBin), hi = lo + h->GetBinWidth(iBin);
+	  // Simpson average of the normalised model over the bin
+	  x.setVal(lo);     double f0 = model.getVal(&normSet);
+	  x.setVal(center); double f1 = model.getVal(&normSet);
+	  x.setVal(hi);     double f2 = model.getVal(&normSet);
+	  double expected = nExpected * (hi-lo) * (f0+4.*f1+f2)/6.;
+	  double muLo, muHi;
+	  RooHistError::instance().getPoissonInterval( int(y+0.5), muLo, muHi, 1. );
+	  double err = (y>expected) ? (y-muLo) : (muHi-y);
+	  if( err<=0 ) continue;
+	  chisq += (y-expected)*(y-expected)/(err*err);
+	  nbin++;
+    }
+    x.setVal(xSave);
+    return nbin>0 ? chisq/nbin : 0.;
+}
+
+/// per-region fit parameters and retry step of the previous iteration, from the calibEB/calibEE trees
+/// of its merged calibMap. Regions without a usable fit (not fitted, or failed) get no seed
+bool FitEpsilonPlot::loadFitSeeds(const char* fileName, int nTrials)
+{
+    TFile* f = TFile::Open(fileName);
+    /// keep trying in case of network I/O problems, as EcalCalibMap::loadCalibMapFromFile
+    for(int iTrial=1; iTrial<nTrials && (!f || f->IsZombie()); iTrial++){
+	  cout << "FIT_EPSILON: previous fits: could not open " << fileName << " (trial #" << iTrial << "), trying again in 30s..." << endl;
+	  delete f;
+	  sleep(30);
+	  f = TFile::Open(fileName);
+    }
+    if( !f || f->IsZombie() ){
+	  cout << "FIT_EPSILON: previous fits: FAILED to open " << fileName << " (" << nTrials << " trials), fits start from the default values" << endl;
+	  delete f;
+	  return false;
+    }
+    EBseeds_.assign( regionalCalibration_->getCalibMap()->getNRegionsEB(), FitSeed() );
+    EEseeds_.assign( regionalCalibration_->getCalibMap()->getNRegionsEE(), FitSeed() );
+
+    const char* treeNames[2] = { "calibEB", "calibEE" };
+    for(int isEE=0; isEE<2; isEE++){
+	  TTree* tree = (TTree*) f->Get( treeNames[isEE] );
+	  if(!tree) continue;
+	  Int_t hashedIndex_, fit_attempt_ = 0;
+	  Float_t Chisqu_, fit_mean_, fit_sigma_, fit_b0_, fit_b1_, fit_b2_, fit_b3_, fit_Snorm_ = 0., fit_Bnorm_ = 0.;
+	  tree->SetBranchAddress( "hashedIndex_", &hashedIndex_ );
+	  tree->SetBranchAddress( "Chisqu_", &Chisqu_ );
+	  tree->SetBranchAddress( "fit_mean_", &fit_mean_ );
+	  tree->SetBranchAddress( "fit_sigma_", &fit_sigma_ );
+	  tree->SetBranchAddress( "fit_b0_", &fit_b0_ );
+	  tree->SetBranchAddress( "fit_b1_", &fit_b1_ );
+	  tree->SetBranchAddress( "fit_b2_", &fit_b2_ );
+	  tree->SetBranchAddress( "fit_b3_", &fit_b3_ );
+	  // calibMaps merged before fit_attempt existed: start the ladder from 0
+	  if( tree->GetBranch("fit_attempt_") ) tree->SetBranchAddress( "fit_attempt_", &fit_attempt_ );
+	  if( tree->GetBranch("fit_Snorm_") ) tree->SetBranchAddress( "fit_Snorm_", &fit_Snorm_ );
+	  if( tree->GetBranch("fit_Bnorm_") ) tree->SetBranchAddress( "fit_Bnorm_", &fit_Bnorm_ );
+
+	  const EcalRegionIndex& index = isEE ? regionalCalibration_->regionIndexEE() : regionalCalibration_->regionIndexEB();
+	  std::vector<FitSeed>& seeds = isEE ? EEseeds_ : EBseeds_;
+	  int nSeeds = 0;
+	  for(Long64_t iEntry=0; iEntry<tree->GetEntriesFast(); iEntry++){
+		tree->GetEntry(iEntry);
+		if( hashedIndex_<0 || hashedIndex_>=index.nXtals() ) continue;
+		int iR = index.region(hashedIndex_);
+		if( iR<0 || seeds[iR].attempt>=0 ) continue;
+		// same acceptance as the epsilon update in analyze()
+		if( fit_mean_<=0. || fit_sigma_<=0. || Chisqu_>=5. ) continue;
+		FitSeed& seed = seeds[iR];
+		seed.mean  = fit_mean_;
+		seed.sigma = fit_sigma_;
+		seed.b0 = fit_b0_; seed.b1 = fit_b1_; seed.b2 = fit_b2_; seed.b3 = fit_b3_;
+		seed.chi2 = Chisqu_;
+		seed.Snorm = fit_Snorm_; seed.Bnorm = fit_Bnorm_;
+		seed.attempt = fit_attempt_;
+		nSeeds++;
+	  }
+	  cout << "FIT_EPSILON: previous fits: " << nSeeds << " " << treeNames[isEE] << " regions seeded from " << fileName << endl;
+    }
+    f->Close();
+    delete f;
+    return true;
+}
+
+const FitSeed* FitEpsilonPlot::previousFit(uint32_t HistoIndex, FitMode mode) const
+{
+    const std::vector<FitSeed>& seeds = (mode==Pi0EE) ? EEseeds_ : EBseeds_;
+    if( HistoIndex>=seeds.size() || seeds[HistoIndex].attempt<0 ) return 0;
+    return &seeds[HistoIndex];
+}
+
+const FitSeed* FitEpsilonPlot::fitSeed(uint32_t HistoIndex, FitMode mode) const
+{
+    return warmStartFits_ ? previousFit(HistoIndex, mode) : 0;
+}
+
+/// retry ladder step to start from: the one that succeeded in the previous iteration
+int FitEpsilonPlot::firstAttempt(uint32_t HistoIndex, FitMode mode) const
+{
+    const FitSeed* seed = fitSeed(HistoIndex, mode);
+    return seed ? seed->attempt : 0;
+}
+
 // ------------ method called once each job just before starting event loop  ------------
     void 
 FitEpsilonPlot::beginJob()
@@ -0,0 +1,25 @@
+#!/usr/bin/env python
+
+# Scans the input list once and writes its index (<list>.index, used with useInputIndex): bytes and
+# events per run and lumi of every file. Files already in the index are not opened again, so it can be
+# run again after adding files to the list. With json_file, prints what the json keeps of the list.
+# usage: python buildInputIndex.py [inputList]   (default: inputlist_n of parameters.py)
+
+import sys, os
+from methods import *
+
+inputList = sys.argv[1] if len(sys.argv) > 1 else inputlist_n
+files = [ line.strip() for line in open( inputList ) if line.strip() != '' ]
+print "[calib] Indexing " + str(len(files)) + " files of " + inputList
+
+index = inputFileIndex( files, inputList )
+nEvents = sum( sum( lumis.values() ) for nBytes, lumis in index.values() )
+nBytes = sum( nBytes for nBytes, lumis in index.values() )
+print "[calib] " + str(len(index)) + " files indexed in " + inputIndexFile(inputList) + ": " + str(nEvents) + " events, " + str(nBytes/1000000000.) + " GB"
+
+if( json_file != '' ):
+    json = jsonLumis( os.getcwd() )
+    goodEvents = dict( (f, sum( n for (run, lumi), n in index[f][1].items() if inJSON( run, lumi, json ) )) for f in files if f in index )
+    nEmpty = sum( 1 for n in goodEvents.values() if n == 0 )
+    nPartial = sum( 1 for f, n in goodEvents.items() if 0 < n < sum( index[f][1].values() ) )
+    print "[calib] In " + json_file + ": " + str(sum( goodEvents.values() )) + " events; " + str(nEmpty) + " files without good lumis (never opened), " + str(nPartial) + " files read in part"
@@ -2,6 +2,11 @@
 
 import subprocess, time, sys, os
 from methods import *
+from executors import *
+
+if( pipelineSubdets and pipelineSubdet not in ('EB', 'EE') ):
+   print "pipelineSubdets: ECALPRO_SUBDET must be EB or EE (set by submitCalibration.py and resubmitCalibration.py)"
+   sys.exit(1)
 
 if len(sys.argv) != 7:
     print "usage thisPyton.py pwd queue iter-to-resubmit Systparam onlyFIT onlyFinalHADD"
@@ -17,17 +22,25 @@ onlyFinalHadd=str(sys.argv[6])
 outputdir = pwd+'/'+dirname
 logPath = outputdir + '/log'
 srcPath  = outputdir + '/src'
+# batch system or this machine (executor in parameters.py)
+jobExecutor = makeExecutor( queue, 2, outputdir )
 
 # To compute the num of hadd
 inputlist_f = open( inputlist_n )
 # read the list containing all the input files
 inputlistbase_v = inputlist_f.readlines()
 #N real Job
-njobs = float(len(inputlistbase_v[:])) / float(ijobmax)
-if( float(int(njobs) - njobs) < 0. ):
-    njobs = int(njobs) + 1
+njobs = nFillJobs( pwd, len(inputlistbase_v) )
+
+# convergence monitor: decisions of a previous run (subdetectors dropped after an iteration, last iteration)
+decisions = convergenceDecisions(pwd) if stopAtConvergence else []
+lastIteration = stopIteration( decisions )
 
 for iters in range(Iter_toResub, nIterations):
+   if ( lastIteration>=0 and iters>lastIteration ):
+       print "Converged after iteration " + str(lastIteration) + " (see " + convergenceLogFile(pwd) + "), not running iteration " + str(iters)
+       break
+   droppedSubdets = droppedSubdetsAt( decisions, iters )
    if(onlyFIT=='False' and onlyFinalHadd=='False'):
       print "\n*******  ITERATION " + str(iters) + "/" + str(nIterations-1) + "  *******"
       for ijob in range(njobs):
@@ -36,6 +49,9 @@ for iters in range(Iter_toResub, nIterations):
           env_script_n = open(outputdir + "/cfgFile/Fill/fillEpsilonPlot_iter_"     + str(iters) + "_job_" + str(ijob) + ".py", 'a')
           SystParamLine = 'process.analyzerFillEpsilon.SystOrNot = cms.untracked.double(' + str(SystParam) + ')\n'
           env_script_n.write(SystParamLine)
+          # converged subdetectors are not filled any more
+          if ( droppedSubdets ):
+              env_script_n.write("process.analyzerFillEpsilon.Barrel_orEndcap = cms.untracked.string('" + ('ONLY_ENDCAP' if 'EB' in droppedSubdets else 'ONLY_BARREL') + "')\n")
           env_script_n.close()
           fill_log_n = logPath + "/fillEpsilonPlot_iter_" + str(iters) + "_job_" + str(ijob) + ".log"
           fill_src_n = srcPath + "/Fill/submit_iter_"     + str(iters) + "_job_" + str(ijob) + ".sh"
@@ -44,45 +60,29 @@ for iters in range(Iter_toResub, nIterations):
           else:
                submit_s = "bsub -q " + queue + " -o /dev/null -e /dev/null " + fill_src_n
 
-          print '\n[job #' + str(ijob) + '] :: ' + submit_s
+          print '\n[job #' + str(ijob) + ']'
 
           # actually submitting filling tasks
-          submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
-          output = submitJobs.communicate()
-          print output
-
-          # avoid overlapping submission
-          time.sleep(1)
-
-      checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-      datalines = (checkJobs.communicate()[0]).splitlines()
+          jobExecutor.submit( fill_src_n, fill_log_n if not(Silent) else None, submit_s )
 
       print 'Waiting for filling jobs to be finished...'
+      # finished fill outputs are summed into partial sums while the others run
+      mergeState = loadIncrementalMerge( pwd, iters ) if incrementalMerge else None
 
       # Daemon cheking running jobs
-      while len(datalines)>=2 :
-          for entry in datalines:
-              entry = entry.rstrip()
-              entry = entry.split()[0]
-              #print entry
-              if(entry.find('JOBID')!=-1): continue
-              i = int(entry)
-
-          time.sleep(1)
-
-          checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-          datalines = (checkJobs.communicate()[0]).splitlines()
+      jobExecutor.wait( 1, (lambda: incrementalMergeStep( pwd, iters, mergeState )) if incrementalMerge else None )
 
       print 'Done with loop'
+      incrementalMerged = incrementalMerge and incrementalMergeFinish( pwd, iters, mergeState )
       print 'Now adding files...'
 
       # Computing Nunber of hadd
-      inputlist_v = inputlistbase_v[:]
-      NrelJob = float(len(inputlist_v)) / float(ijobmax)
-      if( float(int(NrelJob) - NrelJob) < 0. ):
-          NrelJob = int(NrelJob) + 1
+      NrelJob = njobs
       Nlist_flo = float(NrelJob/nHadd) + 1.
       Nlist = int(Nlist_flo)
+      # only the final hadd of the partial sums is left
+      if( incrementalMerged ):
+          Nlist = 0
       print Nlist
       # hadd to sum the epsilon histograms
       for nHadds in range(Nlist):
@@ -90,11 +90,7 @@ for iters in range(Iter_toResub, nIterations):
           Hadd_log_n = logPath + "/HaddCfg_iter_" + str(iters) + "_job_" + str(nHadds) + ".log"
           Hsubmit_s = "bsub -q " + queue + " -o " + Hadd_log_n + " bash " + Hadd_src_n
           #Before each HADD we need ot check if the all the files in the list are present
-          Grepcommand = "grep -i list " + Hadd_src_n + " | grep -v echo | awk '{print $4}'"
-          myGrep = subprocess.Popen([Grepcommand], stdout=subprocess.PIPE, shell=True )
-          FoutGrep = myGrep.communicate()
-          FoutGrep_2 = str(FoutGrep)[3:]
-          FoutGrep_2 = str(FoutGrep_2)[:-10]
+          FoutGrep_2 = srcPath + "/hadd/hadd_iter_" + str(iters) + "_step_" + str(nHadds) + ".list"
           print 'Checking ' + str(FoutGrep_2)
           #Chech The size for each line
           f = open( str(FoutGrep_2) )
@@ -142,61 +138,34 @@ for iters in range(Iter_toResub, nIterations):
               MoveC = subprocess.Popen([MoveComm], stdout=subprocess.PIPE, shell=True);
               mvOut = MoveC.communicate()
           #End of the check
-          subJobs = subprocess.Popen([Hsubmit_s], stdout=subprocess.PIPE, shell=True);
-          outJobs = subJobs.communicate()
-          print outJobs
-          time.sleep(1)
-
-      checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-      datalines = (checkJobs.communicate()[0]).splitlines()
+          jobExecutor.submit( Hadd_src_n, Hadd_log_n, Hsubmit_s )
 
       print 'Waiting for all the hadd...'
 
       # Daemon cheking running jobs
-      while len(datalines)>=2 :
-          for entry in datalines:
-              entry = entry.rstrip()
-              entry = entry.split()[0]
-              #print entry
-              if(entry.find('JOBID')!=-1): continue
-              i = int(entry)
-
-          time.sleep(1)
-
-          checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-          datalines = (checkJobs.communicate()[0]).splitlines()
+      jobExecutor.wait( 1 )
 
       print 'Done with various hadd'
 
-      print 'Now The Final One...'
-      FHadd_src_n = srcPath + "/hadd/Final_HaddCfg_iter_" + str(iters) + ".sh"
-      FHadd_log_n = logPath + "/Final_HaddCfg_iter_" + str(iters) + ".log"
-      FHsubmit_s = "bsub -q " + queue + " -o " + FHadd_log_n + " bash " + FHadd_src_n
-      FsubJobs = subprocess.Popen([FHsubmit_s], stdout=subprocess.PIPE, shell=True);
-      FoutJobs = FsubJobs.communicate()
-      print FoutJobs
-      time.sleep(3)
-
-      FcheckJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-      Fdatalines = (FcheckJobs.communicate()[0]).splitlines()
-      print 'Waiting for the Final hadd...'
-      # Daemon cheking running jobs
-      while len(Fdatalines)>=2 :
-          for entry in Fdatalines:
-              entry = entry.rstrip()
-              entry = entry.split()[0]
-              #print entry
-              if(entry.find('JOBID')!=-1): continue
-              i = int(entry)
-
-          time.sleep(1)
+      if( fusedMergeFit and not fusedKeepMerged ):
+         print 'No final hadd: the fit jobs sum the hadd outputs themselves (fusedMergeFit)'
+      else:
+         print 'Now The Final One...'
+         FHadd_src_n = srcPath + "/hadd/Final_HaddCfg_iter_" + str(iters) + ".sh"
+         FHadd_log_n = logPath + "/Final_HaddCfg_iter_" + str(iters) + ".log"
+         FHsubmit_s = "bsub -q " + queue + " -o " + FHadd_log_n + " bash " + FHadd_src_n
+         jobExecutor.submit( FHadd_src_n, FHadd_log_n, FHsubmit_s, 3 )
 
-          FcheckJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-          Fdatalines = (FcheckJobs.communicate()[0]).splitlines()
+         if( fusedMergeFit ):
+            print 'The final hadd runs alongside the fits (fusedKeepMerged)'
+         else:
+            print 'Waiting for the Final hadd...'
+            # Daemon cheking running jobs
+            jobExecutor.wait( 1 )
 
-      print 'Done with final hadd'
+            print 'Done with final hadd'
 
-      print 'Done with staging the final epsilonPlots.root'
+            print 'Done with staging the final epsilonPlots.root'
 
       # removing useles file
 #      for nRm in range(Nlist):
@@ -207,12 +176,16 @@ for iters in range(Iter_toResub, nIterations):
 #          filesRemoved = (removeFile.communicate()[0]).splitlines()
 
    # N of Fit to send
-   nEB = 61199/nFit
-   if (61199%nFit != 0) :
-       nEB = int(nEB) +1
-   nEE = 14647/nFit
-   if (14647%nFit != 0) :
-       nEE = int(nEE) +1
+   nEB = nFitJobs( nRegionsEB() ) if 'EB' in activeSubdets( Barrel_or_Endcap, droppedSubdets ) else 0
+   nEE = nFitJobs( nRegionsEE() ) if 'EE' in activeSubdets( Barrel_or_Endcap, droppedSubdets ) else 0
+   # balanceFitJobs: the fit jobs get region lists of the same expected cost
+   if(onlyFinalHadd=='False'):
+      # fusedMergeFit: the files each fit job sums
+      if( fusedMergeFit and writeFusedFitInputs( pwd, iters ) ):
+         print 'Stopping before the fits of iteration ' + str(iters) + ': they would miss the hadd outputs above. Redo those hadd jobs and resubmit from this iteration'
+         sys.exit(1)
+      balanceFitCfgs( iters, 'Barrel', [ outputdir + "/cfgFile/Fit/fitEpsilonPlot_EB_" + str(i) + "_iter_" + str(iters) + ".py" for i in range(nEB) ] )
+      balanceFitCfgs( iters, 'Endcap', [ outputdir + "/cfgFile/Fit/fitEpsilonPlot_EE_" + str(i) + "_iter_" + str(iters) + ".py" for i in range(nEE) ] )
    # For final hadd
    ListFinaHadd = list()
    # preparing submission of fit tasks (EB)
@@ -226,11 +199,8 @@ for iters in range(Iter_toResub, nIterations):
        if(onlyFinalHadd=='False'):
          print 'About to EB fit:'
          print 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iters) + '/' + NameTag + 'Barrel_'+str(inteb)+'_' + calibMapName
-         print submit_s
          # actually submitting fit tasks (EB)
-         submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
-         output = submitJobs.communicate()
-         print output
+         jobExecutor.submit( fit_src_n, None, submit_s, 0 )
 
    # preparing submission of fit tasks (EE)
    print 'Submitting ' + str(nEE) + ' jobs to fit the Endcap'
@@ -243,32 +213,14 @@ for iters in range(Iter_toResub, nIterations):
        if(onlyFinalHadd=='False'):
          print 'About to EE fit:'
          print 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iters) + '/' + NameTag + 'Endcap_'+str(inte) + '_' + calibMapName
-         print submit_s
          # actually submitting fit tasks (EE)
-         submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
-         output = submitJobs.communicate()
-         print output
+         jobExecutor.submit( fit_src_n, None, submit_s, 0 )
 
    if(onlyFinalHadd=='False'):
-      # checking number of running/pending jobs
-      checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-      datalines = (checkJobs.communicate()[0]).splitlines()
-   
       print 'Waiting for fit jobs to be finished...'
    
       #Daemon cheking running jobs
-      while len(datalines)>=2 :
-          for entry in datalines:
-              entry = entry.rstrip()
-              entry = entry.split()[0]
-              #print entry
-              if(entry.find('JOBID')!=-1): continue
-              i = int(entry)
-   
-          time.sleep(1)
-   
-          checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-          datalines = (checkJobs.communicate()[0]).splitlines()
+      jobExecutor.wait( 1 )
    
       print "Done with fitting! Now we have to merge all fits in one Calibmap.root"
 
@@ -279,6 +231,9 @@ for iters in range(Iter_toResub, nIterations):
    AutoLibraryLoader.enable()
    f = TFile('/tmp/' + NameTag + calibMapName, 'recreate')
 
+   # compiled merge (mergeCalibMaps) into <calibMap>.native; the PyROOT loop below only runs if it fails
+   nativeMerged = nativeMerge and nativeMergeCalibMap( f.GetName() + '.native', ListFinaHadd )
+
    # Create a struct
    gROOT.ProcessLine(\
      "struct EBStruct{\
@@ -305,6 +260,9 @@ for iters in range(Iter_toResub, nIterations):
        Double_t fit_b2_;\
        Double_t fit_b3_;\
        Double_t fit_Bnorm_;\
+       Int_t fit_attempt_;\
+       Double_t fit_time_;\
+       Int_t iRegion_;\
      };")
    gROOT.ProcessLine(\
      "struct EEStruct{\
@@ -330,6 +288,9 @@ for iters in range(Iter_toResub, nIterations):
        Double_t fit_b2_;\
        Double_t fit_b3_;\
        Double_t fit_Bnorm_;\
+       Int_t fit_attempt_;\
+       Double_t fit_time_;\
+       Int_t iRegion_;\
      };")
    s = EBStruct()
    t = EEStruct()
@@ -338,6 +299,7 @@ for iters in range(Iter_toResub, nIterations):
      "struct EB1Struct{\
        Int_t rawId;\
        Int_t hashedIndex;\
+       Int_t iRegion;\
        Int_t ieta;\
        Int_t iphi;\
        Int_t iSM;\
@@ -359,6 +321,8 @@ for iters in range(Iter_toResub, nIterations):
        Double_t fit_b2;\
        Double_t fit_b3;\
        Double_t fit_Bnorm;\
+       Int_t fit_attempt;\
+       Double_t fit_time;\
      };")
    gROOT.ProcessLine(\
      "struct EE1Struct{\
@@ -370,6 +334,7 @@ for iters in range(Iter_toResub, nIterations):
        Int_t ic;\
        Int_t iquadrant;\
        Int_t hashedIndex;\
+       Int_t iRegion;\
        Int_t iter;\
        Double_t coeff;\
        Double_t Signal;\
@@ -384,6 +349,8 @@ for iters in range(Iter_toResub, nIterations):
        Double_t fit_b2;\
        Double_t fit_b3;\
        Double_t fit_Bnorm;\
+       Int_t fit_attempt;\
+       Double_t fit_time;\
      };")
    s1 = EB1Struct()
    t1 = EE1Struct()
@@ -415,6 +382,9 @@ for iters in range(Iter_toResub, nIterations):
    TreeEB.Branch('fit_b2_'     , AddressOf(s,'fit_b2_'),'fit_b2_/F')
    TreeEB.Branch('fit_b3_'     , AddressOf(s,'fit_b3_'),'fit_b3_/F')
    TreeEB.Branch('fit_Bnorm_'  , AddressOf(s,'fit_Bnorm_'),'fit_Bnorm_/F')
+   TreeEB.Branch('fit_attempt_', AddressOf(s,'fit_attempt_'),'fit_attempt_/I')
+   TreeEB.Branch('fit_time_'   , AddressOf(s,'fit_time_'),'fit_time_/F')
+   TreeEB.Branch('iRegion_'    , AddressOf(s,'iRegion_'),'iRegion_/I')
 
    TreeEE = TTree("calibEE", "Tree of EE Inter-calibration constants")
    TreeEE.Branch('ix_'         , AddressOf(t,'ix_'),'ix_/I')
@@ -439,8 +409,14 @@ for iters in range(Iter_toResub, nIterations):
    TreeEE.Branch('fit_b2_'     , AddressOf(t,'fit_b2_'),'fit_b2_/F')
    TreeEE.Branch('fit_b3_'     , AddressOf(t,'fit_b3_'),'fit_b3_/F')
    TreeEE.Branch('fit_Bnorm_'  , AddressOf(t,'fit_Bnorm_'),'fit_Bnorm_/F')
-
-   for thisfile_s in ListFinaHadd:
+   TreeEE.Branch('fit_attempt_', AddressOf(t,'fit_attempt_'),'fit_attempt_/I')
+   TreeEE.Branch('fit_time_'   , AddressOf(t,'fit_time_'),'fit_time_/F')
+   TreeEE.Branch('iRegion_'    , AddressOf(t,'iRegion_'),'iRegion_/I')
+
+   # fit errors of the merged crystals, for the convergence tracking (freezeConverged)
+   fitRelErrEB = dict()
+   fitRelErrEE = dict()
+   for thisfile_s in ( [] if nativeMerged else ListFinaHadd ):
        thisfile_s = thisfile_s.rstrip()
        print thisfile_s
        thisfile_f = TFile.Open(thisfile_s)
@@ -449,12 +425,21 @@ for iters in range(Iter_toResub, nIterations):
        init = h_Int.GetBinContent(1)
        finit = h_Int.GetBinContent(2)
        EEoEB = h_Int.GetBinContent(3)
+       # balanced fit jobs (balanceFitJobs) list their regions, not contiguous, in "fitRegions"
+       h_Reg = thisfile_f.Get("fitRegions")
+       if h_Reg:
+          fittedRegions = set( iR for iR in range(h_Reg.GetNbinsX()) if h_Reg.GetBinContent(iR+1) > 0 )
+       else:
+          fittedRegions = set( range( int(init), int(finit)+1 ) )
+       # crystals of the fitted regions [init,finit] (one per region for xtal, more for tt/etaring)
+       fittedXtals = list()
 
        #TTree
        if EEoEB == 0:
           thisTree = thisfile_f.Get("calibEB")
           thisTree.SetBranchAddress( 'rawId',AddressOf(s1,'rawId'));
           thisTree.SetBranchAddress( 'hashedIndex',AddressOf(s1,'hashedIndex'));
+          thisTree.SetBranchAddress( 'iRegion',AddressOf(s1,'iRegion'));
           thisTree.SetBranchAddress( 'ieta',AddressOf(s1,'ieta'));
           thisTree.SetBranchAddress( 'iphi',AddressOf(s1,'iphi'));
           thisTree.SetBranchAddress( 'iSM',AddressOf(s1,'iSM'));
@@ -476,9 +461,18 @@ for iters in range(Iter_toResub, nIterations):
           thisTree.SetBranchAddress( 'fit_b2',AddressOf(s1,'fit_b2'));
           thisTree.SetBranchAddress( 'fit_b3',AddressOf(s1,'fit_b3'));
           thisTree.SetBranchAddress( 'fit_Bnorm',AddressOf(s1,'fit_Bnorm'));
+          thisTree.SetBranchAddress( 'fit_attempt',AddressOf(s1,'fit_attempt'));
+          # fit outputs made before fit_time existed
+          if thisTree.GetBranch( 'fit_time' ):
+             thisTree.SetBranchAddress( 'fit_time',AddressOf(s1,'fit_time'));
+          else:
+             s1.fit_time = 0.
           for ntre in range(thisTree.GetEntries()):
               thisTree.GetEntry(ntre);
-              if (ntre>=init and ntre<=finit):
+              if (s1.iRegion in fittedRegions):
+                  fittedXtals.append( s1.hashedIndex )
+                  if freezeConverged:
+                      fitRelErrEB[s1.hashedIndex] = coeffRelError( thisTree )
                   s.rawId_ = s1.rawId
                   s.hashedIndex_ = s1.hashedIndex
                   s.ieta_ = s1.ieta
@@ -502,6 +496,9 @@ for iters in range(Iter_toResub, nIterations):
                   s.fit_b2_ = s1.fit_b2
                   s.fit_b3_ = s1.fit_b3
                   s.fit_Bnorm_ = s1.fit_Bnorm
+                  s.fit_attempt_ = s1.fit_attempt
+                  s.fit_time_ = s1.fit_time
+                  s.iRegion_ = s1.iRegion
                   TreeEB.Fill()
        else:
           thisTree = thisfile_f.Get("calibEE")
@@ -513,6 +510,7 @@ for iters in range(Iter_toResub, nIterations):
           thisTree.SetBranchAddress( 'ic',AddressOf(t1,'ic'));
           thisTree.SetBranchAddress( 'iquadrant',AddressOf(t1,'iquadrant'));
           thisTree.SetBranchAddress( 'hashedIndex',AddressOf(t1,'hashedIndex'));
+          thisTree.SetBranchAddress( 'iRegion',AddressOf(t1,'iRegion'));
           thisTree.SetBranchAddress( 'iter',AddressOf(t1,'iter'));
           thisTree.SetBranchAddress( 'coeff',AddressOf(t1,'coeff'));
           thisTree.SetBranchAddress( 'Signal',AddressOf(t1,'Signal'));
@@ -527,9 +525,18 @@ for iters in range(Iter_toResub, nIterations):
           thisTree.SetBranchAddress( 'fit_b2',AddressOf(t1,'fit_b2'));
           thisTree.SetBranchAddress( 'fit_b3',AddressOf(t1,'fit_b3'));
           thisTree.SetBranchAddress( 'fit_Bnorm',AddressOf(t1,'fit_Bnorm'));
+          thisTree.SetBranchAddress( 'fit_attempt',AddressOf(t1,'fit_attempt'));
+          # fit outputs made before fit_time existed
+          if thisTree.GetBranch( 'fit_time' ):
+             thisTree.SetBranchAddress( 'fit_time',AddressOf(t1,'fit_time'));
+          else:
+             t1.fit_time = 0.
           for ntre in range(thisTree.GetEntries()):
               thisTree.GetEntry(ntre);
-              if (ntre>=init and ntre<=finit):
+              if (t1.iRegion in fittedRegions):
+                  fittedXtals.append( t1.hashedIndex )
+                  if freezeConverged:
+                      fitRelErrEE[t1.hashedIndex] = coeffRelError( thisTree )
                   t.ix_ = t1.ix
                   t.iy_ = t1.iy
                   t.zside_ = t1.zside
@@ -552,6 +559,9 @@ for iters in range(Iter_toResub, nIterations):
                   t.fit_b2_ = t1.fit_b2
                   t.fit_b3_ = t1.fit_b3
                   t.fit_Bnorm_ = t1.fit_Bnorm
+                  t.fit_attempt_ = t1.fit_attempt
+                  t.fit_time_ = t1.fit_time
+                  t.iRegion_ = t1.iRegion
                   TreeEE.Fill()
        #TH2
        thisHistoEB = thisfile_f.Get("calibMap_EB")
@@ -559,32 +569,59 @@ for iters in range(Iter_toResub, nIterations):
        thisHistoEEp = thisfile_f.Get("calibMap_EEp")
        if EEoEB == 0:
           MaxEta = 85
-          Init = int(init)
-          Fin = int(finit+1)
-          for nFitB in range(Init,Fin):
-              if nFitB < 61200:
-                 myRechit = EBDetId( EBDetId.detIdFromDenseIndex(nFitB) )
-                 bin_x = myRechit.ieta()+MaxEta+1
-                 bin_y = myRechit.iphi()
-                 value = thisHistoEB.GetBinContent(bin_x,bin_y)
-                 calibMap_EB.SetBinContent(bin_x,bin_y,value)
+          for nFitB in fittedXtals:
+             myRechit = EBDetId( EBDetId.detIdFromDenseIndex(nFitB) )
+             bin_x = myRechit.ieta()+MaxEta+1
+             bin_y = myRechit.iphi()
+             value = thisHistoEB.GetBinContent(bin_x,bin_y)
+             calibMap_EB.SetBinContent(bin_x,bin_y,value)
        else :
-          Init1 = int(init)
-          Fin1 = int(finit+1)
-          for nFitE in range(Init1,Fin1):
-              if nFitE < 14648:
-                 myRechitE = EEDetId( EEDetId.detIdFromDenseIndex(nFitE) )
-                 if myRechitE.zside() < 0 :
-                    value = thisHistoEEm.GetBinContent(myRechitE.ix(),myRechitE.iy())
-                    calibMap_EEm.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
-                 if myRechitE.zside() > 0 :
-                    value = thisHistoEEp.GetBinContent(myRechitE.ix(),myRechitE.iy())
-                    calibMap_EEp.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
+          for nFitE in fittedXtals:
+             myRechitE = EEDetId( EEDetId.detIdFromDenseIndex(nFitE) )
+             if myRechitE.zside() < 0 :
+                value = thisHistoEEm.GetBinContent(myRechitE.ix(),myRechitE.iy())
+                calibMap_EEm.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
+             if myRechitE.zside() > 0 :
+                value = thisHistoEEp.GetBinContent(myRechitE.ix(),myRechitE.iy())
+                calibMap_EEp.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
 
        thisfile_f.Close()
+   if( nativeMerged ):
+      mergedName = os.path.expandvars( f.GetName() )
+      f.Close()
+      os.rename( mergedName + '.native', mergedName )
+      f = TFile( mergedName, 'update' )
+      calibMap_EB = f.Get('calibMap_EB')
+      calibMap_EEm = f.Get('calibMap_EEm')
+      calibMap_EEp = f.Get('calibMap_EEp')
+      if( freezeConverged ):
+         fitRelErrEB, fitRelErrEE = mergedRelErrors( f )
    f.cd()
-   f.Write()
+   if( droppedSubdets ):
+       carryForwardCalibMap( pwd, iters, calibMap_EB, calibMap_EEm, calibMap_EEp, droppedSubdets )
+   # extrapolated constants (and the accel_* diagnostics) go into calibMap.root
+   if( calibAcceleration!='none' and useCalibMapBinary and not isCRAB ):
+       accelerateCalibMap( pwd, iters, calibMap_EB, calibMap_EEm, calibMap_EEp )
+   if( freezeConverged and useCalibMapBinary and not isCRAB ):
+       updateFrozenMap( pwd, iters, calibMap_EB, calibMap_EEm, calibMap_EEp, fitRelErrEB, fitRelErrEE )
+   f.Write('', TObject.kOverwrite)
+   if( useCalibMapBinary and not isCRAB ):
+       print 'Writing ' + calibMapBinaryFile(pwd, iters) + ' for the next iteration'
+       writeCalibMapBinaryFromTH2( calibMapBinaryFile(pwd, iters), iters, calibMap_EB, calibMap_EEm, calibMap_EEp )
+       if( warmStartFits or fastPeakEstimate ):
+          writeFitSeeds( f, fitSeedsFile(pwd, iters) )
    f.Close()
+   if( monitorConvergence and useCalibMapBinary and not isCRAB ):
+       activeNow = activeSubdets( Barrel_or_Endcap, droppedSubdets )
+       converged = convergenceMonitor( pwd, iters, activeNow )
+       if( stopAtConvergence and converged ):
+           if( len(converged)==len(activeNow) ):
+               recordConvergenceDecision( pwd, iters, 'STOP', converged )
+               decisions.append( (iters, 'STOP', converged) )
+               lastIteration = iters
+           else:
+               recordConvergenceDecision( pwd, iters, 'DROP', converged )
+               decisions.append( (iters, 'DROP', converged) )
 
    print 'Now staging calibMap.root on EOS'
    stage_s_fin = 'cmsStage /tmp/' + NameTag + calibMapName + ' ' + eosPath + '/' + dirname + '/iter_' + str(iters) + "/" + NameTag + calibMapName
@@ -611,6 +648,9 @@ for iters in range(Iter_toResub, nIterations):
            break
 
    print "Done with iteration " + str(iters)
+   if ( lastIteration>=0 and iters>=lastIteration ):
+       print "All subdetectors converged, stopping after iteration " + str(iters)
+       break
    onlyFIT='False'
    onlyFinalHadd='False'
 
@@ -2,6 +2,12 @@
 
 import subprocess, time, sys, os
 from methods import *
+from executors import *
+from daemonState import *
+
+if( pipelineSubdets and pipelineSubdet not in ('EB', 'EE') ):
+    print "pipelineSubdets: ECALPRO_SUBDET must be EB or EE (set by submitCalibration.py and resubmitCalibration.py)"
+    sys.exit(1)
 
 mode = str(sys.argv[1])
 if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):  # Beacause in IIHE the pwd give a link to the area, and you don't want that
@@ -65,20 +71,43 @@ outputdir = pwd+'/'+dirname
 logPath = outputdir + '/log'
 srcPath  = outputdir + '/src'
 cfgHaddPath  = outputdir + '/src/hadd'
+# batch system or this machine (executor in parameters.py)
+jobExecutor = makeExecutor( queue, num, outputdir )
+# durableState: tasks and stages recorded in daemonState.db; a daemon started again (BATCH) skips what is done
+daemonState = DaemonState( daemonStateFile(pwd) if durableState else None, RunBatch )
 
 # To compute the num of hadd
 inputlist_f = open( inputlist_n )
 # read the list containing all the input files
 inputlistbase_v = inputlist_f.readlines()
 
+# convergence monitor: decisions of a previous run (subdetectors dropped after an iteration, last iteration)
+decisions = convergenceDecisions(pwd) if stopAtConvergence else []
+lastIteration = stopIteration( decisions )
+
 for iters in range(nIterations):
     if ( RunCRAB ):
         iters = int(sys.argv[2])
     if ( RunResub ):
         iters = iters + int(sys.argv[2])
-    if ( not RunCRAB and not ONLYHADD and not ONLYFIT and not ONLYFINHADD ):
+    if ( lastIteration>=0 and iters>lastIteration ):
+        print "Converged after iteration " + str(lastIteration) + " (see " + convergenceLogFile(pwd) + "), not running iteration " + str(iters)
+        break
+    droppedSubdets = droppedSubdetsAt( decisions, iters )
+    iterDir = eosPath + '/' + dirname + '/iter_' + str(iters) + '/'
+    if ( daemonState.stageDone( iters, 'merge' ) and not daemonState.toSubmit( iters, 'merge', 'calibMap', iterDir + NameTag + calibMapName, jobExecutor ) ):
+        print "Iteration " + str(iters) + " already done (" + daemonStateFile(pwd) + ")"
+        continue
+    incrementalMerged = False
+    if ( not RunCRAB and not ONLYHADD and not ONLYFIT and not ONLYFINHADD and daemonState.stageDone( iters, 'fill' ) ):
+        print "\n*******  ITERATION " + str(iters) + "/" + str(nIterations-1) + "  *******"
+        print "Fill jobs already done (" + daemonStateFile(pwd) + ")"
+        if( incrementalMerge ):
+            incrementalMerged = incrementalMergeFinish( pwd, iters, loadIncrementalMerge( pwd, iters ) )
+    elif ( not RunCRAB and not ONLYHADD and not ONLYFIT and not ONLYFINHADD ):
         print "\n*******  ITERATION " + str(iters) + "/" + str(nIterations-1) + "  *******"
         print "Submitting " + str(njobs) + " jobs"
+        daemonState.startStage( iters, 'fill' )
         for ijob in range(njobs):
             #In case you want the stat. syst
             if ( mode.find('BATCH_RESU_SYST_1') != -1 ):
@@ -91,6 +120,11 @@ for iters in range(nIterations):
                  SystParamLine = 'process.analyzerFillEpsilon.SystOrNot = cms.untracked.double(2)\n'
                  env_script_n.write(SystParamLine)
                  env_script_n.close()
+            # converged subdetectors are not filled any more
+            if ( droppedSubdets ):
+                 env_script_n = open(outputdir + "/cfgFile/Fill/fillEpsilonPlot_iter_" + str(iters) + "_job_" + str(ijob) + ".py", 'a')
+                 env_script_n.write("process.analyzerFillEpsilon.Barrel_orEndcap = cms.untracked.string('" + ('ONLY_ENDCAP' if 'EB' in droppedSubdets else 'ONLY_BARREL') + "')\n")
+                 env_script_n.close()
             # preparing submission of filling tasks
             fill_log_n = logPath + "/fillEpsilonPlot_iter_" + str(iters) + "_job_" + str(ijob) + ".log"
             fill_src_n = srcPath + "/Fill/submit_iter_"     + str(iters) + "_job_" + str(ijob) + ".sh"
@@ -100,36 +134,30 @@ for iters in range(nIterations):
             else:
                  submit_s = "bsub -q " + queue + " -o /dev/null -e /dev/null " + fill_src_n
 
-            print '\n[job #' + str(ijob) + '] :: ' + submit_s
-
-            # actually submitting filling tasks
-            submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
-            output = submitJobs.communicate()
-            print "Out: " + str(output)
+            fill_out = iterDir + NameTag + outputFile + '_' + str(ijob) + '.root'
+            if not( daemonState.toSubmit( iters, 'fill', ijob, fill_out, jobExecutor ) ):
+                continue
 
-            # avoid overlapping submission
-            time.sleep(1)
+            print '\n[job #' + str(ijob) + ']'
 
-        checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-        datalines = (checkJobs.communicate()[0]).splitlines()
+            # actually submitting filling tasks
+            jobId = jobExecutor.submit( fill_src_n, fill_log_n if not(Silent) else None, submit_s )
+            daemonState.submitted( iters, 'fill', ijob, fill_out, jobId )
 
         print 'Waiting for filling jobs to be finished...'
-        # Daemon cheking running jobs
-        while len(datalines)>=2 :
-            for entry in datalines:
-                entry = entry.rstrip()
-                entry = entry.split()[0]
-                #print entry
-                if(entry.find('JOBID')!=-1): continue
-                i = int(entry)
-
-            time.sleep(10)
-
-            checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-            datalines = (checkJobs.communicate()[0]).splitlines()
+        # finished fill outputs are summed into partial sums while the others run
+        mergeState = loadIncrementalMerge( pwd, iters ) if incrementalMerge else None
+        def fillPoll():
+            if( incrementalMerge ):
+                incrementalMergeStep( pwd, iters, mergeState )
             checkJobs2 = subprocess.Popen(['rm -rf ' + pwd + '/core.*'], stdout=subprocess.PIPE, shell=True);
             datalines2 = (checkJobs2.communicate()[0]).splitlines()
+        # Daemon cheking running jobs
+        jobExecutor.wait( 10, fillPoll )
+        daemonState.finishStage( iters, 'fill' )
         print 'Done with the Fill part'
+        if( incrementalMerge ):
+            incrementalMerged = incrementalMergeFinish( pwd, iters, mergeState )
     #Crab start from HADD, but it need to rebuild the list of files. So he has this additional part
     if ( mode == 'CRAB' ):
         getGoodfile_str = ''
@@ -217,39 +245,30 @@ for iters in range(nIterations):
         Fhadd_cfg_f.close()
 
     #HADD for batch and CRAB, if you do not want just the finalHADD or the FIT
-    if ( mode != 'CRAB_RESU_FinalHadd' and mode != 'CRAB_RESU_FitOnly' and not ONLYFIT and not ONLYFINHADD ):
+    if ( mode != 'CRAB_RESU_FinalHadd' and mode != 'CRAB_RESU_FitOnly' and not ONLYFIT and not ONLYFINHADD and not incrementalMerged and daemonState.stageDone( iters, 'hadd' ) ):
+        print 'Hadd jobs already done (' + daemonStateFile(pwd) + ')'
+    elif ( mode != 'CRAB_RESU_FinalHadd' and mode != 'CRAB_RESU_FitOnly' and not ONLYFIT and not ONLYFINHADD and not incrementalMerged ):
         print 'Now adding files...'
+        daemonState.startStage( iters, 'hadd' )
         if not( RunCRAB ):
-           inputlist_v = inputlistbase_v[:]
-           NrelJob = float(len(inputlist_v)) / float(ijobmax)
-           if( float(int(NrelJob) - NrelJob) < 0. ):
-               NrelJob = int(NrelJob) + 1
+           NrelJob = nFillJobs( pwd, len(inputlistbase_v) )
            Nlist_flo = float(NrelJob/nHadd) + 1.
            Nlist = int(Nlist_flo)
         print "Number of Hadd in parallel: " + str(Nlist)
         for nHadds in range(Nlist):
             Hadd_src_n = srcPath + "/hadd/HaddCfg_iter_" + str(iters) + "_job_" + str(nHadds) + ".sh"
             Hadd_log_n = logPath + "/HaddCfg_iter_" + str(iters) + "_job_" + str(nHadds) + ".log"
+            Hadd_out = iterDir + NameTag + 'epsilonPlots_' + str(nHadds) + '.root'
+            if not( daemonState.toSubmit( iters, 'hadd', nHadds, Hadd_out, jobExecutor ) ):
+                continue
             Hsubmit_s = "bsub -q " + queue + " -o " + Hadd_log_n + " bash " + Hadd_src_n
             if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
                Hsubmit_s = "qsub -q localgrid@cream02 -o /dev/null -e /dev/null " +  Hadd_src_n
             #Before each HADD we need ot check if the all the files in the list are present
             #BUT we do that only if you are working on batch
             if not( RunCRAB ):
-               if(fastHadd):
-                  Grepcommand = "grep -i list " + Hadd_src_n + " | grep -v echo | grep -v bash | awk '{print $2}'"
-               else:
-                  Grepcommand = "grep -i list " + Hadd_src_n + " | grep -v echo | awk '{print $4}'"
-               myGrep = subprocess.Popen([Grepcommand], stdout=subprocess.PIPE, shell=True )
-               FoutGrep = myGrep.communicate()
-               if(fastHadd):
-                  FoutGrep_2 = str(FoutGrep)[2:]
-               else:
-                  FoutGrep_2 = str(FoutGrep)[3:]
-               if(fastHadd):
-                  FoutGrep_2 = str(FoutGrep_2)[:-11]
-               else:
-                  FoutGrep_2 = str(FoutGrep_2)[:-10]
+               # list of this hadd, as written by submitCalibration.py (or above, with CRAB)
+               FoutGrep_2 = srcPath + "/hadd/hadd_iter_" + str(iters) + "_step_" + str(nHadds) + ".list"
                print 'Checking ' + str(FoutGrep_2)
                #Chech The size for each line
                f = open( str(FoutGrep_2) )
@@ -299,90 +318,60 @@ for iters in range(nIterations):
                    MoveC = subprocess.Popen([MoveComm], stdout=subprocess.PIPE, shell=True);
                    mvOut = MoveC.communicate()
             #End of the check, sending the job
-            print Hsubmit_s
-            subJobs = subprocess.Popen([Hsubmit_s], stdout=subprocess.PIPE, shell=True);
-            outJobs = subJobs.communicate()
-            print outJobs
-            time.sleep(5)
-        if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-           checkJobs = subprocess.Popen(['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True);
-           datalines = (checkJobs.communicate()[0]).splitlines()
-        else:
-           checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-           datalines = (checkJobs.communicate()[0]).splitlines()
+            jobId = jobExecutor.submit( Hadd_src_n, Hadd_log_n, Hsubmit_s, 5 )
+            daemonState.submitted( iters, 'hadd', nHadds, Hadd_out, jobId )
 
         print 'Waiting for all the hadd...'
 
         # Daemon cheking running jobs
-        while len(datalines)>=num :
-            if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-               time.sleep(5)
-               checkJobs = subprocess.Popen(['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True);
-               datalines = (checkJobs.communicate()[0]).splitlines()
-            else:
-               for entry in datalines:
-                   entry = entry.rstrip()
-                   entry = entry.split()[0]
-                   #print entry
-                   if(entry.find('JOBID')!=-1): continue
-                   i = int(entry)
-
-               time.sleep(5)
-
-               checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-               datalines = (checkJobs.communicate()[0]).splitlines()
+        jobExecutor.wait( 5 )
+        daemonState.finishStage( iters, 'hadd' )
         print 'Done with various hadd'
 
-    if ( mode != 'CRAB_RESU_FitOnly' and not ONLYFIT ):
+    if ( mode != 'CRAB_RESU_FitOnly' and not ONLYFIT and daemonState.stageDone( iters, 'finalHadd' ) ):
+        print 'Final hadd already done (' + daemonStateFile(pwd) + ')'
+    elif ( mode != 'CRAB_RESU_FitOnly' and not ONLYFIT and fusedMergeFit and not fusedKeepMerged ):
+        print 'No final hadd: the fit jobs sum the hadd outputs themselves (fusedMergeFit)'
+    elif ( mode != 'CRAB_RESU_FitOnly' and not ONLYFIT ):
         print 'Now The Final One...'
+        daemonState.startStage( iters, 'finalHadd' )
         FHadd_src_n = srcPath + "/hadd/Final_HaddCfg_iter_" + str(iters) + ".sh"
         FHadd_log_n = logPath + "/Final_HaddCfg_iter_" + str(iters) + ".log"
+        FHadd_out = iterDir + NameTag + 'epsilonPlots.root'
         if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
              FHsubmit_s = "qsub -q localgrid@cream02 -o /dev/null -e /dev/null " + FHadd_src_n
         else:
              FHsubmit_s = "bsub -q " + queue + " -o " + FHadd_log_n + " bash " + FHadd_src_n
-        FsubJobs = subprocess.Popen([FHsubmit_s], stdout=subprocess.PIPE, shell=True);
-        FoutJobs = FsubJobs.communicate()
-        print FoutJobs
-        time.sleep(5)
+        if( daemonState.toSubmit( iters, 'finalHadd', 0, FHadd_out, jobExecutor ) ):
+            jobId = jobExecutor.submit( FHadd_src_n, FHadd_log_n, FHsubmit_s, 5 )
+            daemonState.submitted( iters, 'finalHadd', 0, FHadd_out, jobId )
 
-        if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-           FcheckJobs = subprocess.Popen(['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True);
-           Fdatalines = (FcheckJobs.communicate()[0]).splitlines()
+        if( fusedMergeFit ):
+            print 'The final hadd runs alongside the fits (fusedKeepMerged)'
         else:
-           FcheckJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-           Fdatalines = (FcheckJobs.communicate()[0]).splitlines()
-        print 'Waiting for the Final hadd...'
-        # Daemon cheking running jobs
-        while len(Fdatalines)>=num :
-            if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-               time.sleep(5)
-               FcheckJobs = subprocess.Popen(['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True);
-               Fdatalines = (FcheckJobs.communicate()[0]).splitlines()
-            else:
-               for entry in Fdatalines:
-                   entry = entry.rstrip()
-                   entry = entry.split()[0]
-                   #print entry
-                   if(entry.find('JOBID')!=-1): continue
-                   i = int(entry)
-
-               time.sleep(5)
-
-               FcheckJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-               Fdatalines = (FcheckJobs.communicate()[0]).splitlines()
-        print 'Done with final hadd'
+            print 'Waiting for the Final hadd...'
+            # Daemon cheking running jobs
+            jobExecutor.wait( 5 )
+            daemonState.finishStage( iters, 'finalHadd' )
+            print 'Done with final hadd'
 
     # N of Fit to send
-    nEB = 61199/nFit
-    if (61199%nFit != 0) :
-        nEB = int(nEB) +1
-    nEE = 14647/nFit
-    if (14647%nFit != 0) :
-        nEE = int(nEE) +1
+    nEB = nFitJobs( nRegionsEB() ) if 'EB' in activeSubdets( Barrel_or_Endcap, droppedSubdets ) else 0
+    nEE = nFitJobs( nRegionsEE() ) if 'EE' in activeSubdets( Barrel_or_Endcap, droppedSubdets ) else 0
+    # balanceFitJobs: the fit jobs get region lists of the same expected cost
+    balanceFitCfgs( iters, 'Barrel', [ outputdir + "/cfgFile/Fit/fitEpsilonPlot_EB_" + str(i) + "_iter_" + str(iters) + ".py" for i in range(nEB) ] )
+    balanceFitCfgs( iters, 'Endcap', [ outputdir + "/cfgFile/Fit/fitEpsilonPlot_EE_" + str(i) + "_iter_" + str(iters) + ".py" for i in range(nEE) ] )
+    # fusedMergeFit: the files each fit job sums
+    if( fusedMergeFit and writeFusedFitInputs( pwd, iters ) ):
+        print 'Stopping before the fits of iteration ' + str(iters) + ': they would miss the hadd outputs above. Redo those hadd jobs (or start the daemon again with durableState) and resubmit from this iteration'
+        sys.exit(1)
     # For final hadd
     ListFinaHaddEB = list()
     ListFinaHaddEE = list()
+    # a fit stage already done only rebuilds the lists above
+    fitDone = daemonState.stageDone( iters, 'fit' )
+    if not( fitDone ):
+        daemonState.startStage( iters, 'fit' )
     # preparing submission of fit tasks (EB)
     print 'Submitting ' + str(nEB) + ' jobs to fit the Barrel'
     for inteb in range(nEB):
@@ -435,11 +424,12 @@ for iters in range(nIterations):
             ListFinaHaddEB.append('root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iters) + '/' + Add_path + '/' + NameTag + 'Barrel_'+str(inteb)+'_' + calibMapName )
         print 'About to EB fit:'
         print 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iters) + '/' + Add_path + '/' + NameTag + 'Barrel_'+str(inteb)+'_' + calibMapName
-        print submit_s
         # actually submitting fit tasks (EB)
-        submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
-        output = submitJobs.communicate()
-        print output
+        fit_out = iterDir + NameTag + 'Barrel_' + str(inteb) + '_' + calibMapName
+        if( fitDone or not daemonState.toSubmit( iters, 'fit', 'EB_' + str(inteb), fit_out, jobExecutor ) ):
+            continue
+        jobId = jobExecutor.submit( fit_src_n, None, submit_s, 0 )
+        daemonState.submitted( iters, 'fit', 'EB_' + str(inteb), fit_out, jobId )
 
     # preparing submission of fit tasks (EE)
     print 'Submitting ' + str(nEE) + ' jobs to fit the Endcap'
@@ -493,41 +483,24 @@ for iters in range(nIterations):
             ListFinaHaddEE.append('root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iters) + '/' + Add_path + '/' + NameTag + 'Endcap_'+str(inte) + '_' + calibMapName)
         print 'About to EE fit:'
         print 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iters) + '/' + Add_path + '/' + NameTag + 'Endcap_'+str(inte) + '_' + calibMapName
-        print submit_s
         # actually submitting fit tasks (EE)
-        submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
-        output = submitJobs.communicate()
-        print output
+        fit_out = iterDir + NameTag + 'Endcap_' + str(inte) + '_' + calibMapName
+        if( fitDone or not daemonState.toSubmit( iters, 'fit', 'EE_' + str(inte), fit_out, jobExecutor ) ):
+            continue
+        jobId = jobExecutor.submit( fit_src_n, None, submit_s, 0 )
+        daemonState.submitted( iters, 'fit', 'EE_' + str(inte), fit_out, jobId )
 
-    # checking number of running/pending jobs
-    if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-        checkJobs = subprocess.Popen(['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True);
-        datalines = (checkJobs.communicate()[0]).splitlines()
-    else:
-        checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-        datalines = (checkJobs.communicate()[0]).splitlines()
     print 'Waiting for fit jobs to be finished...'
 
     #Daemon cheking running jobs
-    while len(datalines)>=num :
-        if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-            time.sleep(5)
-            checkJobs = subprocess.Popen(['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True);
-            datalines = (checkJobs.communicate()[0]).splitlines()
-        else:
-            for entry in datalines:
-                entry = entry.rstrip()
-                entry = entry.split()[0]
-                #print entry
-                if(entry.find('JOBID')!=-1): continue
-                i = int(entry)
-
-            time.sleep(5)
-
-            checkJobs = subprocess.Popen(['bjobs -q ' + queue], stdout=subprocess.PIPE, shell=True);
-            datalines = (checkJobs.communicate()[0]).splitlines()
+    jobExecutor.wait( 5 )
+    if not( fitDone ):
+        daemonState.finishStage( iters, 'fit' )
+    if( fusedMergeFit and fusedKeepMerged ):
+        daemonState.finishStage( iters, 'finalHadd' )
 
     print "Done with fitting! Now we have to merge all fits in one Calibmap.root"
+    daemonState.startStage( iters, 'merge' )
 
     # Merge Final CalibMap
     from ROOT import *
@@ -548,6 +521,9 @@ for iters in range(nIterations):
        ListFinaHadd = ListFinaHaddEB
        ListFinaHadd = ListFinaHadd + ListFinaHaddEE
 
+    # compiled merge (mergeCalibMaps) into <calibMap>.native; the PyROOT loop below only runs if it fails
+    nativeMerged = nativeMerge and nativeMergeCalibMap( f.GetName() + '.native', ListFinaHadd )
+
     # Create a struct
     if(Barrel_or_Endcap=='ONLY_BARREL' or Barrel_or_Endcap=='ALL_PLEASE'):
        gROOT.ProcessLine(\
@@ -576,6 +552,9 @@ for iters in range(nIterations):
            Double_t fit_b2_;\
            Double_t fit_b3_;\
            Double_t fit_Bnorm_;\
+           Int_t fit_attempt_;\
+           Double_t fit_time_;\
+           Int_t iRegion_;\
          };")
        s = EBStruct()
     if(Barrel_or_Endcap=='ONLY_ENDCAP' or Barrel_or_Endcap=='ALL_PLEASE'):
@@ -604,6 +583,9 @@ for iters in range(nIterations):
            Double_t fit_b2_;\
            Double_t fit_b3_;\
            Double_t fit_Bnorm_;\
+           Int_t fit_attempt_;\
+           Double_t fit_time_;\
+           Int_t iRegion_;\
          };")
        t = EEStruct()
     if(Barrel_or_Endcap=='ONLY_BARREL' or Barrel_or_Endcap=='ALL_PLEASE'):
@@ -611,6 +593,7 @@ for iters in range(nIterations):
          "struct EB1Struct{\
            Int_t rawId;\
            Int_t hashedIndex;\
+           Int_t iRegion;\
            Int_t ieta;\
            Int_t iphi;\
            Int_t iSM;\
@@ -633,6 +616,8 @@ for iters in range(nIterations):
            Double_t fit_b2;\
            Double_t fit_b3;\
            Double_t fit_Bnorm;\
+           Int_t fit_attempt;\
+           Double_t fit_time;\
          };")
        s1 = EB1Struct()
     if(Barrel_or_Endcap=='ONLY_ENDCAP' or Barrel_or_Endcap=='ALL_PLEASE'):
@@ -646,6 +631,7 @@ for iters in range(nIterations):
            Int_t ic;\
            Int_t iquadrant;\
            Int_t hashedIndex;\
+           Int_t iRegion;\
            Int_t iter;\
            Double_t coeff;\
            Double_t Signal;\
@@ -661,6 +647,8 @@ for iters in range(nIterations):
            Double_t fit_b2;\
            Double_t fit_b3;\
            Double_t fit_Bnorm;\
+           Int_t fit_attempt;\
+           Double_t fit_time;\
          };")
        t1 = EE1Struct()
 
@@ -693,6 +681,9 @@ for iters in range(nIterations):
        TreeEB.Branch('fit_b2_'     , AddressOf(s,'fit_b2_'),'fit_b2_/F')
        TreeEB.Branch('fit_b3_'     , AddressOf(s,'fit_b3_'),'fit_b3_/F')
        TreeEB.Branch('fit_Bnorm_'  , AddressOf(s,'fit_Bnorm_'),'fit_Bnorm_/F')
+       TreeEB.Branch('fit_attempt_', AddressOf(s,'fit_attempt_'),'fit_attempt_/I')
+       TreeEB.Branch('fit_time_'   , AddressOf(s,'fit_time_'),'fit_time_/F')
+       TreeEB.Branch('iRegion_'    , AddressOf(s,'iRegion_'),'iRegion_/I')
 
     TreeEE = TTree("calibEE", "Tree of EE Inter-calibration constants")
     if(Barrel_or_Endcap=='ONLY_ENDCAP' or Barrel_or_Endcap=='ALL_PLEASE'):
@@ -719,8 +710,14 @@ for iters in range(nIterations):
        TreeEE.Branch('fit_b2_'     , AddressOf(t,'fit_b2_'),'fit_b2_/F')
        TreeEE.Branch('fit_b3_'     , AddressOf(t,'fit_b3_'),'fit_b3_/F')
        TreeEE.Branch('fit_Bnorm_'  , AddressOf(t,'fit_Bnorm_'),'fit_Bnorm_/F')
-
-    for thisfile_s in ListFinaHadd:
+       TreeEE.Branch('fit_attempt_', AddressOf(t,'fit_attempt_'),'fit_attempt_/I')
+       TreeEE.Branch('fit_time_'   , AddressOf(t,'fit_time_'),'fit_time_/F')
+       TreeEE.Branch('iRegion_'    , AddressOf(t,'iRegion_'),'iRegion_/I')
+
+    # fit errors of the merged crystals, for the convergence tracking (freezeConverged)
+    fitRelErrEB = dict()
+    fitRelErrEE = dict()
+    for thisfile_s in ( [] if nativeMerged else ListFinaHadd ):
         thisfile_s = thisfile_s.rstrip()
         print thisfile_s
         thisfile_f = TFile.Open(thisfile_s)
@@ -729,12 +726,21 @@ for iters in range(nIterations):
         init = h_Int.GetBinContent(1)
         finit = h_Int.GetBinContent(2)
         EEoEB = h_Int.GetBinContent(3)
+        # balanced fit jobs (balanceFitJobs) list their regions, not contiguous, in "fitRegions"
+        h_Reg = thisfile_f.Get("fitRegions")
+        if h_Reg:
+           fittedRegions = set( iR for iR in range(h_Reg.GetNbinsX()) if h_Reg.GetBinContent(iR+1) > 0 )
+        else:
+           fittedRegions = set( range( int(init), int(finit)+1 ) )
+        # crystals of the fitted regions [init,finit] (one per region for xtal, more for tt/etaring)
+        fittedXtals = list()
 
         #TTree
         if EEoEB == 0:
            thisTree = thisfile_f.Get("calibEB")
            thisTree.SetBranchAddress( 'rawId',AddressOf(s1,'rawId'));
            thisTree.SetBranchAddress( 'hashedIndex',AddressOf(s1,'hashedIndex'));
+           thisTree.SetBranchAddress( 'iRegion',AddressOf(s1,'iRegion'));
            thisTree.SetBranchAddress( 'ieta',AddressOf(s1,'ieta'));
            thisTree.SetBranchAddress( 'iphi',AddressOf(s1,'iphi'));
            thisTree.SetBranchAddress( 'iSM',AddressOf(s1,'iSM'));
@@ -757,9 +763,18 @@ for iters in range(nIterations):
            thisTree.SetBranchAddress( 'fit_b2',AddressOf(s1,'fit_b2'));
            thisTree.SetBranchAddress( 'fit_b3',AddressOf(s1,'fit_b3'));
            thisTree.SetBranchAddress( 'fit_Bnorm',AddressOf(s1,'fit_Bnorm'));
+           thisTree.SetBranchAddress( 'fit_attempt',AddressOf(s1,'fit_attempt'));
+           # fit outputs made before fit_time existed
+           if thisTree.GetBranch( 'fit_time' ):
+              thisTree.SetBranchAddress( 'fit_time',AddressOf(s1,'fit_time'));
+           else:
+              s1.fit_time = 0.
            for ntre in range(thisTree.GetEntries()):
                thisTree.GetEntry(ntre);
-               if (ntre>=init and ntre<=finit):
+               if (s1.iRegion in fittedRegions):
+                   fittedXtals.append( s1.hashedIndex )
+                   if freezeConverged:
+                       fitRelErrEB[s1.hashedIndex] = coeffRelError( thisTree )
                    s.rawId_ = s1.rawId
                    s.hashedIndex_ = s1.hashedIndex
                    s.ieta_ = s1.ieta
@@ -784,6 +799,9 @@ for iters in range(nIterations):
                    s.fit_b2_ = s1.fit_b2
                    s.fit_b3_ = s1.fit_b3
                    s.fit_Bnorm_ = s1.fit_Bnorm
+                   s.fit_attempt_ = s1.fit_attempt
+                   s.fit_time_ = s1.fit_time
+                   s.iRegion_ = s1.iRegion
                    TreeEB.Fill()
         else:
            thisTree = thisfile_f.Get("calibEE")
@@ -795,6 +813,7 @@ for iters in range(nIterations):
            thisTree.SetBranchAddress( 'ic',AddressOf(t1,'ic'));
            thisTree.SetBranchAddress( 'iquadrant',AddressOf(t1,'iquadrant'));
            thisTree.SetBranchAddress( 'hashedIndex',AddressOf(t1,'hashedIndex'));
+           thisTree.SetBranchAddress( 'iRegion',AddressOf(t1,'iRegion'));
            thisTree.SetBranchAddress( 'iter',AddressOf(t1,'iter'));
            thisTree.SetBranchAddress( 'coeff',AddressOf(t1,'coeff'));
            thisTree.SetBranchAddress( 'Signal',AddressOf(t1,'Signal'));
@@ -810,9 +829,18 @@ for iters in range(nIterations):
            thisTree.SetBranchAddress( 'fit_b2',AddressOf(t1,'fit_b2'));
            thisTree.SetBranchAddress( 'fit_b3',AddressOf(t1,'fit_b3'));
            thisTree.SetBranchAddress( 'fit_Bnorm',AddressOf(t1,'fit_Bnorm'));
+           thisTree.SetBranchAddress( 'fit_attempt',AddressOf(t1,'fit_attempt'));
+           # fit outputs made before fit_time existed
+           if thisTree.GetBranch( 'fit_time' ):
+              thisTree.SetBranchAddress( 'fit_time',AddressOf(t1,'fit_time'));
+           else:
+              t1.fit_time = 0.
            for ntre in range(thisTree.GetEntries()):
                thisTree.GetEntry(ntre);
-               if (ntre>=init and ntre<=finit):
+               if (t1.iRegion in fittedRegions):
+                   fittedXtals.append( t1.hashedIndex )
+                   if freezeConverged:
+                       fitRelErrEE[t1.hashedIndex] = coeffRelError( thisTree )
                    t.ix_ = t1.ix
                    t.iy_ = t1.iy
                    t.zside_ = t1.zside
@@ -836,6 +864,9 @@ for iters in range(nIterations):
                    t.fit_b2_ = t1.fit_b2
                    t.fit_b3_ = t1.fit_b3
                    t.fit_Bnorm_ = t1.fit_Bnorm
+                   t.fit_attempt_ = t1.fit_attempt
+                   t.fit_time_ = t1.fit_time
+                   t.iRegion_ = t1.iRegion
                    TreeEE.Fill()
         #TH2
         thisHistoEB = thisfile_f.Get("calibMap_EB")
@@ -843,32 +874,59 @@ for iters in range(nIterations):
         thisHistoEEp = thisfile_f.Get("calibMap_EEp")
         if EEoEB == 0:
            MaxEta = 85
-           Init = int(init)
-           Fin = int(finit+1)
-           for nFitB in range(Init,Fin):
-               if nFitB < 61200:
-                  myRechit = EBDetId( EBDetId.detIdFromDenseIndex(nFitB) )
-                  bin_x = myRechit.ieta()+MaxEta+1
-                  bin_y = myRechit.iphi()
-                  value = thisHistoEB.GetBinContent(bin_x,bin_y)
-                  calibMap_EB.SetBinContent(bin_x,bin_y,value)
+           for nFitB in fittedXtals:
+              myRechit = EBDetId( EBDetId.detIdFromDenseIndex(nFitB) )
+              bin_x = myRechit.ieta()+MaxEta+1
+              bin_y = myRechit.iphi()
+              value = thisHistoEB.GetBinContent(bin_x,bin_y)
+              calibMap_EB.SetBinContent(bin_x,bin_y,value)
         else :
-           Init1 = int(init)
-           Fin1 = int(finit+1)
-           for nFitE in range(Init1,Fin1):
-               if nFitE < 14648:
-                  myRechitE = EEDetId( EEDetId.detIdFromDenseIndex(nFitE) )
-                  if myRechitE.zside() < 0 :
-                     value = thisHistoEEm.GetBinContent(myRechitE.ix(),myRechitE.iy())
-                     calibMap_EEm.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
-                  if myRechitE.zside() > 0 :
-                     value = thisHistoEEp.GetBinContent(myRechitE.ix(),myRechitE.iy())
-                     calibMap_EEp.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
+           for nFitE in fittedXtals:
+              myRechitE = EEDetId( EEDetId.detIdFromDenseIndex(nFitE) )
+              if myRechitE.zside() < 0 :
+                 value = thisHistoEEm.GetBinContent(myRechitE.ix(),myRechitE.iy())
+                 calibMap_EEm.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
+              if myRechitE.zside() > 0 :
+                 value = thisHistoEEp.GetBinContent(myRechitE.ix(),myRechitE.iy())
+                 calibMap_EEp.SetBinContent(myRechitE.ix(),myRechitE.iy(),value)
 
         thisfile_f.Close()
+    if( nativeMerged ):
+        mergedName = os.path.expandvars( f.GetName() )
+        f.Close()
+        os.rename( mergedName + '.native', mergedName )
+        f = TFile( mergedName, 'update' )
+        calibMap_EB = f.Get('calibMap_EB')
+        calibMap_EEm = f.Get('calibMap_EEm')
+        calibMap_EEp = f.Get('calibMap_EEp')
+        if( freezeConverged ):
+            fitRelErrEB, fitRelErrEE = mergedRelErrors( f )
     f.cd()
-    f.Write()
+    if( droppedSubdets ):
+        carryForwardCalibMap( pwd, iters, calibMap_EB, calibMap_EEm, calibMap_EEp, droppedSubdets )
+    # extrapolated constants (and the accel_* diagnostics) go into calibMap.root
+    if( calibAcceleration!='none' and useCalibMapBinary and not isCRAB ):
+        accelerateCalibMap( pwd, iters, calibMap_EB, calibMap_EEm, calibMap_EEp )
+    if( freezeConverged and useCalibMapBinary and not isCRAB ):
+        updateFrozenMap( pwd, iters, calibMap_EB, calibMap_EEm, calibMap_EEp, fitRelErrEB, fitRelErrEE )
+    f.Write('', TObject.kOverwrite)
+    if( useCalibMapBinary and not isCRAB ):
+        print 'Writing ' + calibMapBinaryFile(pwd, iters) + ' for the next iteration'
+        writeCalibMapBinaryFromTH2( calibMapBinaryFile(pwd, iters), iters, calibMap_EB, calibMap_EEm, calibMap_EEp )
+        if( warmStartFits or fastPeakEstimate ):
+            writeFitSeeds( f, fitSeedsFile(pwd, iters) )
     f.Close()
+    if( monitorConvergence and useCalibMapBinary and not isCRAB ):
+        activeNow = activeSubdets( Barrel_or_Endcap, droppedSubdets )
+        converged = convergenceMonitor( pwd, iters, activeNow )
+        if( stopAtConvergence and converged ):
+            if( len(converged)==len(activeNow) ):
+                recordConvergenceDecision( pwd, iters, 'STOP', converged )
+                decisions.append( (iters, 'STOP', converged) )
+                lastIteration = iters
+            else:
+                recordConvergenceDecision( pwd, iters, 'DROP', converged )
+                decisions.append( (iters, 'DROP', converged) )
 
     print 'Now staging calibMap.root on EOS'
     if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
@@ -905,8 +963,13 @@ for iters in range(nIterations):
             output = checkFileAvailability.communicate()[0]
         else:
             break
+    daemonState.submitted( iters, 'merge', 'calibMap', iterDir + NameTag + calibMapName, None )
+    daemonState.finishStage( iters, 'merge' )
 
     print "Done with iteration " + str(iters)
+    if ( lastIteration>=0 and iters>=lastIteration ):
+        print "All subdetectors converged, stopping after iteration " + str(iters)
+        break
     if( ONLYHADD or ONLYFINHADD or ONLYFIT):
        mode = "BATCH_RESU"
        ONLYHADD = False; ONLYFINHADD = False; ONLYFIT=False;
@@ -0,0 +1,131 @@
+import os, sqlite3, subprocess, time
+from parameters import *
+
+# Progress of calibJobHandler.py kept on disk (durableState), in an sqlite file of the work area.
+# Every task of an iteration (fill job, hadd job, final hadd, fit job, merge) goes
+#   submitted -> done | failed
+# each transition in its own transaction, and is also appended to the transitions table. A done task
+# keeps the size and the adler32 checksum (as stored by EOS) of its output. A daemon started again on
+# the same work area skips the iterations and stages already done; in the stage it died in, it only
+# submits the tasks whose output is missing or changed and which are no longer in the batch queue.
+
+minOutputSize = 10000                     # smaller outputs are broken (same threshold as the hadd check)
+
+def daemonStateFile( pwd ):
+    return pwd + '/' + dirname + '/daemonState.db'
+
+def eosListing( directory ):
+    # size and checksum of the files of an EOS directory, by name: one listing and one checksum query
+    # for the whole directory. The checksum is '' if it cannot be had
+    files = dict()
+    listing = subprocess.Popen( ['cmsLs -l ' + directory], stdout=subprocess.PIPE, stderr=subprocess.PIPE, shell=True )
+    for line in listing.communicate()[0].splitlines():
+        words = line.split()
+        if len(words) >= 5 and words[1].isdigit():
+            files[ os.path.basename(words[-1]) ] = ( int(words[1]), '' )
+    checksums = subprocess.Popen( ['eos find --checksum /eos/cms' + directory], stdout=subprocess.PIPE, stderr=subprocess.PIPE, shell=True )
+    for line in checksums.communicate()[0].splitlines():
+        fields = dict( w.split('=', 1) for w in line.split() if '=' in w )
+        name = os.path.basename( fields.get('path', '') )
+        if( name in files and fields.get('checksum') ):
+            files[name] = ( files[name][0], fields['checksum'] )
+    return files
+
+class DaemonState:
+    def __init__( self, fileName, resume ):
+        # fileName None: nothing is recorded and everything is submitted, as without durableState
+        self.resume = resume and fileName is not None
+        self.listings = dict()            # EOS directory -> eosListing, until the next stage
+        self.db = None
+        if fileName is None:
+            return
+        self.db = sqlite3.connect( fileName, timeout=60 )
+        with self.db:
+            self.db.execute( 'CREATE TABLE IF NOT EXISTS tasks ( iteration INTEGER, stage TEXT, name TEXT, state TEXT, jobId TEXT, output TEXT, size INTEGER, checksum TEXT, updated REAL, PRIMARY KEY (iteration, stage, name) )' )
+            self.db.execute( 'CREATE TABLE IF NOT EXISTS stages ( iteration INTEGER, stage TEXT, state TEXT, updated REAL, PRIMARY KEY (iteration, stage) )' )
+            self.db.execute( 'CREATE TABLE IF NOT EXISTS transitions ( iteration INTEGER, stage TEXT, name TEXT, state TEXT, jobId TEXT, time REAL )' )
+        if( self.resume ):
+            last = self.db.execute( "SELECT MAX(iteration) FROM stages WHERE stage='merge' AND state='done'" ).fetchone()[0]
+            if( last is not None ):
+                print '[daemonState] :: resuming from ' + fileName + ': iterations up to ' + str(last) + ' done'
+
+    def setTask( self, iteration, stage, name, state, jobId=None, output=None, info=None ):
+        if self.db is None:
+            return
+        now = time.time()
+        size, checksum = info if info else ( None, None )
+        with self.db:
+            self.db.execute( 'INSERT OR REPLACE INTO tasks VALUES (?,?,?,?,?,?,?,?,?)', (iteration, stage, str(name), state, jobId, output, size, checksum, now) )
+            self.db.execute( 'INSERT INTO transitions VALUES (?,?,?,?,?,?)', (iteration, stage, str(name), state, jobId, now) )
+
+    def setStage( self, iteration, stage, state ):
+        if self.db is None:
+            return
+        now = time.time()
+        with self.db:
+            self.db.execute( 'INSERT OR REPLACE INTO stages VALUES (?,?,?,?)', (iteration, stage, state, now) )
+            self.db.execute( 'INSERT INTO transitions VALUES (?,?,?,?,?,?)', (iteration, stage, '', state, None, now) )
+
+    def stageDone( self, iteration, stage ):
+        if not( self.resume ):
+            return False
+        row = self.db.execute( 'SELECT state FROM stages WHERE iteration=? AND stage=?', (iteration, stage) ).fetchone()
+        return row is not None and row[0] == 'done'
+
+    def startStage( self, iteration, stage ):
+        self.listings = dict()
+        self.setStage( iteration, stage, 'running' )
+
+    def outputInfo( self, output ):
+        directory = os.path.dirname( output )
+        if directory not in self.listings:
+            self.listings[directory] = eosListing( directory )
+        info = self.listings[directory].get( os.path.basename(output) )
+        return info if( info and info[0] >= minOutputSize ) else None
+
+    def toSubmit( self, iteration, stage, name, output, executor ):
+        # False if the task needs no new job: done with its output unchanged on EOS, still in the batch
+        # queue, or finished while no daemon was watching
+        if not( self.resume ):
+            return True
+        row = self.db.execute( 'SELECT state, jobId, size, checksum FROM tasks WHERE iteration=? AND stage=? AND name=?', (iteration, stage, str(name)) ).fetchone()
+        if row is None:
+            return True
+        state, jobId, size, checksum = row
+        what = '[daemonState] :: ' + stage + ' ' + str(name) + ' of iteration ' + str(iteration)
+        if( state == 'submitted' and jobId and executor.alive(jobId) ):
+            print what + ' still running as job ' + jobId
+            executor.track( jobId )
+            return False
+        info = self.outputInfo( output )
+        if( state == 'done' and info and info[0] == size and ( not checksum or not info[1] or info[1] == checksum ) ):
+            print what + ' already done'
+            return False
+        if( state == 'submitted' and info ):
+            print what + ' finished while the daemon was down'
+            self.setTask( iteration, stage, name, 'done', jobId, output, info )
+            return False
+        if( state == 'done' ):
+            print what + ': output missing or changed, submitting it again'
+        return True
+
+    def submitted( self, iteration, stage, name, output, jobId ):
+        self.setTask( iteration, stage, name, 'submitted', jobId, output )
+
+    def finishStage( self, iteration, stage ):
+        # after the wait: the submitted tasks are done if their output is on EOS, failed otherwise. The
+        # stage is done if none failed; a daemon started again redoes the failed ones. Returns the failed
+        if self.db is None:
+            return []
+        self.listings = dict()
+        rows = self.db.execute( "SELECT name, jobId, output FROM tasks WHERE iteration=? AND stage=? AND state IN ('submitted','failed')", (iteration, stage) ).fetchall()
+        failed = list()
+        for name, jobId, output in rows:
+            info = self.outputInfo( output )
+            self.setTask( iteration, stage, name, 'done' if info else 'failed', jobId, output, info )
+            if not( info ):
+                failed.append( name )
+        self.setStage( iteration, stage, 'incomplete' if failed else 'done' )
+        if( failed ):
+            print '[daemonState] :: ' + stage + ' of iteration ' + str(iteration) + ': no output for ' + str(len(failed)) + ' tasks (' + ' '.join( failed[:10] ) + ( ' ...' if len(failed) > 10 else '' ) + ')'
+        return failed
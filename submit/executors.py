@@ -0,0 +1,193 @@
+import os, re, subprocess, time, socket
+from parameters import *
+from workQueue import startCoordinator, newToken
+
+# Where the daemon runs the fill, hadd and fit job scripts written by methods.py. Both executors take
+# the same scripts: submit() queues one, wait() returns when all the submitted ones are done.
+# submit() returns the batch job id (None if the job does not outlive the daemon), alive() tells if that
+# job is still in the queue (daemonState.py, a daemon started again), track() makes wait() also wait for
+# such a job
+
+activeStates = ('PEND', 'RUN', 'PSUSP', 'USUSP', 'SSUSP')
+
+class BatchExecutor:
+    # bsub (qsub at IIHE) with the command built by the daemon. wait() polls the jobs of this daemon by id,
+    # so that other daemons in the same queue (pipelineSubdets) do not hold it. Without job ids (qsub)
+    # the queue is polled until only the daemon itself is left in it (less than num lines of bjobs/qstat)
+    def __init__( self, queue, num ):
+        self.queue = queue
+        self.num = num
+        self.jobIds = list()
+        self.anonymous = False
+
+    def submit( self, script, log, command, pause=1 ):
+        print command
+        output = subprocess.Popen( [command], stdout=subprocess.PIPE, shell=True ).communicate()
+        print "Out: " + str(output)
+        # avoid overlapping submission
+        time.sleep( pause )
+        jobId = re.search( 'Job <([0-9]+)>', str(output[0]) )
+        self.track( jobId.group(1) if jobId else None )
+        return jobId.group(1) if jobId else None
+
+    def track( self, jobId ):
+        if( jobId ):
+            self.jobIds.append( jobId )
+        else:
+            self.anonymous = True
+
+    def running( self, jobIds ):
+        # the jobs of jobIds still in the queue, a few hundred per bjobs call
+        still = list()
+        for first in range( 0, len(jobIds), 500 ):
+            chunk = jobIds[first:first+500]
+            checkJobs = subprocess.Popen( ['bjobs ' + ' '.join(chunk)], stdout=subprocess.PIPE, stderr=subprocess.PIPE, shell=True )
+            for line in (checkJobs.communicate()[0]).splitlines():
+                words = line.split()
+                if( len(words) > 2 and words[0] in chunk and words[2] in activeStates ):
+                    still.append( words[0] )
+        return still
+
+    def alive( self, jobId ):
+        return len( self.running( [jobId] ) ) > 0
+
+    def jobLines( self ):
+        if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
+            checkJobs = subprocess.Popen( ['qstat -u $USER localgrid@cream02'], stdout=subprocess.PIPE, shell=True )
+        else:
+            checkJobs = subprocess.Popen( ['bjobs -q ' + self.queue], stdout=subprocess.PIPE, shell=True )
+        return (checkJobs.communicate()[0]).splitlines()
+
+    def wait( self, poll=10, callback=None ):
+        if( self.anonymous ):
+            while len( self.jobLines() ) >= self.num:
+                time.sleep( poll )
+                if( callback ):
+                    callback()
+        else:
+            while True:
+                self.jobIds = self.running( self.jobIds )
+                if not( self.jobIds ):
+                    break
+                time.sleep( poll )
+                if( callback ):
+                    callback()
+        self.jobIds = list()
+        self.anonymous = False
+
+class LocalExecutor:
+    # The scripts run on this machine, at most nSlots at a time, each pinned (taskset) to its share of the
+    # cores. A finished script is replaced at once: no queue dispatch, no polling interval
+    def __init__( self, nSlots, pinCpus ):
+        import multiprocessing
+        nCpus = multiprocessing.cpu_count()
+        self.nSlots = nSlots if nSlots > 0 else nCpus
+        self.cpuSets = list()
+        for slot in range( self.nSlots ):
+            cores = [ c for c in range(nCpus) if c * self.nSlots / nCpus == slot ]
+            self.cpuSets.append( ','.join( str(c) for c in cores ) if pinCpus and cores else None )
+        self.pending = list()
+
+    def submit( self, script, log, command=None, pause=0 ):
+        print '[LocalExecutor] queued ' + script
+        self.pending.append( (script, log) )
+        return None
+
+    def alive( self, jobId ):
+        return False
+
+    def track( self, jobId ):
+        pass
+
+    def start( self, slot, script, log ):
+        command = [ 'bash', script ]
+        if( self.cpuSets[slot] ):
+            command = [ 'taskset', '-c', self.cpuSets[slot] ] + command
+        out = open( log if log else os.devnull, 'w' )
+        return ( subprocess.Popen( command, stdout=out, stderr=subprocess.STDOUT ), script, out )
+
+    def wait( self, poll=10, callback=None ):
+        running = dict()
+        lastCallback = time.time()
+        while( self.pending or running ):
+            for slot in range( self.nSlots ):
+                if( slot in running ):
+                    process, script, out = running[slot]
+                    if( process.poll() is None ):
+                        continue
+                    out.close()
+                    if( process.returncode != 0 ):
+                        print '[LocalExecutor] ' + script + ' exited with ' + str(process.returncode)
+                    del running[slot]
+                if( self.pending ):
+                    script, log = self.pending.pop(0)
+                    running[slot] = self.start( slot, script, log )
+            time.sleep( 0.2 )
+            if( callback and time.time() - lastCallback >= poll ):
+                lastCallback = time.time()
+                callback()
+
+class WorkQueueExecutor:
+    # The submitted scripts are not sent one by one: wait() serves them from a coordinator (workQueue.py)
+    # and sends nWorkers workers through the inner executor, each pulling scripts until none is left.
+    # Workers lost with units still open are replaced, up to 3 rounds. The coordinator listens on the
+    # address of workQueueHost only and answers only requests with the token of this campaign
+    def __init__( self, inner, nWorkers, workDir ):
+        self.inner = inner
+        self.nWorkers = nWorkers
+        self.workDir = workDir
+        self.units = list()
+        self.nRounds = 0
+        self.tokenFile = workDir + '/workQueue.token'
+        self.token = newToken( self.tokenFile )
+
+    def submit( self, script, log, command=None, pause=0 ):
+        self.units.append( (script, log) )
+        return None
+
+    def alive( self, jobId ):
+        return False
+
+    def track( self, jobId ):
+        pass
+
+    def wait( self, poll=10, callback=None ):
+        if not( self.units ):
+            return
+        host = workQueueHost if workQueueHost else socket.getfqdn()
+        server = startCoordinator( self.units, workQueueLease, workQueueRetries, socket.gethostbyname( host ), self.token )
+        coordinator = server.coordinator
+        port = server.server_address[1]
+        print '[workQueue] :: ' + str(len(self.units)) + ' units served on ' + host + ':' + str(port)
+        for round in range(3):
+            for iW in range( min( self.nWorkers, coordinator.remaining() ) ):
+                name = 'worker_' + str(self.nRounds) + '_' + str(iW)
+                script = self.workDir + '/src/workQueue_' + name + '.sh'
+                log = self.workDir + '/log/workQueue_' + name + '.log'
+                script_f = open( script, 'w' )
+                script_f.write( '#!/bin/bash\n' )
+                script_f.write( 'cd ' + os.getcwd() + '\n' )
+                script_f.write( 'python workQueue.py ' + host + ' ' + str(port) + ' ' + name + ' ' + self.tokenFile + '\n' )
+                script_f.close()
+                self.inner.submit( script, log, 'bsub -q ' + self.inner.queue + ' -o ' + log + ' bash ' + script if isinstance(self.inner, BatchExecutor) else None )
+            self.nRounds += 1
+            self.inner.wait( poll, callback )
+            if( coordinator.finished() or round==2 ):
+                break
+            print '[workQueue] :: ' + str(coordinator.remaining()) + ' units left after the workers ended, sending new ones'
+        if not( coordinator.finished() ):
+            print '[workQueue] :: ' + str(coordinator.remaining()) + ' units never completed'
+        for script in coordinator.failed:
+            print '[workQueue] :: failed: ' + script
+        server.shutdown()
+        server.server_close()
+        self.units = list()
+
+def makeExecutor( queue, num=2, workDir=None ):
+    if( executor == 'local' ):
+        inner = LocalExecutor( localSlots, localPinCpus )
+    else:
+        inner = BatchExecutor( queue, num )
+    if( workQueue and workDir ):
+        return WorkQueueExecutor( inner, inner.nSlots if executor == 'local' else workQueueWorkers, workDir )
+    return inner
@@ -1,4 +1,686 @@
+import os
 from parameters import *
+
+def calibMapBinaryFile( pwd, iteration ):
+    return pwd + "/" + dirname + "/calibMaps/" + NameTag + "iter_" + str(iteration) + "_" + calibMapBinName
+
+def writeCalibMapBinary( fileName, iteration, valuesEB, valuesEE ):
+    # Same layout as CalibTools/interface/EcalCalibMapBinary.h: header + float[61200] EB + float[14648] EE, by hashed index
+    import struct, array
+    payload = array.array('f', valuesEB)
+    payload.extend( valuesEE )
+    data = payload.tostring()
+    checksum = 2166136261
+    for c in data:
+        checksum = ((checksum ^ ord(c)) * 16777619) & 0xFFFFFFFF
+    header = struct.pack('<IIiIII', 0x4D435045, 1, iteration, len(valuesEB), len(valuesEE), checksum)
+    out = open(fileName + '.tmp', 'wb')
+    out.write(header)
+    out.write(data)
+    out.close()
+    os.rename(fileName + '.tmp', fileName)
+
+def writeCalibMapBinaryFromTH2( fileName, iteration, calibMap_EB, calibMap_EEm, calibMap_EEp ):
+    # Reads the merged calibMap_EB/EEm/EEp TH2F with the binning used by EcalCalibMap::loadCalibMapFromFile
+    values = [ histo.GetBinContent(bx, by) for histo, bx, by in calibMapBins(calibMap_EB, calibMap_EEm, calibMap_EEp) ]
+    valuesEB = values[:61200]; valuesEE = values[61200:]
+    if not os.path.isdir( os.path.dirname(fileName) ):
+        os.makedirs( os.path.dirname(fileName) )
+    writeCalibMapBinary( fileName, iteration, valuesEB, valuesEE )
+
+def fitSeedsFile( pwd, iteration ):
+    # local copy of the calibEB/calibEE fit trees, read by WarmStartFits/FastPeakEstimate instead of calibMap.root on EOS
+    return pwd + "/" + dirname + "/calibMaps/" + NameTag + "iter_" + str(iteration) + "_fitSeeds.root"
+
+def writeFitSeeds( mergedFile, fileName ):
+    # copies the calibEB/calibEE trees of the merged calibMap (already open in the daemon) next to the binary map
+    from ROOT import TFile
+    out = TFile.Open( fileName + '.tmp', 'RECREATE' )
+    for name in ( 'calibEB', 'calibEE' ):
+        tree = mergedFile.Get( name )
+        if( tree ):
+            out.cd()
+            tree.CloneTree( -1 ).Write()
+    out.Close()
+    os.rename( fileName + '.tmp', fileName )
+
+def readCalibMapBinary( fileName ):
+    # Inverse of writeCalibMapBinary: (iteration, valuesEB, valuesEE), or None if the file is missing or invalid
+    import struct, array
+    if not os.path.isfile(fileName):
+        return None
+    data = open(fileName, 'rb').read()
+    if len(data) < 24:
+        return None
+    magic, version, iteration, nEB, nEE, checksum = struct.unpack('<IIiIII', data[:24])
+    if magic != 0x4D435045 or version != 1 or len(data) != 24 + 4*(nEB+nEE):
+        return None
+    values = array.array('f')
+    values.fromstring( data[24:] )
+    return ( iteration, values[:nEB], values[nEB:] )
+
+_calibMapBins = list()
+def calibMapBins( calibMap_EB, calibMap_EEm, calibMap_EEp ):
+    # (histogram, binx, biny) of each crystal, EB then EE, in the order of the binary calibMap. The
+    # (0=EB 1=EE- 2=EE+, binx, biny) of the DetIds are only computed once per process
+    from ROOT import EBDetId, EEDetId
+    if len(_calibMapBins) == 0:
+        for nFitB in range(61200):
+            myRechit = EBDetId( EBDetId.detIdFromDenseIndex(nFitB) )
+            _calibMapBins.append( (0, myRechit.ieta()+85+1, myRechit.iphi()) )
+        for nFitE in range(14648):
+            myRechitE = EEDetId( EEDetId.detIdFromDenseIndex(nFitE) )
+            _calibMapBins.append( (1 if myRechitE.zside() < 0 else 2, myRechitE.ix(), myRechitE.iy()) )
+    histos = ( calibMap_EB, calibMap_EEm, calibMap_EEp )
+    return [ (histos[h], bx, by) for h, bx, by in _calibMapBins ]
+
+def accelerateCalibMap( pwd, iteration, calibMap_EB, calibMap_EEm, calibMap_EEp ):
+    # Extrapolates the merged coefficients of this iteration (in place) from the binary calibMaps of the
+    # previous ones, in log space. The calibEB/calibEE trees keep the fitted (not extrapolated) coefficients.
+    #  'overrelax': c = c_prev * (c_fit/c_prev)^calibOverRelaxation
+    #  'aitken'   : on even iterations, from the last two plain steps a=log(c_prev/c_prev2), b=log(c_fit/c_prev):
+    #               rho = b/a, c = c_fit * exp(b*rho/(1-rho)), only for 0 < rho < calibAitkenMaxRho.
+    #               Odd iterations are plain, so that the two steps used are never extrapolated ones.
+    # Crystals whose step is larger than calibAccelMaxStep (not yet in the linear regime) or not fitted are left alone.
+    import math
+    from ROOT import TH1F
+    if calibAcceleration not in ('overrelax', 'aitken'):
+        return
+    if calibAcceleration == 'aitken' and ( iteration < 2 or iteration % 2 != 0 ):
+        print '[Acceleration] iteration ' + str(iteration) + ': plain step'
+        return
+    prev = readCalibMapBinary( calibMapBinaryFile(pwd, iteration-1) ) if iteration >= 1 else None
+    prev2 = readCalibMapBinary( calibMapBinaryFile(pwd, iteration-2) ) if calibAcceleration == 'aitken' else None
+    if prev is None or ( calibAcceleration == 'aitken' and prev2 is None ):
+        print '[Acceleration] iteration ' + str(iteration) + ': previous binary calibMaps not available, plain step'
+        return
+    cPrev = list(prev[1]) + list(prev[2])
+    cPrev2 = list(prev2[1]) + list(prev2[2]) if prev2 else None
+
+    hStep = TH1F('accel_step', 'log(c_{fit}/c_{prev});log step;crystals', 200, -0.05, 0.05)
+    hGain = TH1F('accel_gain', 'extrapolated / fitted log step;ratio;crystals', 100, 0., 10.)
+    nAccel = 0; nSkipped = 0; sumFit = 0.; sumNew = 0.
+    for i, (histo, bx, by) in enumerate( calibMapBins(calibMap_EB, calibMap_EEm, calibMap_EEp) ):
+        c = histo.GetBinContent(bx, by)
+        if c <= 0. or cPrev[i] <= 0.:
+            continue
+        b = math.log( c/cPrev[i] )
+        if b == 0.:
+            continue
+        hStep.Fill(b)
+        sumFit += abs(b)
+        newStep = b
+        if abs(b) <= calibAccelMaxStep:
+            if calibAcceleration == 'overrelax':
+                newStep = calibOverRelaxation*b
+            elif cPrev2[i] > 0.:
+                a = math.log( cPrev[i]/cPrev2[i] )
+                rho = b/a if a != 0. else 0.
+                if 0. < rho < calibAitkenMaxRho:
+                    newStep = b + b*rho/(1.-rho)
+        if newStep != b:
+            nAccel += 1
+            hGain.Fill( newStep/b )
+            histo.SetBinContent( bx, by, cPrev[i]*math.exp(newStep) )
+        else:
+            nSkipped += 1
+        sumNew += abs(newStep)
+    nSteps = nAccel + nSkipped
+    print '[Acceleration] iteration ' + str(iteration) + ' (' + calibAcceleration + '): ' + str(nAccel) + ' crystals extrapolated, ' + str(nSkipped) + ' plain'
+    if nSteps > 0:
+        print '[Acceleration]   mean |log step| fitted: ' + str(sumFit/nSteps) + ' applied: ' + str(sumNew/nSteps)
+
+def nativeMergeCalibMap( outFile, fitOutputs ):
+    # Merge with the compiled mergeCalibMaps (CalibTools/bin). Returns False, leaving the merge to the
+    # PyROOT loop, if it is not available, cannot read an output or the outputs do not cover every region
+    import subprocess
+    outFile = os.path.expandvars( outFile )
+    listFile = outFile + '.fitOutputs.list'
+    out = open( listFile, 'w' )
+    for fitOutput in fitOutputs:
+        out.write( fitOutput.rstrip() + '\n' )
+    out.close()
+    command = ' '.join( ['mergeCalibMaps', outFile, listFile, str(nRegionsEB()), str(nRegionsEE()), str(nativeMergeThreads)] )
+    print command
+    merge = subprocess.Popen( [command], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, shell=True )
+    print merge.communicate()[0]
+    os.remove( listFile )
+    if merge.returncode != 0:
+        print 'mergeCalibMaps failed (' + str(merge.returncode) + '), merging with PyROOT'
+        return False
+    return os.path.isfile( outFile )
+
+def mergedRelErrors( mergedFile ):
+    # coeffRelError of every crystal of the merged calibEB/calibEE trees, by hashed index
+    relErr = list()
+    for treeName in ['calibEB', 'calibEE']:
+        errors = dict()
+        tree = mergedFile.Get( treeName )
+        if tree and tree.GetEntries() > 0:
+            n = tree.Draw( 'hashedIndex_:fit_mean_:fit_mean_err_', '', 'goff' )
+            for i in range(n):
+                errors[ int(tree.GetV1()[i]) ] = massFitRelError( tree.GetV2()[i], tree.GetV3()[i] )
+        relErr.append( errors )
+    return relErr[0], relErr[1]
+
+def frozenMapFile( pwd, iteration ):
+    # per-crystal count of consecutive converged iterations, same layout as the binary calibMap
+    return pwd + "/" + dirname + "/calibMaps/" + NameTag + "iter_" + str(iteration) + "_frozen.bin"
+
+def massFitRelError( mean, err ):
+    # relative error on the coefficient from the mass fit, as FitEpsilonPlot updates it:
+    # c -> c/(1+eps), eps = (m^2/M^2-1)/2, so dc/c = 2*m*dm/(M^2+m^2). Only the mass fit (RooFit) gives
+    # fit_mean_err: the epsilon fit and FastPeakEstimate leave it 0, and those crystals never converge
+    M = 0.1349 if Are_pi0 else 0.5479     # PI0MASS, ETAMASS of EcalRegionalCalibration.h
+    if mean <= 0. or err <= 0.:
+        return -1.
+    return 2.*mean*err/(M*M + mean*mean)
+
+def coeffRelError( tree ):
+    # massFitRelError of the current tree entry. Read through the leaves, the fit output has float branches
+    return massFitRelError( tree.GetLeaf('fit_mean').GetValue(), tree.GetLeaf('fit_mean_err').GetValue() )
+
+def updateFrozenMap( pwd, iteration, calibMap_EB, calibMap_EEm, calibMap_EEp, relErrEB, relErrEE ):
+    # A crystal converges in this iteration if its coefficient moved by less than freezeMaxStep (relative)
+    # and its fit error is below freezeMaxRelErr. After freezeAfter consecutive converged iterations it is
+    # frozen: Fill/Fit skip it and its coefficient is carried forward, so it stays frozen from then on.
+    import math
+    prev = readCalibMapBinary( calibMapBinaryFile(pwd, iteration-1) ) if iteration >= 1 else None
+    if prev is None:
+        print '[Freeze] iteration ' + str(iteration) + ': previous binary calibMap not available, nothing frozen'
+        return
+    counts = readCalibMapBinary( frozenMapFile(pwd, iteration-1) )
+    cPrev = list(prev[1]) + list(prev[2])
+    nPrev = list(counts[1]) + list(counts[2]) if counts else [0.]*len(cPrev)
+    relErr = [ relErrEB.get(h, -1.) for h in range(61200) ] + [ relErrEE.get(h, -1.) for h in range(14648) ]
+    newCounts = list()
+    nFrozen = 0; nNew = 0
+    for i, (histo, bx, by) in enumerate( calibMapBins(calibMap_EB, calibMap_EEm, calibMap_EEp) ):
+        n = nPrev[i]
+        if n < freezeAfter:
+            c = histo.GetBinContent(bx, by)
+            converged = c > 0. and cPrev[i] > 0. and abs(c/cPrev[i]-1.) < freezeMaxStep and 0. < relErr[i] < freezeMaxRelErr
+            n = n+1 if converged else 0
+            if n >= freezeAfter:
+                nNew += 1
+        if n >= freezeAfter:
+            nFrozen += 1
+        newCounts.append( n )
+    writeCalibMapBinary( frozenMapFile(pwd, iteration), iteration, newCounts[:61200], newCounts[61200:] )
+    print '[Freeze] iteration ' + str(iteration) + ': ' + str(nFrozen) + ' crystals frozen (' + str(nNew) + ' new), ' + str(len(newCounts)-nFrozen) + ' still moving'
+
+def convergenceLogFile( pwd ):
+    return pwd + "/" + dirname + "/" + NameTag + "convergence.log"
+
+convergenceRegionNames = [ 'EB |ieta| 1-25', 'EB |ieta| 26-45', 'EB |ieta| 46-65', 'EB |ieta| 66-85',
+                           'EE inner', 'EE middle', 'EE outer' ]
+_convergenceRegionOf = list()
+def convergenceRegionOf():
+    # region of each crystal (EB hashed indices, then EE): EB modules in |ieta|, EE rings in distance from the beam
+    from ROOT import EBDetId, EEDetId
+    import math
+    if len(_convergenceRegionOf) == 0:
+        for nFitB in range(61200):
+            ieta = abs( EBDetId( EBDetId.detIdFromDenseIndex(nFitB) ).ieta() )
+            _convergenceRegionOf.append( 0 if ieta <= 25 else 1 if ieta <= 45 else 2 if ieta <= 65 else 3 )
+        for nFitE in range(14648):
+            myRechitE = EEDetId( EEDetId.detIdFromDenseIndex(nFitE) )
+            r = math.sqrt( (myRechitE.ix()-50.5)**2 + (myRechitE.iy()-50.5)**2 )
+            _convergenceRegionOf.append( 4 if r < 25. else 5 if r < 38. else 6 )
+    return _convergenceRegionOf
+
+def icRatioSpread( cNew, cOld, frozen=None ):
+    # RMS of IC(n)/IC(n-1)-1 per convergence region, with the selection of AfterCalibTools/TestConvergence/Convergence.C
+    # (crystals not fitted or not moved are skipped). frozen: per-crystal flags of the crystals frozen during
+    # the iteration (freezeConverged), skipped as well. Returns [ (nCrystals, rms, allFrozen) ] by region,
+    # allFrozen if the region has frozen crystals and every other one has no coefficient (0 or 1)
+    import math
+    regionOf = convergenceRegionOf()
+    n = [0]*len(convergenceRegionNames); sum2 = [0.]*len(convergenceRegionNames)
+    nFrozen = [0]*len(n); nOther = [0]*len(n)
+    for i in range(len(cNew)):
+        if frozen and frozen[i]:
+            nFrozen[regionOf[i]] += 1
+            continue
+        if cNew[i] != 1. and cNew[i] != 0.:
+            nOther[regionOf[i]] += 1
+        if cNew[i] == 1. or cOld[i] == 1. or cNew[i] == cOld[i] or cNew[i] == 0. or cOld[i] == 0.:
+            continue
+        d = cNew[i]/cOld[i] - 1.
+        n[regionOf[i]] += 1
+        sum2[regionOf[i]] += d*d
+    return [ (n[r], math.sqrt(sum2[r]/n[r]) if n[r] > 0 else 0., nFrozen[r] > 0 and nOther[r] == 0) for r in range(len(n)) ]
+
+def convergenceMonitor( pwd, iteration, subdets ):
+    # After the merge of 'iteration' (its binary calibMap written): spread of the IC ratio to the previous
+    # iteration per region, for the last convergenceIterations iterations. A subdetector (in subdets, 'EB'/'EE')
+    # has converged when all its regions were below convergenceMaxRMS_EB/EE in each of them.
+    # Everything is appended to convergenceLogFile. Returns the converged subdetectors
+    maxRMS = { 'EB' : convergenceMaxRMS_EB, 'EE' : convergenceMaxRMS_EE }
+    log = open( convergenceLogFile(pwd), 'a' )
+    below = dict( (sd, True) for sd in subdets )
+    for it in range(iteration, iteration-convergenceIterations, -1):
+        new = readCalibMapBinary( calibMapBinaryFile(pwd, it) ) if it >= 1 else None
+        old = readCalibMapBinary( calibMapBinaryFile(pwd, it-1) ) if it >= 1 else None
+        if new is None or old is None:
+            below = dict( (sd, False) for sd in subdets )
+            break
+        # crystals frozen during iteration it: their counts in the frozen map written at the merge of it-1
+        counts = readCalibMapBinary( frozenMapFile(pwd, it-1) ) if freezeConverged else None
+        frozen = [ c >= freezeAfter for c in list(counts[1]) + list(counts[2]) ] if counts else None
+        spread = icRatioSpread( list(new[1]) + list(new[2]), list(old[1]) + list(old[2]), frozen )
+        for r, (n, rms, allFrozen) in enumerate(spread):
+            sd = convergenceRegionNames[r][:2]
+            if sd not in subdets:
+                continue
+            # a region with every crystal frozen has converged; no crystal to compare otherwise
+            # (all fits failed) is not convergence
+            if not allFrozen and (n == 0 or rms >= maxRMS[sd]):
+                below[sd] = False
+            if it == iteration:
+                line = 'iter ' + str(iteration) + ' ' + convergenceRegionNames[r] + ': ' + ( 'all crystals frozen' if allFrozen else str(n) + ' crystals, rms(IC ratio - 1) = ' + str(rms) )
+                print '[Convergence] ' + line
+                log.write( line + '\n' )
+    converged = [ sd for sd in subdets if below[sd] ]
+    line = 'iter ' + str(iteration) + ' converged (' + str(convergenceIterations) + ' iterations below threshold): ' + ( ' '.join(converged) if converged else 'none' )
+    print '[Convergence] ' + line
+    log.write( line + '\n' )
+    log.close()
+    return converged
+
+def recordConvergenceDecision( pwd, iteration, decision, subdets ):
+    # decision is 'STOP' or 'DROP'; read back by convergenceDecisions when the daemon is restarted
+    log = open( convergenceLogFile(pwd), 'a' )
+    log.write( 'DECISION iter ' + str(iteration) + ' ' + decision + ' ' + ' '.join(subdets) + '\n' )
+    log.close()
+    print '[Convergence] decision after iteration ' + str(iteration) + ': ' + decision + ' ' + ' '.join(subdets)
+
+def convergenceDecisions( pwd ):
+    # decisions recorded by previous runs of the daemon: [ (iteration, 'STOP' or 'DROP', subdets) ]
+    decisions = list()
+    if os.path.isfile( convergenceLogFile(pwd) ):
+        for line in open( convergenceLogFile(pwd) ):
+            words = line.split()
+            if len(words) < 4 or words[0] != 'DECISION':
+                continue
+            decisions.append( (int(words[2]), words[3], words[4:]) )
+    return decisions
+
+def droppedSubdetsAt( decisions, iteration ):
+    # subdetectors not iterated in 'iteration': dropped after an earlier iteration. A re-run of the
+    # iteration that dropped them (restart, resubmission) still fits them
+    dropped = list()
+    for it, decision, subdets in decisions:
+        if decision == 'DROP' and it < iteration:
+            dropped += [ sd for sd in subdets if sd not in dropped ]
+    return dropped
+
+def stopIteration( decisions ):
+    # last iteration to be run (-1 = no stop)
+    stops = [ it for it, decision, subdets in decisions if decision == 'STOP' ]
+    return min(stops) if stops else -1
+
+def activeSubdets( BarrelOrEndcap, dropped ):
+    subdets = { 'ONLY_BARREL' : ['EB'], 'ONLY_ENDCAP' : ['EE'], 'ALL_PLEASE' : ['EB', 'EE'] }[BarrelOrEndcap]
+    return [ sd for sd in subdets if sd not in dropped ]
+
+def carryForwardCalibMap( pwd, iteration, calibMap_EB, calibMap_EEm, calibMap_EEp, subdets ):
+    # coefficients of subdetectors no longer iterated: copied from the previous iteration
+    prev = readCalibMapBinary( calibMapBinaryFile(pwd, iteration-1) )
+    if prev is None:
+        print '[Convergence] cannot carry ' + ' '.join(subdets) + ' forward: ' + calibMapBinaryFile(pwd, iteration-1) + ' not available'
+        return
+    cPrev = list(prev[1]) + list(prev[2])
+    for i, (histo, bx, by) in enumerate( calibMapBins(calibMap_EB, calibMap_EEm, calibMap_EEp) ):
+        if ( 'EB' if i < 61200 else 'EE' ) in subdets:
+            histo.SetBinContent( bx, by, cPrev[i] )
+
+def nRegionsEB():
+    # Same as EcalCalibType::<CalibType>::nRegions in CalibTools/interface/EcalCalibTypes.h
+    return { 'xtal' : 61200, 'tt' : 2448, 'etaring' : 170 }[CalibType]
+
+def nRegionsEE():
+    # Same as EcalCalibType::<CalibType>::nRegionsEE (tt = 5x5 supercrystals in EE)
+    return { 'xtal' : 14648, 'tt' : 632, 'etaring' : 78 }[CalibType]
+
+def nFitJobs( nRegions ):
+    # each fit job covers nFit regions
+    return (nRegions + nFit - 1)/nFit
+
+def fitRegionCosts( iteration, isEE, nRegions ):
+    # Expected cost of the fit of each region, from the fits of the previous iteration (same data: the
+    # same regions below the integral threshold, about the same retries): the seconds spent on the region
+    # (fit_time_), or for calibMaps without it 1 + the retry step of regions with a fit and 0 for the
+    # others. Every region costs at least 1% of the average (loading its histogram). None if the merged
+    # calibMap of the previous iteration cannot be read
+    from ROOT import TFile
+    f = TFile.Open( 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iteration-1) + '/' + NameTag + calibMapName )
+    if not( f ) or f.IsZombie():
+        return None
+    tree = f.Get( 'calibEE' if isEE else 'calibEB' )
+    if not( tree ) or not( tree.GetBranch('iRegion_') ):
+        f.Close()
+        return None
+    hasTime = bool( tree.GetBranch('fit_time_') )
+    nEntries = int( tree.GetEntries() )
+    tree.SetEstimate( nEntries + 1 )
+    tree.Draw( 'iRegion_:Signal_+Backgr_:fit_attempt_:' + ('fit_time_' if hasTime else '0'), '', 'goff' )
+    iRegion, integral, attempt, seconds = tree.GetV1(), tree.GetV2(), tree.GetV3(), tree.GetV4()
+    costs = [ None for iR in range(nRegions) ]
+    for i in range( nEntries ):
+        iR = int( iRegion[i] )
+        if( iR < 0 or iR >= nRegions or costs[iR] is not None ):
+            continue
+        if( hasTime ):
+            costs[iR] = seconds[i]
+        else:
+            costs[iR] = ( 1. + attempt[i] ) if integral[i] > 0 else 0.
+    f.Close()
+    known = [ c for c in costs if c is not None ]
+    average = sum(known)/len(known) if known and sum(known) > 0 else 1.
+    return [ max( 0.01*average, c if c is not None else average ) for c in costs ]
+
+def fitJobPartition( costs, nJobs ):
+    # regions by decreasing cost, each into the currently cheapest job; the regions of a job are sorted
+    import heapq
+    jobs = [ list() for i in range(nJobs) ]
+    loads = [ 0. for i in range(nJobs) ]
+    heap = [ (0., i) for i in range(nJobs) ]
+    for iR in sorted( range(len(costs)), key=lambda iR: -costs[iR] ):
+        load, ijob = heapq.heappop( heap )
+        jobs[ijob].append( iR )
+        loads[ijob] = load + costs[iR]
+        heapq.heappush( heap, (loads[ijob], ijob) )
+    return [ sorted(job) for job in jobs ], loads
+
+def printFitCfgRegions( outputfile, regions ):
+    outputfile.write("#FIT_REGIONS_APPENDED\n")
+    outputfile.write("fitRegions = [" + ",".join( str(iR) for iR in regions ) + "]\n")
+    outputfile.write("process.fitEpsilon.FitRegions = cms.untracked.vint32( *fitRegions )\n")
+
+def balanceFitCfgs( iteration, EBorEE, cfgNames ):
+    # balanceFitJobs: the fit cfgs of the iteration (made by submitCalibration.py on the nFit ranges) get
+    # the region lists of fitJobPartition, from the costs of the previous iteration. Nothing changes for
+    # the first iteration or if the previous calibMap has no iRegion_
+    if not( balanceFitJobs ) or iteration == 0 or not( cfgNames ):
+        return
+    isEE = ( EBorEE == 'Endcap' )
+    nRegions = nRegionsEE() if isEE else nRegionsEB()
+    costs = fitRegionCosts( iteration, isEE, nRegions )
+    if costs is None:
+        print '[calib] ' + EBorEE + ' fit jobs: no region costs from iteration ' + str(iteration-1) + ', keeping the ranges of ' + str(nFit) + ' regions'
+        return
+    jobs, loads = fitJobPartition( costs, len(cfgNames) )
+    ranges = [ sum( costs[i:i+nFit] ) for i in range(0, nRegions, nFit) ]
+    print '[calib] ' + EBorEE + ' fit jobs balanced on the fits of iteration ' + str(iteration-1) + ': cost ' + str(round(min(loads),1)) + ' to ' + str(round(max(loads),1)) + ' per job (' + str(round(max(ranges),1)) + ' for the longest range of ' + str(nFit) + ')'
+    for cfgName, regions in zip( cfgNames, jobs ):
+        # already there if the daemon was restarted: the partition is the same
+        if( '#FIT_REGIONS_APPENDED' in open(cfgName).read() ):
+            continue
+        cfg = open( cfgName, 'a' )
+        printFitCfgRegions( cfg, regions )
+        cfg.close()
+
+def eventCountsFile( pwd ):
+    return pwd + '/' + dirname + '/eventCounts.txt'
+
+def fillJobsFile( pwd ):
+    return pwd + '/' + dirname + '/fillJobs.txt'
+
+def jsonLumis( pwd ):
+    # run -> list of [first,last] lumi ranges of json_file
+    import json
+    lumis = json.load( open( pwd + '/../../CalibCode/FillEpsilonPlot/data/' + json_file ) )
+    return dict( (int(run), ranges) for run, ranges in lumis.items() )
+
+def countEvents( fileName, lumis ):
+    # events of the file, and those in the json lumis (the same if lumis is None); -1 if it cannot be read
+    from ROOT import TFile
+    url = ('root://eoscms//eos/cms' + fileName) if fileName.startswith('/store/') else fileName
+    f = TFile.Open( url )
+    if not( f ) or f.IsZombie():
+        return -1, -1
+    tree = f.Get('Events')
+    nAll = int( tree.GetEntries() ) if tree else -1
+    nJSON = nAll
+    if( tree and lumis is not None and nAll > 0 ):
+        tree.SetEstimate( nAll + 1 )
+        if( tree.Draw( 'EventAuxiliary.id_.run_:EventAuxiliary.id_.luminosityBlock_', '', 'goff' ) == nAll ):
+            runs, lumiBlocks = tree.GetV1(), tree.GetV2()
+            nJSON = 0
+            for i in range( nAll ):
+                for first, last in lumis.get( int(runs[i]), [] ):
+                    if( first <= lumiBlocks[i] <= last ):
+                        nJSON += 1
+                        break
+    f.Close()
+    return nAll, nJSON
+
+def inputIndexFile( inputList ):
+    return inputList + '.index'
+
+def scanInputFile( fileName ):
+    # bytes of the file and its events per (run, lumi); None if it cannot be read
+    from ROOT import TFile
+    url = ('root://eoscms//eos/cms' + fileName) if fileName.startswith('/store/') else fileName
+    f = TFile.Open( url )
+    if not( f ) or f.IsZombie():
+        return None
+    nBytes = int( f.GetSize() )
+    lumis = dict()
+    tree = f.Get('Events')
+    nAll = int( tree.GetEntries() ) if tree else 0
+    if( nAll > 0 ):
+        tree.SetEstimate( nAll + 1 )
+        if( tree.Draw( 'EventAuxiliary.id_.run_:EventAuxiliary.id_.luminosityBlock_', '', 'goff' ) != nAll ):
+            f.Close()
+            return None
+        runs, lumiBlocks = tree.GetV1(), tree.GetV2()
+        for i in range( nAll ):
+            key = ( int(runs[i]), int(lumiBlocks[i]) )
+            lumis[key] = lumis.get( key, 0 ) + 1
+    f.Close()
+    return nBytes, lumis
+
+def inputFileIndex( files, inputList=inputlist_n ):
+    # file -> (bytes, {(run, lumi): events}), kept in inputIndexFile as "file bytes run:lumi:events ...".
+    # A file is scanned once, by buildInputIndex.py or the first submission needing it, for any json:
+    # the json is only applied when the index is used. Unreadable files are left out and tried again
+    index = dict()
+    if( os.path.isfile( inputIndexFile(inputList) ) ):
+        for line in open( inputIndexFile(inputList) ):
+            words = line.split()
+            if( len(words) < 2 or words[0].startswith('#') ):
+                continue
+            lumis = dict()
+            for word in words[2:]:
+                run, lumi, n = word.split(':')
+                lumis[ (int(run), int(lumi)) ] = int(n)
+            index[words[0]] = ( int(words[1]), lumis )
+    new = [ f for f in files if f not in index ]
+    if( new ):
+        out = open( inputIndexFile(inputList), 'a' )
+        for ifile, fileName in enumerate( new ):
+            scan = scanInputFile( fileName )
+            if( scan is None ):
+                print "[calib]  '-- cannot index " + fileName
+                continue
+            index[fileName] = scan
+            out.write( fileName + ' ' + str(scan[0]) + ''.join( ' %d:%d:%d' % (run, lumi, n) for (run, lumi), n in sorted( scan[1].items() ) ) + '\n' )
+            if( ifile % 100 == 0 ):
+                print "[calib]  '-- indexed " + str(ifile) + "/" + str(len(new)) + " new files in " + inputIndexFile(inputList)
+        out.close()
+    return index
+
+def inJSON( run, lumi, json ):
+    for first, last in json.get( run, [] ):
+        if( first <= lumi <= last ):
+            return True
+    return False
+
+def goodInputFiles( pwd, files ):
+    # useInputIndex: files without any lumi in json_file are left out (files not indexed are kept)
+    index = inputFileIndex( files )
+    json = jsonLumis( pwd )
+    good = [ f for f in files if f not in index or any( inJSON( run, lumi, json ) for run, lumi in index[f][1] ) ]
+    if( len(good) < len(files) ):
+        print "[calib] " + str(len(files) - len(good)) + " input files without lumis in " + json_file + " left out (" + inputIndexFile(inputlist_n) + ")"
+    return good
+
+def lumiSkipRanges( lumis, json ):
+    # lumis of a file outside the json, as 'run:first-run:last' ranges. The source skips them for all the
+    # files of the job, so a range only joins two bad lumis if no lumi between them is in the json
+    ranges = list()
+    for run, lumi in sorted( lumis ):
+        if( inJSON( run, lumi, json ) ):
+            continue
+        if( ranges and ranges[-1][0]==run and not any( first < lumi and last > ranges[-1][2] for first, last in json.get( run, [] ) ) ):
+            ranges[-1][2] = lumi
+        else:
+            ranges.append( [run, lumi, lumi] )
+    return [ '%d:%d-%d:%d' % (run, first, run, last) for run, first, last in ranges ]
+
+def skippedGoodLumis( ranges, lumis, json ):
+    # json lumis of lumis (the files of a job) falling in the skip ranges: must be none
+    bad = list()
+    for r in ranges:
+        first, last = r.split('-')
+        run, lumiFirst = [ int(w) for w in first.split(':') ]
+        lumiLast = int( last.split(':')[1] )
+        bad += [ (run, lumi) for lumiRun, lumi in lumis if lumiRun==run and lumiFirst <= lumi <= lumiLast and inJSON( run, lumi, json ) ]
+    return sorted( bad )
+
+def fillJobLumiSkips( pwd, jobs ):
+    # useInputIndex: per fill job, the lumis of its files outside json_file, skipped by the source. Not for
+    # event-range jobs (skipEvents and lumisToSkip do not mix): the analyzer applies the json there
+    if not( useInputIndex and json_file!='' ):
+        return [ [] for job in jobs ]
+    import sys
+    index = inputFileIndex( [ f for job in jobs for f, first, n in job ] )
+    json = jsonLumis( pwd )
+    skips = list()
+    for ijob, job in enumerate( jobs ):
+        if( job[0][2] >= 0 ):
+            skips.append( [] )
+            continue
+        skip = [ r for f, first, n in job if f in index for r in lumiSkipRanges( index[f][1], json ) ]
+        jobLumis = set( lumi for f, first, n in job if f in index for lumi in index[f][1] )
+        bad = skippedGoodLumis( skip, jobLumis, json )
+        if( bad ):
+            print "[calib] fill job " + str(ijob) + " would skip json lumis " + ' '.join( '%d:%d' % l for l in bad[:10] ) + ", stopping"
+            sys.exit(1)
+        skips.append( skip )
+    print "[calib] " + str(sum( 1 for skip in skips if skip )) + " fill jobs skip the lumis of their files outside " + json_file
+    return skips
+
+def fileEventCounts( pwd, files ):
+    # (all events, events in the json) per input file, cached in eventCountsFile: only new files are opened.
+    # With useInputIndex, from the index
+    if( useInputIndex ):
+        index = inputFileIndex( files )
+        json = jsonLumis(pwd) if( balanceWithJSON and json_file!='' ) else None
+        counts = dict( (f, (-1, -1)) for f in files )
+        for f in files:
+            if( f in index ):
+                nAll = sum( index[f][1].values() )
+                counts[f] = ( nAll, nAll if json is None else sum( n for (run, lumi), n in index[f][1].items() if inJSON( run, lumi, json ) ) )
+        return counts
+    counts = dict()
+    if( os.path.isfile( eventCountsFile(pwd) ) ):
+        for line in open( eventCountsFile(pwd) ):
+            words = line.split()
+            if( len(words)==3 ):
+                counts[words[0]] = ( int(words[1]), int(words[2]) )
+    lumis = jsonLumis(pwd) if( balanceWithJSON and json_file!='' ) else None
+    cache = open( eventCountsFile(pwd), 'a' )
+    for ifile, fileName in enumerate( files ):
+        if( fileName in counts ):
+            continue
+        counts[fileName] = countEvents( fileName, lumis )
+        cache.write( fileName + ' ' + str(counts[fileName][0]) + ' ' + str(counts[fileName][1]) + '\n' )
+        if( ifile % 100 == 0 ):
+            print "[calib]  '-- events counted in " + str(ifile) + "/" + str(len(files)) + " files"
+    cache.close()
+    return counts
+
+def fillJobPartition( pwd, files ):
+    # Fill jobs as lists of (file, first event, number of events or -1 for all), written to fillJobsFile.
+    # Without balanceFillJobs: ijobmax files per job, in the order of the list. With it: as many jobs,
+    # with the same expected work. The work of a file is its number of events (in the json with
+    # balanceWithJSON); files above 1.5 times the work of a job are split in event ranges, one job each,
+    # the others are packed largest first into the currently lightest job
+    import heapq, math
+    if( useInputIndex and json_file!='' ):
+        files = goodInputFiles( pwd, files )
+    nJobs = (len(files) + ijobmax - 1)/ijobmax
+    if not( balanceFillJobs ):
+        jobs = [ [ (f, 0, -1) for f in files[i:i+ijobmax] ] for i in range(0, len(files), ijobmax) ]
+    else:
+        counts = fileEventCounts( pwd, files )
+        known = [ counts[f][1] for f in files if counts[f][1] >= 0 ]
+        average = float(sum(known))/len(known) if known else 1.
+        work = dict( (f, counts[f][1] if counts[f][1] >= 0 else average) for f in files )
+        target = max( 1., sum(work.values())/nJobs )
+        jobs = list()
+        loads = list()
+        small = list()
+        for f in files:
+            nAll = counts[f][0]
+            if( work[f] > 1.5*target and nAll > 1 ):
+                nPieces = int( min( nAll, math.ceil( work[f]/target ) ) )
+                for p in range( nPieces ):
+                    jobs.append( [ (f, nAll*p/nPieces, nAll*(p+1)/nPieces - nAll*p/nPieces) ] )
+                    loads.append( work[f]/nPieces )
+            else:
+                small.append( f )
+        if( small ):
+            nBins = max( 1, min( len(small), int( round( sum( work[f] for f in small )/target ) ) ) )
+            bins = [ (0., len(jobs) + i) for i in range(nBins) ]
+            jobs += [ [] for i in range(nBins) ]
+            loads += [ 0. for i in range(nBins) ]
+            for f in sorted( small, key=lambda f: -work[f] ):
+                load, ijob = heapq.heappop( bins )
+                jobs[ijob].append( (f, 0, -1) )
+                loads[ijob] = load + work[f]
+                heapq.heappush( bins, (loads[ijob], ijob) )
+        # heaviest first: they are submitted (or pulled from the work queue) first
+        jobs = [ jobs[i] for i in sorted( range(len(jobs)), key=lambda i: -loads[i] ) ]
+        print "[calib] Fill jobs balanced on " + ("json " if balanceWithJSON else "") + "events: " + str(len(jobs)) + " jobs, " + str(int(min(loads))) + " to " + str(int(max(loads))) + " events per job"
+    partition = open( fillJobsFile(pwd), 'w' )
+    for ijob, job in enumerate( jobs ):
+        for f, first, n in job:
+            partition.write( str(ijob) + ' ' + f + ' ' + str(first) + ' ' + str(n) + '\n' )
+    partition.close()
+    return jobs
+
+def nFillJobs( pwd, nFiles ):
+    # number of fill jobs made by submitCalibration.py (ijobmax files per job for older work areas)
+    if( os.path.isfile( fillJobsFile(pwd) ) ):
+        ijobs = set( line.split()[0] for line in open( fillJobsFile(pwd) ) if line.strip() )
+        return len( ijobs )
+    return (nFiles + ijobmax - 1)/ijobmax
+
+def fillCheckpointFile( pwd, iteration, ijob ):
+    return pwd + '/' + dirname + '/checkpoints/fill_iter_' + str(iteration) + '_job_' + str(ijob) + '.root'
+
+def printFillCfgCheckpoint( outputfile, pwd, iteration, ijob ):
+    # FillEpsilonPlot checkpoints its histograms and its events per lumi; a new attempt of the job resumes
+    # from them, skipping those events itself (the source reads the same files in the same order)
+    checkpoint = fillCheckpointFile( pwd, iteration, ijob )
+    outputfile.write("process.analyzerFillEpsilon.CheckpointFile = cms.untracked.string('" + checkpoint + "')\n")
+    outputfile.write("process.analyzerFillEpsilon.CheckpointEvery = cms.untracked.int32(" + str(fillCheckpointEvery) + ")\n")
+
+def printFillCfgLumiSkip( outputfile, ranges ):
+    # lumis outside json_file (useInputIndex): never read by the source
+    outputfile.write("process.source.lumisToSkip = cms.untracked.VLuminosityBlockRange(\n")
+    outputfile.write(",\n".join( "    '" + r + "'" for r in ranges ) + "\n")
+    outputfile.write(")\n")
+
+def printFillCfgRange( outputfile, first, n ):
+    # fill job on an event range of a single file
+    outputfile.write("process.source.skipEvents = cms.untracked.uint32(" + str(first) + ")\n")
+    outputfile.write("process.maxEvents.input = cms.untracked.int32(" + str(n) + ")\n")
+
 ####from parameters_NEWESTCRAB import *
 
 def printFillCfg1( outputfile ):
@@ -173,6 +855,11 @@ def printFillCfg2( outputfile, pwd , iteration, outputDir, ijob ):
         outputfile.write("process.analyzerFillEpsilon.isCRAB  = cms.untracked.bool(True)\n")
     else:
         outputfile.write("process.analyzerFillEpsilon.calibMapPath = cms.untracked.string('root://eoscms//eos/cms" + eosPath + "/" + dirname + "/iter_" + str(iteration-1) + "/" + NameTag + calibMapName + "')\n")
+        if(useCalibMapBinary):
+            outputfile.write("process.analyzerFillEpsilon.calibMapBinaryPath = cms.untracked.string('" + calibMapBinaryFile(pwd, iteration-1) + "')\n")
+            if(freezeConverged):
+                outputfile.write("process.analyzerFillEpsilon.FrozenRegionsFile = cms.untracked.string('" + frozenMapFile(pwd, iteration-1) + "')\n")
+                outputfile.write("process.analyzerFillEpsilon.FreezeAfter = cms.untracked.int32( " + str(freezeAfter) + " )\n")
     outputfile.write("process.analyzerFillEpsilon.useEBContainmentCorrections = cms.untracked.bool(" + useEBContainmentCorrections + ")\n")
     outputfile.write("process.analyzerFillEpsilon.useEEContainmentCorrections = cms.untracked.bool(" + useEEContainmentCorrections + ")\n")
     outputfile.write("process.analyzerFillEpsilon.EBContainmentCorrections = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + EBContainmentCorrections + "')\n")
@@ -183,6 +870,8 @@ def printFillCfg2( outputfile, pwd , iteration, outputDir, ijob ):
     outputfile.write("process.analyzerFillEpsilon.MVAEBContainmentCorrections_eta01  = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + MVAEBContainmentCorrections_eta01 + "')\n")
     outputfile.write("process.analyzerFillEpsilon.MVAEBContainmentCorrections_eta02  = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + MVAEBContainmentCorrections_eta02 + "')\n")
     outputfile.write("process.analyzerFillEpsilon.Endc_x_y                        = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + Endc_x_y + "')\n")
+    if(RingTablesBinary!=""):
+        outputfile.write("process.analyzerFillEpsilon.RingTablesBinary                = cms.untracked.string('" + RingTablesBinary + "')\n")
     outputfile.write("process.analyzerFillEpsilon.EBPHIContainmentCorrections = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + EBPHIContainmentCorrections + "')\n")
     outputfile.write("process.analyzerFillEpsilon.EEContainmentCorrections    = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + EEContainmentCorrections + "')\n")
     outputfile.write("process.analyzerFillEpsilon.ContCorr_EB                 = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + EBContCorr + "')\n")
@@ -296,7 +985,41 @@ def printFillCfg2( outputfile, pwd , iteration, outputDir, ijob ):
         outputfile.write("process.p *= process.ecalLocalRecoSequence\n")
     outputfile.write("process.p *= process.analyzerFillEpsilon\n")
 
-def printFitCfg( outputfile, iteration, outputDir, nIn, nFin, EBorEE, nFit ):
+def fusedFitInputsFile( pwd, iteration ):
+    return pwd + '/' + dirname + '/src/hadd/fit_inputs_iter_' + str(iteration) + '.list'
+
+def writeFusedFitInputs( pwd, iteration ):
+    # fusedMergeFit: the inputs of the final hadd (hadd outputs, or the incrementalMerge partial sums),
+    # summed by every fit job of the iteration instead of reading epsilonPlots.root. The fits need all of
+    # them: returns the ones missing (or too small) on EOS, and then writes no list
+    import subprocess
+    listing = subprocess.Popen( ['cmsLs ' + eosPath + '/' + dirname + '/iter_' + str(iteration)], stdout=subprocess.PIPE, shell=True )
+    present = set()
+    for line in listing.communicate()[0].splitlines():
+        words = line.split()
+        if len(words) >= 5 and words[1].isdigit() and int(words[1]) >= 10000:
+            present.add( os.path.basename(words[-1]) )
+    inputs = list()
+    missing = list()
+    for line in open( pwd + '/' + dirname + '/src/hadd/hadd_iter_' + str(iteration) + '_final.list' ):
+        name = line.strip()
+        if( name == '' ):
+            continue
+        if( os.path.basename(name) not in present ):
+            print '[fusedMergeFit] missing (or too small) on EOS: ' + name
+            missing.append( name )
+            continue
+        inputs.append( name if name.startswith('root://') else 'root://eoscms//eos/cms' + name )
+    if( missing ):
+        return missing
+    out = open( fusedFitInputsFile(pwd, iteration), 'w' )
+    for name in inputs:
+        out.write( name + '\n' )
+    out.close()
+    print '[fusedMergeFit] the fit jobs sum ' + str(len(inputs)) + ' files (' + fusedFitInputsFile(pwd, iteration) + ')'
+    return missing
+
+def printFitCfg( outputfile, iteration, outputDir, nIn, nFin, EBorEE, nFit, pwd ):
     outputfile.write("import FWCore.ParameterSet.Config as cms\n")
     outputfile.write("process = cms.Process('FitEpsilonPlot')\n")
     outputfile.write("process.load('FWCore.MessageService.MessageLogger_cfi')\n")
@@ -305,6 +1028,8 @@ def printFitCfg( outputfile, iteration, outputDir, nIn, nFin, EBorEE, nFit ):
     outputfile.write("process.fitEpsilon = cms.EDAnalyzer('FitEpsilonPlot')\n")
     outputfile.write("process.fitEpsilon.OutputFile = cms.untracked.string('" + NameTag + EBorEE + "_" + str(nFit) + "_" + calibMapName + "')\n")
     outputfile.write("process.fitEpsilon.CalibType = cms.untracked.string('" + CalibType + "')\n")
+    if( CalibType=='etaring' ):
+        outputfile.write("process.fitEpsilon.ExternalGeometry = cms.untracked.string('CalibCode/FillEpsilonPlot/data/" + ExternalGeometry + "')\n")
     if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
         outputfile.write("process.fitEpsilon.OutputDir = cms.untracked.string('$TMPDIR')\n")
     else:
@@ -318,11 +1043,33 @@ def printFitCfg( outputfile, iteration, outputDir, nIn, nFin, EBorEE, nFit ):
         outputfile.write("process.fitEpsilon.Are_pi0 = cms.untracked.bool( True )\n")
     else:
         outputfile.write("process.fitEpsilon.Are_pi0 = cms.untracked.bool( False )\n")
-    outputfile.write("process.fitEpsilon.StoreForTest = cms.untracked.bool( False )\n")
+    outputfile.write("process.fitEpsilon.StoreForTest = cms.untracked.bool( " + str(storeFits) + " )\n")
     outputfile.write("process.fitEpsilon.Barrel_orEndcap = cms.untracked.string('" + Barrel_or_Endcap + "')\n")
+    if(warmStartFits):
+        outputfile.write("process.fitEpsilon.WarmStartFits = cms.untracked.bool( True )\n")
+    if(headlessFits):
+        outputfile.write("process.fitEpsilon.HeadlessFits = cms.untracked.bool( True )\n")
+        outputfile.write("process.fitEpsilon.StoreFitEvery = cms.untracked.int32( " + str(storeFitEvery) + " )\n")
+    if(concurrentFitVariants):
+        outputfile.write("process.fitEpsilon.ConcurrentFitVariants = cms.untracked.bool( True )\n")
+    if(fastPeakEstimate):
+        outputfile.write("process.fitEpsilon.FastPeakEstimate = cms.untracked.bool( True )\n")
+        outputfile.write("process.fitEpsilon.FastPeakMaxPull = cms.untracked.double( " + str(fastPeakMaxPull) + " )\n")
+        outputfile.write("process.fitEpsilon.FastPeakMinSignal = cms.untracked.double( " + str(fastPeakMinSignal) + " )\n")
+        outputfile.write("process.fitEpsilon.FastPeakMaxSigmaShift = cms.untracked.double( " + str(fastPeakMaxSigmaShift) + " )\n")
+        outputfile.write("process.fitEpsilon.FastPeakValidateEvery = cms.untracked.int32( " + str(fastPeakValidateEvery) + " )\n")
     if not(isCRAB): #If CRAB you have to put the correct path, and you do it on calibJobHandler.py, not on ./submitCalibration.py
         outputfile.write("process.fitEpsilon.EpsilonPlotFileName = cms.untracked.string('root://eoscms//eos/cms" + eosPath + "/" + dirname + "/iter_" + str(iteration) + "/" + NameTag + "epsilonPlots.root')\n")
+        if(fusedMergeFit):
+            outputfile.write("process.fitEpsilon.EpsilonPlotFileNames = cms.untracked.vstring( [ l.strip() for l in open('" + fusedFitInputsFile(pwd, iteration) + "') if l.strip() ] )\n")
         outputfile.write("process.fitEpsilon.calibMapPath = cms.untracked.string('root://eoscms//eos/cms" + eosPath + "/" + dirname + "/iter_" + str(iteration-1) + "/" + NameTag + calibMapName + "')\n")
+        if(useCalibMapBinary):
+            outputfile.write("process.fitEpsilon.calibMapBinaryPath = cms.untracked.string('" + calibMapBinaryFile(pwd, iteration-1) + "')\n")
+            if(warmStartFits or fastPeakEstimate):
+                outputfile.write("process.fitEpsilon.FitSeedsPath = cms.untracked.string('" + fitSeedsFile(pwd, iteration-1) + "')\n")
+            if(freezeConverged):
+                outputfile.write("process.fitEpsilon.FrozenRegionsFile = cms.untracked.string('" + frozenMapFile(pwd, iteration-1) + "')\n")
+                outputfile.write("process.fitEpsilon.FreezeAfter = cms.untracked.int32( " + str(freezeAfter) + " )\n")
     outputfile.write("process.p = cms.Path(process.fitEpsilon)\n")
 
 
@@ -345,9 +1092,16 @@ def printSubmitFitSrc(outputfile, cfgName, source, destination, pwd, logpath):
        outputfile.write("echo 'rm -f " + source + "' >> " + logpath + " \n")
        outputfile.write("rm -f " + source + " >> " + logpath + " 2>&1 \n")
 
-def printSubmitSrc(outputfile, cfgName, source, destination, pwd, logpath):
+def printSubmitSrc(outputfile, cfgName, source, destination, pwd, logpath, checkpoint='', done=''):
+    # the checkpoint of the job is removed once its output is on EOS, then the done marker (fillDoneFile)
+    # is written, renamed into place: it exists only while a complete output of this job is on EOS
+    removeCheckpoint = (" && rm -f " + checkpoint) if checkpoint else ""
+    if( done ):
+        removeCheckpoint += " && date +%s%N > " + done + ".tmp && mv -f " + done + ".tmp " + done
     outputfile.write("#!/bin/bash\n")
     outputfile.write("cd " + pwd + "\n")
+    if( done ):
+        outputfile.write("rm -f " + done + "\n")
     outputfile.write("eval `scramv1 runtime -sh`\n")
     outputfile.write("source /cvmfs/cms.cern.ch/crab3/crab.sh\n")
     if ( not isOtherT2 and isCRAB ):
@@ -356,7 +1110,7 @@ def printSubmitSrc(outputfile, cfgName, source, destination, pwd, logpath):
         outputfile.write("echo 'cmsRun " + cfgName + "'\n")
         outputfile.write("cmsRun " + cfgName + "\n")
         outputfile.write("echo 'cmsStage -f " + source + " " + destination + "'\n")
-        outputfile.write("cmsStage -f " + source + " " + destination + "\n")
+        outputfile.write("cmsStage -f " + source + " " + destination + removeCheckpoint + "\n")
         outputfile.write("echo 'rm -f " + source + "'\n")
         outputfile.write("rm -f " + source + "\n")
     else:
@@ -365,7 +1119,7 @@ def printSubmitSrc(outputfile, cfgName, source, destination, pwd, logpath):
         outputfile.write("echo 'ls " + source + " >> " + logpath + " 2>&1' \n" )
         outputfile.write("ls " + source + " >> " + logpath + " 2>&1 \n" )
         outputfile.write("echo 'cmsStage -f " + source + " " + destination + "' >> " + logpath  + "\n")
-        outputfile.write("cmsStage -f " + source + " " + destination + " >> " + logpath + " 2>&1 \n")
+        outputfile.write("cmsStage -f " + source + " " + destination + " >> " + logpath + " 2>&1" + removeCheckpoint + " \n")
         outputfile.write("echo 'rm -f " + source + "' >> " + logpath + " \n")
         outputfile.write("rm -f " + source + " >> " + logpath + " 2>&1 \n")
 
@@ -433,6 +1187,138 @@ def printCrabHadd(outputfile, iter, pwd):
     outputfile.write("   python calibJobHandler.py CRAB " + iter + " " + queue + " $AddPath $AddPathOLDIter;\n")
     outputfile.write("fi\n")
 
+def haddCommand( outFile, list ):
+    # mergeEpsilonPlots if layoutHadd, falling back to hadd when it refuses the inputs
+    hadd = "hadd -f " + outFile + " @" + list
+    if( layoutHadd ):
+        return "mergeEpsilonPlots " + outFile + " " + list + " " + str(layoutHaddThreads) + " || " + hadd
+    return hadd
+
+def incrementalMergeLogFile( pwd, iteration ):
+    return pwd + "/" + dirname + "/" + NameTag + "incrementalMerge_iter_" + str(iteration) + ".log"
+
+def fillDoneFile( pwd, iteration, ijob ):
+    # written by the fill job after its output is staged on EOS (printSubmitSrc), holds a stamp of that stage-out
+    return pwd + "/" + dirname + "/src/Fill/submit_iter_" + str(iteration) + "_job_" + str(ijob) + ".done"
+
+def fillOutputsDone( pwd, iteration ):
+    # stamp of each fill output known to be complete on EOS, by job number
+    import glob, re
+    pattern = re.compile( '_job_([0-9]+)\.done$' )
+    stamps = dict()
+    for done in glob.glob( fillDoneFile(pwd, iteration, '*') ):
+        match = pattern.search( done )
+        stamp = open( done ).read().strip()
+        if match and stamp:
+            stamps[ int(match.group(1)) ] = stamp
+    return stamps
+
+def fillOutputsOnEOS( iteration ):
+    # size of each fill output <NameTag><outputFile>_<ijob>.root already staged on EOS, by job number
+    import re, subprocess
+    pattern = re.compile( '^' + re.escape(NameTag + outputFile) + '_([0-9]+)\.root$' )
+    listing = subprocess.Popen( ['cmsLs ' + eosPath + '/' + dirname + '/iter_' + str(iteration)], stdout=subprocess.PIPE, shell=True )
+    sizes = dict()
+    for line in listing.communicate()[0].splitlines():
+        words = line.split()
+        if len(words) < 5 or not words[1].isdigit():
+            continue
+        match = pattern.match( os.path.basename(words[-1]) )
+        if match:
+            sizes[ int(match.group(1)) ] = int(words[1])
+    return sizes
+
+def loadIncrementalMerge( pwd, iteration ):
+    # Partial sums already made for this iteration (from the log, if the daemon was restarted). Each
+    # partial records the stamps of the fill outputs it contains
+    state = { 'partials' : list(), 'lastPoll' : 0., 'process' : None, 'running' : None, 'nMerges' : 0 }
+    if os.path.isfile( incrementalMergeLogFile(pwd, iteration) ):
+        for line in open( incrementalMergeLogFile(pwd, iteration) ):
+            words = line.split()
+            if len(words) >= 2 and words[0] == 'PARTIAL':
+                jobs = dict( (int(w.split(':')[0]), w.split(':')[1]) for w in words[2:] )
+                state['partials'].append( { 'name' : words[1], 'jobs' : jobs } )
+                state['nMerges'] = max( state['nMerges'], int(words[1].split('_')[-1].split('.')[0]) + 1 )
+            if len(words) == 2 and words[0] == 'DROP':
+                state['partials'] = [ p for p in state['partials'] if p['name'] != words[1] ]
+    return state
+
+def launchPartialMerge( pwd, iteration, state, jobs ):
+    import subprocess
+    name = NameTag + 'epsilonPartial_' + str(iteration) + '_' + str(state['nMerges']) + '.root'
+    state['nMerges'] += 1
+    listName = pwd + '/' + dirname + '/src/hadd/' + name.replace('.root', '.list')
+    listFile = open( listName, 'w' )
+    for ijob in sorted(jobs):
+        listFile.write( 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iteration) + '/' + NameTag + outputFile + '_' + str(ijob) + '.root\n' )
+    listFile.close()
+    command = haddCommand( '/tmp/' + name, listName ) + ' && cmsStage -f /tmp/' + name + ' ' + eosPath + '/' + dirname + '/iter_' + str(iteration) + '/; status=$?; rm -f /tmp/' + name + '; exit $status'
+    print '[IncrementalMerge] ' + str(len(jobs)) + ' fill outputs into ' + name
+    state['running'] = { 'name' : name, 'jobs' : jobs }
+    state['process'] = subprocess.Popen( [command], stdout=open(listName.replace('.list', '.log'), 'w'), stderr=subprocess.STDOUT, shell=True )
+
+def incrementalMergeStep( pwd, iteration, state, final=False ):
+    # Called while the fill jobs run: the outputs with a done marker (fillDoneFile) are summed,
+    # incrementalMergeBatch at a time, into partial sums on EOS (one merge running at a time).
+    # An output whose marker is removed or rewritten after being summed (resubmitted job) drops its partial:
+    # its outputs are summed again. With final=True (all fill jobs ended) every remaining output goes into
+    # a last partial, also the ones on EOS without a marker, as the normal hadd would sum them
+    import time
+    if( not final and time.time() - state['lastPoll'] < incrementalMergePoll ):
+        return
+    state['lastPoll'] = time.time()
+    stamps = fillOutputsDone( pwd, iteration )
+    if( final ):
+        for ijob, size in fillOutputsOnEOS( iteration ).items():
+            if( ijob not in stamps and size >= 10000 ):
+                stamps[ijob] = 'eos' + str(size)
+    log = open( incrementalMergeLogFile(pwd, iteration), 'a' )
+    for partial in list( state['partials'] ):
+        changed = [ ijob for ijob, stamp in partial['jobs'].items() if stamps.get(ijob) != stamp ]
+        if changed:
+            print '[IncrementalMerge] output of job ' + str(changed[0]) + ' changed after being summed into ' + partial['name'] + ': summing its outputs again'
+            log.write( 'DROP ' + partial['name'] + '\n' )
+            state['partials'].remove( partial )
+    if( state['process'] is not None and state['process'].poll() is not None ):
+        running = state['running']
+        if( state['process'].returncode == 0 and all( stamps.get(ijob) == stamp for ijob, stamp in running['jobs'].items() ) ):
+            log.write( 'PARTIAL ' + running['name'] + ' ' + ' '.join( str(ijob) + ':' + str(stamp) for ijob, stamp in sorted(running['jobs'].items()) ) + '\n' )
+            state['partials'].append( running )
+        else:
+            print '[IncrementalMerge] ' + running['name'] + ' failed or is outdated, its outputs will be summed again'
+        state['process'] = None; state['running'] = None
+    log.close()
+    if( state['process'] is None ):
+        folded = set()
+        for partial in state['partials']:
+            folded.update( partial['jobs'].keys() )
+        ready = dict( (ijob, stamp) for ijob, stamp in stamps.items() if ijob not in folded )
+        if( len(ready) >= incrementalMergeBatch or (final and ready) ):
+            batch = ready if final else dict( (ijob, ready[ijob]) for ijob in sorted(ready)[:incrementalMergeBatch] )
+            launchPartialMerge( pwd, iteration, state, batch )
+
+def incrementalMergeFinish( pwd, iteration, state ):
+    # After the last fill job: wait for the running merge, sum what is left, and point the final hadd list
+    # (hadd_iter_<iteration>_final.list) to the partial sums. False if nothing was summed (normal hadd then)
+    for attempt in range(4):
+        if( state['process'] is not None ):
+            state['process'].wait()
+        incrementalMergeStep( pwd, iteration, state, True )
+        if( state['process'] is None ):
+            break
+    if( state['process'] is not None ):
+        print '[IncrementalMerge] the last partial sum keeps failing, normal hadd of all the fill outputs'
+        state['process'].wait()
+        return False
+    if not state['partials']:
+        return False
+    finalList = open( pwd + '/' + dirname + '/src/hadd/hadd_iter_' + str(iteration) + '_final.list', 'w' )
+    for partial in state['partials']:
+        finalList.write( 'root://eoscms//eos/cms' + eosPath + '/' + dirname + '/iter_' + str(iteration) + '/' + partial['name'] + '\n' )
+    finalList.close()
+    print '[IncrementalMerge] final hadd of ' + str(len(state['partials'])) + ' partial sums'
+    return True
+
 def printParallelHadd(outputfile, outFile, list, destination, pwd):
     import os, sys, imp, re
     CMSSW_VERSION=os.getenv("CMSSW_VERSION")
@@ -450,14 +1336,14 @@ def printParallelHadd(outputfile, outFile, list, destination, pwd):
          outputfile.write("cd " + pwd + "\n")
     outputfile.write("eval `scramv1 runtime -sh`\n")
     if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-       outputfile.write("echo 'hadd -f $TMPDIR/" + outFile + " @" + list + "'\n")
-       outputfile.write("hadd -f $TMPDIR/" + outFile + " @" + list  + "\n")
+       outputfile.write("echo '" + haddCommand("$TMPDIR/" + outFile, list) + "'\n")
+       outputfile.write(haddCommand("$TMPDIR/" + outFile, list) + "\n")
        outputfile.write("echo 'srmcp file:///$TMPDIR/" + outFile + " " + destination + "/" + outFile + "'\n")
        outputfile.write("srmcp file:///$TMPDIR/" + outFile + " " + destination + "/" + outFile + "\n")
        outputfile.write("rm -f $TMPDIR/" + outFile + "\n")
     else:
-       outputfile.write("echo 'hadd -f /tmp/" + outFile + " @" + list + "'\n")
-       outputfile.write("hadd -f /tmp/" + outFile + " @" + list  + "\n")
+       outputfile.write("echo '" + haddCommand("/tmp/" + outFile, list) + "'\n")
+       outputfile.write(haddCommand("/tmp/" + outFile, list) + "\n")
        outputfile.write("echo 'cmsStage -f /tmp/" + outFile + " " + destination + "'\n")
        outputfile.write("cmsStage -f /tmp/" + outFile + " " + destination + "\n")
        outputfile.write("rm -f /tmp/" + outFile + "\n")
@@ -479,14 +1365,14 @@ def printFinalHadd(outputfile, list, destination, pwd):
          outputfile.write("cd " + pwd + "\n")
     outputfile.write("eval `scramv1 runtime -sh`\n")
     if( isOtherT2 and storageSite=="T2_BE_IIHE" and isCRAB ):
-       outputfile.write("echo 'hadd -f $TMPDIR/" + NameTag + "epsilonPlots.root @" + list + "'\n")
-       outputfile.write("hadd -f $TMPDIR/" + NameTag + "epsilonPlots.root @" + list  + "\n")
+       outputfile.write("echo '" + haddCommand("$TMPDIR/" + NameTag + "epsilonPlots.root", list) + "'\n")
+       outputfile.write(haddCommand("$TMPDIR/" + NameTag + "epsilonPlots.root", list) + "\n")
        outputfile.write("echo 'srmcp file:///$TMPDIR/" + NameTag + "epsilonPlots.root " + destination + "/epsilonPlots.root" + "'\n")
        outputfile.write("srmcp file:///$TMPDIR/" + NameTag + "epsilonPlots.root " + destination + "/epsilonPlots.root" + "\n")
        outputfile.write("rm -f $TMPDIR/" + NameTag + "epsilonPlots.root\n")
     else:
-       outputfile.write("echo 'hadd -f /tmp/" + NameTag + "epsilonPlots.root @" + list + "'\n")
-       outputfile.write("hadd -f /tmp/" + NameTag + "epsilonPlots.root @" + list  + "\n")
+       outputfile.write("echo '" + haddCommand("/tmp/" + NameTag + "epsilonPlots.root", list) + "'\n")
+       outputfile.write(haddCommand("/tmp/" + NameTag + "epsilonPlots.root", list) + "\n")
        outputfile.write("echo 'cmsStage -f /tmp//" + NameTag + "epsilonPlots.root " + destination + "'\n")
        outputfile.write("cmsStage -f /tmp/" + NameTag + "epsilonPlots.root " + destination + "\n")
        outputfile.write("rm -f /tmp/" + NameTag + "epsilonPlots.root\n")
@@ -1,10 +1,38 @@
+import os
 #Do not modify these
 nEventsPerJob      = '-1'
 outputFile         = 'EcalNtp'           # without .root suffix
 calibMapName       = 'calibMap.root'
+calibMapBinName    = 'calibMap.bin'       # Compact copy of calibMap.root written by the daemon in dirname/calibMaps/ (read with a single read by Fill/Fit)
+useCalibMapBinary  = True                # Fill/Fit read calibMapBinName first and fall back to calibMap.root on EOS. Ignored with CRAB
+warmStartFits      = False               # Fit: start each region from its fit of the previous iteration (calibEB/calibEE trees, local copy with useCalibMapBinary) and its last retry step
+headlessFits       = False               # Fit: chi2 from the model bin expectations, no RooPlot/TLatex per region (only for the stored fits)
+storeFits          = False               # Fit: fit frames saved in /tmp/Fit_Stored.root of each fit job (StoreForTest)
+storeFitEvery      = 0                   # Fit: with storeFits and headlessFits, only every storeFitEvery-th region and the fits with chi2 > 5 are saved (0 = only those with chi2 > 5)
+concurrentFitVariants = False            # Fit: when the first EB attempt fails, the remaining background-order retry variants are fitted at once, one forked process each (up to 3 more cores per fit job)
+fastPeakEstimate   = False               # Fit: sideband-subtracted truncated mean instead of the fit for high-statistics regions stable w.r.t. the previous iteration
+fastPeakMaxPull    = 1.0                 # Fit: FastPeakEstimate is kept if |mean - previous mean| < fastPeakMaxPull * stat. error
+fastPeakMinSignal  = 2000.               # Fit: ...and the region has at least this many signal entries
+fastPeakMaxSigmaShift = 0.2              # Fit: ...and its width moved by less than this (relative) w.r.t. the previous fit
+fastPeakValidateEvery = 0                # Fit: every N-th kept FastPeakEstimate is also fitted and the difference logged ("FastPeakEstimate validation"), 0 = never
+nativeMerge        = True                # Merge: fit outputs merged into calibMap.root by mergeCalibMaps (CalibTools/bin, parallel reads, region coverage check). PyROOT loop if it fails
+nativeMergeThreads = 8
+calibAcceleration  = 'none'              # Merge: 'none', 'overrelax' or 'aitken' extrapolation of the coefficients from the previous iterations (needs useCalibMapBinary, not CRAB)
+calibOverRelaxation = 1.5                # Merge: 'overrelax' factor applied to the fitted log step
+calibAitkenMaxRho  = 0.8                 # Merge: 'aitken' only where the step ratio is in (0, calibAitkenMaxRho), i.e. at most 4x the fitted step is added
+calibAccelMaxStep  = 0.02                # Merge: crystals moving more than this (in log) in one iteration are not extrapolated
+freezeConverged    = False               # Freeze crystals converged for freezeAfter iterations: no more filled/fitted, coefficient carried forward (needs useCalibMapBinary, not CRAB)
+freezeAfter        = 3
+freezeMaxStep      = 0.001               # converged: |c_iter/c_iter-1 - 1| below this...
+freezeMaxRelErr    = 0.01                # ...and relative fit error on the coefficient below this (from the RooFit mass fit: crystals fitted otherwise never freeze)
+monitorConvergence = True                # After each merge: RMS of IC(n)/IC(n-1)-1 per subdetector and eta region in dirname/<NameTag>convergence.log (needs useCalibMapBinary, not CRAB)
+stopAtConvergence  = False               # ...and stop iterating a subdetector (the whole loop when none is left) once it has converged
+convergenceMaxRMS_EB = 0.001             # converged: every EB region below this...
+convergenceMaxRMS_EE = 0.002             # ...(EE)
+convergenceIterations = 2                # ...in each of the last convergenceIterations iterations
 GeometryFromFile   = False               # Keep that False, you want the cmssw geometry. Anyway the geometry file is needed
 ExternalGeometry   = 'caloGeometry.root' 
-CalibType          = 'xtal'              # Calibrating single xtals. I never try but you could calibrate EtaRing ot Trigger Towers
+CalibType          = 'xtal'              # 'xtal', 'tt' (trigger towers in EB, 5x5 supercrystals in EE) or 'etaring'. EtaRingCalib/SMCalib need 'xtal'
 
 #Are Pi0
 Are_pi0            = True               # True = using Pi0, False = using Eta
@@ -14,6 +42,7 @@ SMCalibEB          = False
 EtaRingCalibEE     = False
 SMCalibEE          = False
 CalibMapEtaRing    = "CalibCode/FillEpsilonPlot/data/calibMap.root"
+RingTablesBinary   = ""                 # Binary ring tables made once with makeEcalRingTables (CalibTools/bin). Empty = parse Endc_x_y and CalibMapEtaRing in each job
 #PATH
 #eosPath = '/store/caf/user/lpernie'
 eosPath = '/store/caf/user/cmackay'
@@ -42,15 +71,59 @@ Silent           = False                 # True->Fill modules is silent; False->
 NameTag          = '2015C_v2_38T_pi0_CC'                   # Tag to the names to avoid overlap
 queueForDaemon   = 'cmscaf1nw'          # Option suggested: 2nw/2nd, 1nw/1nd, cmscaf1nw/cmscaf1nd... even cmscaf2nw
 queue            = 'cmscaf1nd'
+executor         = 'batch'               # 'batch': jobs sent with bsub (qsub at IIHE) to queue; 'local': daemon and jobs run on this machine
+localSlots       = 0                     # executor='local': jobs running at the same time (0 = one per core)
+localPinCpus     = True                  # executor='local': each job pinned (taskset) to its own cores
+workQueue        = False                 # Fill/hadd/fit scripts pulled one at a time by long-lived workers from a coordinator in the daemon (submit/workQueue.py), instead of one job per script
+workQueueWorkers = 50                    # workers sent to the batch queue (executor='local': one per slot)
+workQueueHost    = ''                    # host the workers connect to: '' = this machine's name, 'localhost' with executor='local'
+workQueueLease   = 300                   # seconds without news from a worker after which its unit is handed to another one
+workQueueRetries = 1                     # times a script exiting with an error is handed out again
+if( isCRAB ):
+   workQueue     = False
 nIterations      = 14
 #N files
 ijobmax          = 3                     # 5 number of files per job
+balanceFillJobs  = False                 # Fill jobs (as many as with ijobmax) built from the events of each file (counted once, cached in dirname/eventCounts.txt): same events per job, large files split in event ranges
+balanceWithJSON  = False                 # balanceFillJobs on the events in json_file (reads the run/lumi of every event once)
+useInputIndex    = False                 # Input files indexed once (bytes, events per run and lumi) in <inputlist_n>.index (buildInputIndex.py, or at submission): files without lumis in json_file left out, the others skip their lumis outside it, balanceFillJobs counts from the index
+fillCheckpoint   = False                 # Fill jobs checkpoint their histograms and events per lumi in dirname/checkpoints/; a resubmitted job skips the events of its checkpoint (without reading their data)
+fillCheckpointEvery = 300                # seconds between two checkpoints of a fill job
+if( isCRAB ):
+   fillCheckpoint = False
 nHadd            = 35                    # 35 number of files per hadd
 fastHadd         = True                  # From 7_4_X we can use this faster mathod. But files have to be copied on /tmp/ to be converted in .db
 if( isCRAB and isOtherT2 ):
    fastHadd      = False                 # No fastHadd on a different T2
+layoutHadd       = True                  # Hadd with mergeEpsilonPlots (CalibTools/bin): bin contents of the fixed epsilon layout summed as flat arrays. Replaces fastHadd, plain hadd if it refuses the inputs
+layoutHaddThreads = 4                    # threads (and accumulators, ~100 MB each for xtal EB+EE) of mergeEpsilonPlots
+if( layoutHadd ):
+   fastHadd      = False
+incrementalMerge = False                 # Fill outputs summed into partial sums on EOS while the fill jobs run; the final hadd only adds the partial sums (needs layoutHadd, not CRAB)
+incrementalMergeBatch = 35               # fill outputs per partial sum
+incrementalMergePoll = 60                # seconds between two looks at the done markers of the fill jobs
+if( not layoutHadd or isCRAB ):
+   incrementalMerge = False
 nFit             = 2000                  # number of fits done in parallel
+balanceFitJobs   = False                 # Fit jobs (as many as with nFit) get lists of regions of the same expected cost, from the fit time (or retries) of each region in the previous iteration's calibMap.root
+if( isCRAB ):
+   balanceFitJobs = False
+fusedMergeFit    = False                 # No final hadd: each fit job sums the distributions of its own regions over the hadd outputs (or incrementalMerge partial sums) itself, epsilonPlots.root is neither written nor read
+fusedKeepMerged  = False                 # fusedMergeFit: epsilonPlots.root still written (final hadd run alongside the fits, for debugging)
+if( isCRAB ):
+   fusedMergeFit = False
+durableState     = False                 # Daemon progress (task states, size and checksum of the EOS outputs) in dirname/daemonState.db: a daemon started again with dirname/submit.sh resumes where the previous one stopped
+if( isCRAB ):
+   durableState = False
 Barrel_or_Endcap = 'ONLY_BARREL'          # Option: 'ONLY_BARREL','ONLY_ENDCAP','ALL_PLEASE'
+pipelineSubdets  = False                 # With ALL_PLEASE: EB and EE calibrated as two independent pipelines, each with its own work area (dirname_EB, dirname_EE), NameTag, fills, fits, merges, iterations and daemon, so each goes on as soon as its own previous stage is done (each daemon waits for its own job ids). Each pipeline reads the full input: the fill I/O doubles
+if( isCRAB or Barrel_or_Endcap!='ALL_PLEASE' ):
+   pipelineSubdets = False
+pipelineSubdet   = os.environ.get('ECALPRO_SUBDET', '')  # pipeline of this daemon (exported by its submit.sh, set by submitCalibration.py)
+if( pipelineSubdets and pipelineSubdet in ('EB', 'EE') ):
+   dirname          = dirname + '_' + pipelineSubdet
+   NameTag          = NameTag + pipelineSubdet + '_'
+   Barrel_or_Endcap = 'ONLY_BARREL' if pipelineSubdet=='EB' else 'ONLY_ENDCAP'
 #Remove Xtral Dead
 RemoveDead_Flag = "True"
 RemoveDead_Map  = ""
@@ -17,6 +17,17 @@ OnlyFIT             = str(sys.argv[5])
 nJobs               = str(sys.argv[6])
 pwd                 = os.getcwd()
 
+# pipelineSubdets: both pipelines are resubmitted, each in its own work area (ECALPRO_SUBDET=EB or EE
+# in the environment resubmits only that one)
+if( pipelineSubdets and pipelineSubdet not in ('EB', 'EE') ):
+    for subdet in ['EB', 'EE']:
+        print "[resubmit] Resubmitting the " + subdet + " pipeline (" + dirname + "_" + subdet + ")"
+        rc = subprocess.call( [sys.executable] + sys.argv, env=dict( os.environ, ECALPRO_SUBDET=subdet ) )
+        if( rc != 0 ):
+            print "[resubmit] Resubmitting the " + subdet + " pipeline failed (exit code " + str(rc) + ")"
+            sys.exit(rc)
+    sys.exit(0)
+
 workdir = pwd+'/'+dirname
 
 Mode = "BATCH_RESU"
@@ -35,6 +46,8 @@ env_script_f = open(env_script_n, 'w')
 env_script_f.write("#!/bin/bash\n")
 env_script_f.write("cd " + pwd + "\n")
 env_script_f.write("eval `scramv1 runtime -sh`\n")
+if( pipelineSubdets ):
+    env_script_f.write("export ECALPRO_SUBDET=" + pipelineSubdet + "\n")
 print "python calibJobHandler.py " + Mode + " " + str(iteration_to_resume) + " " + queue + " " + str(nJobs)
 env_script_f.write("python calibJobHandler.py " + Mode + " " + str(iteration_to_resume) + " " + queue + " " + str(nJobs) + "\n")
 env_script_f.close()
@@ -42,10 +55,14 @@ env_script_f.close()
 # configuring calibration handler
 print "[resubmit] Iteration to resume = " + str(iteration_to_resume)
 print "[resubmit] Submitting calibration handler"
-submit_s = "bsub -q " + queueForDaemon + " -o " + workdir + "/resume-calibration.log source " + env_script_n
+if( executor=='local' ):
+    submit_s = "nohup bash " + env_script_n + " > " + workdir + "/resume-calibration.log 2>&1 &"
+else:
+    submit_s = "bsub -q " + queueForDaemon + " -o " + workdir + "/resume-calibration.log source " + env_script_n
 print "[resubmit]  '-- " + submit_s
 
 # submitting calibration handler
 submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
 output = (submitJobs.communicate()[0]).splitlines()
-print "[resubmit]  '-- " + output[0]
+if( output ):
+    print "[resubmit]  '-- " + output[0]
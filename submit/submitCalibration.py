@@ -11,13 +11,25 @@ else:
 #-------- check if you have right access to queues --------#
 checkAccessToQueues = subprocess.Popen(['bjobs'], stderr=subprocess.PIPE, shell=True);
 output = checkAccessToQueues.communicate()[1]
-if(output.find('command not found')==-1):
+if( executor=='local' ):
+    print "[calib] Local executor: jobs run on this machine"
+elif(output.find('command not found')==-1):
     print "[calib] Correct setup for batch submission"
 else:
     print "[calib] Missing access to queues"
     if not( isCRAB and storageSite=="T2_BE_IIHE" ):
        sys.exit(1)
 
+#-------- pipelineSubdets: one work area and one daemon per subdetector --------#
+if( pipelineSubdets and pipelineSubdet not in ('EB', 'EE') ):
+    for subdet in ['EB', 'EE']:
+        print "[calib] Setting up the " + subdet + " pipeline (" + dirname + "_" + subdet + ")"
+        rc = subprocess.call( [sys.executable] + sys.argv, env=dict( os.environ, ECALPRO_SUBDET=subdet ) )
+        if( rc != 0 ):
+            print "[calib] Setting up the " + subdet + " pipeline failed (exit code " + str(rc) + ")"
+            sys.exit(rc)
+    sys.exit(0)
+
 #-------- create folders --------#
 
 workdir = pwd+'/'+dirname
@@ -47,6 +59,20 @@ folderCreation = subprocess.Popen(['mkdir -p ' + srcPath + '/Fit'], stdout=subpr
 folderCreation.communicate()
 folderCreation = subprocess.Popen(['mkdir -p ' + srcPath + '/hadd'], stdout=subprocess.PIPE, shell=True);
 folderCreation.communicate()
+folderCreation = subprocess.Popen(['mkdir -p ' + workdir + '/calibMaps'], stdout=subprocess.PIPE, shell=True);
+folderCreation.communicate()
+folderCreation = subprocess.Popen(['mkdir -p ' + workdir + '/checkpoints'], stdout=subprocess.PIPE, shell=True);
+folderCreation.communicate()
+# a new campaign: the progress recorded by a previous daemon in this work area (durableState) is stale
+if( os.path.exists( workdir + '/daemonState.db' ) ):
+    print "[calib] Removing the daemon state of a previous submission (" + workdir + "/daemonState.db)"
+    os.remove( workdir + '/daemonState.db' )
+# and so are the fill checkpoints of its iterations (FillEpsilonPlot also refuses one of other constants)
+staleCheckpoints = os.listdir( workdir + '/checkpoints' )
+if( staleCheckpoints ):
+    print "[calib] Removing " + str(len(staleCheckpoints)) + " fill checkpoints of a previous submission (" + workdir + "/checkpoints)"
+    for f in staleCheckpoints:
+        os.remove( workdir + '/checkpoints/' + f )
 
 print "[calib] Storing parameter.py for future reference"
 CopyParam = subprocess.Popen(['cp  parameters.py ' + workdir], stdout=subprocess.PIPE, shell=True);
@@ -81,18 +107,17 @@ inputlist_f = open( inputlist_n )
 inputlistbase_v = inputlist_f.readlines()
 
 print "[calib] Total number of files to be processed: " , len(inputlistbase_v)
+# input files of each fill job, the same in every iteration
+fillJobs = fillJobPartition( pwd, [ ntpfile.rstrip() for ntpfile in inputlistbase_v if ntpfile.rstrip() != '' ] )
+# useInputIndex: lumis of the files of each job outside the json
+fillSkips = fillJobLumiSkips( pwd, fillJobs )
 print "[calib] Creating cfg Files"
 
 for iter in range(nIterations):
     print "[calib]  '-- Fill::Iteration " + str(iter)
-    # copy by value and not by reference
-    inputlist_v = inputlistbase_v[:]
-    ijob=0
 
     # Creating different list for hadd
-    NrelJob = float(len(inputlist_v)) / float(ijobmax)
-    if( float(int(NrelJob) - NrelJob) < 0. ):
-        NrelJob = int(NrelJob) + 1
+    NrelJob = len(fillJobs)
     Nlist_flo = float(NrelJob/nHadd) + 1.
     Nlist = int(Nlist_flo)
 
@@ -143,8 +168,8 @@ for iter in range(nIterations):
     else:
         printFinalHadd(Fhadd_cfg_f, haddSrc_final_n_s, dest, pwd )
     Fhadd_cfg_f.close()
-    # loop over the whole list
-    while (len(inputlist_v) > 0):
+    # loop over the fill jobs
+    for ijob, fillJob in enumerate(fillJobs):
 
         # create cfg file
         fill_cfg_n = cfgFillPath + "/fillEpsilonPlot_iter_" + str(iter) + "_job_" + str(ijob) + ".py"
@@ -154,21 +179,27 @@ for iter in range(nIterations):
         # print first part of the cfg file
         printFillCfg1( fill_cfg_f )
         # loop over the names of the input files to be put in a single cfg
-        lastline = min(ijobmax,len(inputlist_v)) - 1
-        for line in range(min(ijobmax,len(inputlist_v))):
-            ntpfile = inputlist_v.pop(0)
-            ntpfile = ntpfile.rstrip()
-            if ntpfile != '':
-                if(line != lastline):
-                    fill_cfg_f.write("        '" + ntpfile + "',\n")
-                else:
-                    fill_cfg_f.write("        '" + ntpfile + "'\n")
+        lastline = len(fillJob) - 1
+        for line in range(len(fillJob)):
+            ntpfile = fillJob[line][0]
+            if(line != lastline):
+                fill_cfg_f.write("        '" + ntpfile + "',\n")
+            else:
+                fill_cfg_f.write("        '" + ntpfile + "'\n")
 
         # print the last part of the cfg file
         if( isCRAB ):
             printFillCfg2( fill_cfg_f, pwd, iter , "", ijob )
         else: 
             printFillCfg2( fill_cfg_f, pwd, iter , "/tmp/", ijob )
+        # large file split in event ranges
+        if( fillJob[0][2] >= 0 ):
+            printFillCfgRange( fill_cfg_f, fillJob[0][1], fillJob[0][2] )
+        if( fillSkips[ijob] ):
+            printFillCfgLumiSkip( fill_cfg_f, fillSkips[ijob] )
+        checkpoint = fillCheckpointFile( pwd, iter, ijob ) if( fillCheckpoint ) else ''
+        if( checkpoint ):
+            printFillCfgCheckpoint( fill_cfg_f, pwd, iter, ijob )
         fill_cfg_f.close()
 
         # print source file for batch submission of FillEpsilonPlot task
@@ -177,25 +208,22 @@ for iter in range(nIterations):
         source_s = NameTag +outputFile + "_" + str(ijob) + ".root"
         destination_s = eosPath + '/' + dirname + '/iter_' + str(iter) + "/" + source_s
         logpathFill = pwd + "/" + dirname + "/log/" + "fillEpsilonPlot_iter_" + str(iter) + "_job_" + str(ijob) + ".log"
-        printSubmitSrc(fillSrc_f, fill_cfg_n, "/tmp/" + source_s, destination_s , pwd, logpathFill)
+        printSubmitSrc(fillSrc_f, fill_cfg_n, "/tmp/" + source_s, destination_s , pwd, logpathFill, checkpoint, fillDoneFile(pwd, iter, ijob))
+        # a marker left by an earlier campaign in this folder would make incrementalMerge sum the old output
+        if os.path.isfile( fillDoneFile(pwd, iter, ijob) ):
+            os.remove( fillDoneFile(pwd, iter, ijob) )
         fillSrc_f.close()
 
         # make the source file executable
         changePermission = subprocess.Popen(['chmod 777 ' + fillSrc_n], stdout=subprocess.PIPE, shell=True);
         debugout = changePermission.communicate()
 
-        ijob = ijob+1
-
-njobs = ijob
+njobs = len(fillJobs)
 
 #-------- fit cfg files --------#
     # Fit parallelized
-nEB = 61199/nFit
-if (61199%nFit != 0) :
-    nEB = int(nEB) +1
-nEE = 14647/nFit
-if (14647%nFit != 0) :
-    nEE = int(nEE) +1
+nEB = nFitJobs( nRegionsEB() )
+nEE = nFitJobs( nRegionsEE() )
 
 print '[calib] Splitting Fit Task: ' + str(nEB) + ' jobs on EB, ' + str(nEE) + ' jobs on EE'
 #print 'I will submit ' + str(nEB) + ' jobs to fit the Barrel'
@@ -220,7 +248,7 @@ for iter in range(nIterations):
         fit_cfg_f = open( fit_cfg_n, 'w' )
 
         # print the cfg file
-        printFitCfg( fit_cfg_f , iter, "/tmp",inListB[nFit],finListB[nFit],"Barrel",nFit)
+        printFitCfg( fit_cfg_f , iter, "/tmp",inListB[nFit],finListB[nFit],"Barrel",nFit,pwd)
         fit_cfg_f.close()
 
         # print source file for batch submission of FitEpsilonPlot task
@@ -244,7 +272,7 @@ for iter in range(nIterations):
         fit_cfg_f = open( fit_cfg_n, 'w' )
 
         # print the cfg file
-        printFitCfg( fit_cfg_f , iter, "/tmp",inListE[nFit],finListE[nFit],"Endcap",nFit)
+        printFitCfg( fit_cfg_f , iter, "/tmp",inListE[nFit],finListE[nFit],"Endcap",nFit,pwd)
 
         fit_cfg_f.close()
 
@@ -275,6 +303,8 @@ env_script_f.write("ulimit -c 0\n")
 #   env_script_f.write("export SCRAM_ARCH=slc5_amd64_gcc434\n")
 
 env_script_f.write("eval `scramv1 runtime -sh`\n")
+if( pipelineSubdets ):
+   env_script_f.write("export ECALPRO_SUBDET=" + pipelineSubdet + "\n")
 env_script_f.write( "python " + pwd + "/calibJobHandler.py " + str(njobs) + " " + queue + "\n")
 env_script_f.write( "rm -rf " + pwd + "/core.*")
 env_script_f.close()
@@ -306,12 +336,18 @@ else:
     # configuring calibration handler
     print "[calib] Number of jobs created = " + str(njobs)
     print "[calib] Submitting calibration handler"
-    submit_s = 'bsub -q ' + queueForDaemon + ' -o ' + workdir + '/calibration.log "source ' + env_script_n + '"'
+    if( executor=='local' ):
+        submit_s = 'nohup bash ' + env_script_n + ' > ' + workdir + '/calibration.log 2>&1 &'
+    else:
+        submit_s = 'bsub -q ' + queueForDaemon + ' -o ' + workdir + '/calibration.log "source ' + env_script_n + '"'
     print "[calib]  '-- " + submit_s
     
     # submitting calibration handler
     submitJobs = subprocess.Popen([submit_s], stdout=subprocess.PIPE, shell=True);
     output = (submitJobs.communicate()[0]).splitlines()
-    print "[calib]  '-- " + output[0]
+    if( output ):
+        print "[calib]  '-- " + output[0]
+    if( durableState ):
+        print "[calib]  '-- if the daemon dies, the same command resumes it from " + workdir + "/daemonState.db"
     
     #    print "usage thisPyton.py pwd njobs queue"
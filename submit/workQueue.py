@@ -0,0 +1,184 @@
+#!/usr/bin/env python
+
+# Pull-based distribution of the daemon's job scripts (fill, hadd, fit). The daemon runs a coordinator
+# on a TCP port; a few long-lived workers (sent to the batch queue, or run on this machine) ask it for
+# one script at a time, run it and come back for the next one, so fast workers take more units and a
+# slow node only delays the unit it holds. A unit is leased to its worker: the worker renews the lease
+# while the script runs, and a unit whose lease expires (worker killed, node lost) is handed out again.
+# Only the worker holding the lease may close the unit: a worker told LOST kills its script.
+#
+# Protocol, one line per connection, starting with the token of the coordinator (any other line gets ERROR):
+#   <token> GET <worker>               -> RUN <id> <lease> <script> <log or ->  |  WAIT  |  END
+#   <token> RENEW <id> <worker>        -> OK  |  LOST (the unit was handed to another worker)
+#   <token> DONE <id> <worker> <rc>    -> OK  |  LOST
+#
+# worker usage: python workQueue.py <host> <port> <workerName> <tokenFile>
+
+import os, sys, time, socket, signal, subprocess, threading, hmac, SocketServer
+
+class WorkQueueCoordinator:
+    def __init__( self, units, lease, retries ):
+        self.units = list( units )            # (script, log)
+        self.lease = lease
+        self.retries = retries
+        self.pending = range( len(self.units) )
+        self.leases = dict()                  # id -> (worker, expiry)
+        self.attempts = [ 0 for u in self.units ]
+        self.done = set()
+        self.failed = list()
+        self.lock = threading.Lock()
+
+    def expire( self ):
+        now = time.time()
+        for id, (worker, expiry) in self.leases.items():
+            if( expiry < now ):
+                print '[workQueue] :: lease of ' + self.units[id][0] + ' expired on ' + worker + ', handing it out again'
+                del self.leases[id]
+                self.pending.insert( 0, id )
+
+    def get( self, worker ):
+        with self.lock:
+            self.expire()
+            if not( self.pending ):
+                return 'WAIT' if self.leases else 'END'
+            id = self.pending.pop(0)
+            self.attempts[id] += 1
+            self.leases[id] = ( worker, time.time() + self.lease )
+            script, log = self.units[id]
+            return 'RUN ' + str(id) + ' ' + str(self.lease) + ' ' + script + ' ' + ( log if log else '-' )
+
+    def renew( self, id, worker ):
+        with self.lock:
+            if( id in self.leases and self.leases[id][0]==worker ):
+                self.leases[id] = ( worker, time.time() + self.lease )
+                return 'OK'
+            return 'LOST'
+
+    def finish( self, id, worker, rc ):
+        with self.lock:
+            # a worker whose lease expired may report late: the unit is someone else's (or pending) by now
+            if not( id in self.leases and self.leases[id][0]==worker ):
+                return 'LOST'
+            del self.leases[id]
+            if( rc==0 ):
+                self.done.add( id )
+            elif( self.attempts[id] <= self.retries ):
+                print '[workQueue] :: ' + self.units[id][0] + ' exited with ' + str(rc) + ' on ' + worker + ', handing it out again'
+                self.pending.append( id )
+            else:
+                print '[workQueue] :: ' + self.units[id][0] + ' exited with ' + str(rc) + ' on ' + worker + ', giving up'
+                self.done.add( id )
+                self.failed.append( self.units[id][0] )
+            return 'OK'
+
+    def finished( self ):
+        with self.lock:
+            return len(self.done)==len(self.units)
+
+    def remaining( self ):
+        with self.lock:
+            return len(self.units) - len(self.done)
+
+class WorkQueueHandler( SocketServer.StreamRequestHandler ):
+    def handle( self ):
+        words = self.rfile.readline().split()
+        coordinator = self.server.coordinator
+        if( not words or not hmac.compare_digest( words[0], self.server.token ) ):
+            reply = 'ERROR'
+        elif( len(words)==3 and words[1]=='GET' ):
+            reply = coordinator.get( words[2] )
+        elif( len(words)==4 and words[1]=='RENEW' and words[2].isdigit() ):
+            reply = coordinator.renew( int(words[2]), words[3] )
+        elif( len(words)==5 and words[1]=='DONE' and words[2].isdigit() and words[4].lstrip('-').isdigit() ):
+            reply = coordinator.finish( int(words[2]), words[3], int(words[4]) )
+        else:
+            reply = 'ERROR'
+        self.wfile.write( reply + '\n' )
+
+class WorkQueueServer( SocketServer.ThreadingMixIn, SocketServer.TCPServer ):
+    allow_reuse_address = True
+    daemon_threads = True
+
+def newToken( tokenFile ):
+    # random token of a campaign, readable only by its owner; the workers read it from the file
+    token = os.urandom( 16 ).encode( 'hex' )
+    if( os.path.exists( tokenFile ) ):
+        os.remove( tokenFile )
+    tokenFd = os.open( tokenFile, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0600 )
+    os.write( tokenFd, token + '\n' )
+    os.close( tokenFd )
+    return token
+
+def startCoordinator( units, lease, retries, bindAddress, token ):
+    # port chosen by the system; the coordinator serves from a thread of the daemon until shutdown()
+    server = WorkQueueServer( (bindAddress, 0), WorkQueueHandler )
+    server.token = token
+    server.coordinator = WorkQueueCoordinator( units, lease, retries )
+    thread = threading.Thread( target=server.serve_forever )
+    thread.daemon = True
+    thread.start()
+    return server
+
+def request( host, port, line ):
+    connection = socket.create_connection( (host, port), 30 )
+    try:
+        connection.sendall( line + '\n' )
+        return connection.makefile().readline().strip()
+    finally:
+        connection.close()
+
+def requestRetry( host, port, line, patience ):
+    # the coordinator may be busy for a moment; after patience seconds without it the worker gives up
+    start = time.time()
+    while True:
+        try:
+            return request( host, port, line )
+        except socket.error, e:
+            if( time.time() - start > patience ):
+                print '[workQueue] :: no coordinator at ' + host + ':' + str(port) + ' (' + str(e) + ')'
+                return None
+            time.sleep( 5 )
+
+def runWorker( host, port, worker, token ):
+    nUnits = 0
+    while True:
+        reply = requestRetry( host, port, token + ' GET ' + worker, 120 )
+        if( reply is None or reply=='END' ):
+            break
+        if( reply=='WAIT' ):
+            time.sleep( 10 )
+            continue
+        words = reply.split()
+        if( len(words)!=5 or words[0]!='RUN' ):
+            print '[workQueue] :: unexpected reply ' + reply
+            break
+        id, lease, script, log = words[1], float(words[2]), words[3], words[4]
+        print '[workQueue] :: ' + worker + ' running ' + script
+        out = open( os.devnull if log=='-' else log, 'w' )
+        # own process group, so that a lost unit is killed with the cmsRun/hadd it started
+        process = subprocess.Popen( [ 'bash', script ], stdout=out, stderr=subprocess.STDOUT, preexec_fn=os.setsid )
+        lastRenew = time.time()
+        lost = False
+        while( process.poll() is None ):
+            time.sleep( 1 )
+            if( time.time() - lastRenew > lease/3. ):
+                lastRenew = time.time()
+                if( requestRetry( host, port, token + ' RENEW ' + id + ' ' + worker, lease/3. )=='LOST' ):
+                    print '[workQueue] :: ' + worker + ' lost the lease of ' + script + ', killing it'
+                    os.killpg( process.pid, signal.SIGKILL )
+                    process.wait()
+                    lost = True
+        out.close()
+        if( lost ):
+            continue
+        if( requestRetry( host, port, token + ' DONE ' + id + ' ' + worker + ' ' + str(process.returncode), lease )=='LOST' ):
+            print '[workQueue] :: ' + worker + ' finished ' + script + ' after losing its lease, not counted'
+            continue
+        nUnits += 1
+    print '[workQueue] :: ' + worker + ' done after ' + str(nUnits) + ' units'
+
+if __name__ == '__main__':
+    if len(sys.argv) != 5:
+        print "usage workQueue.py host port workerName tokenFile"
+        sys.exit(1)
+    runWorker( sys.argv[1], int(sys.argv[2]), sys.argv[3], open( sys.argv[4] ).read().strip() )